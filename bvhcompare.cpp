@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <climits>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+#include "source/Cfg.h"
+#include "source/Logger.h"
+#include "source/ModelLoader.h"
+#include "source/accelstructures/BVH.h"
+
+using std::string;
+using std::vector;
+
+
+/**
+ * A way to build the BVH, given by the settings it needs.
+ */
+struct buildStrategy {
+	const char* name;
+	cl_uint buildMethod;
+	cl_uint sahBins;
+	cl_uint sahFacesLimit;
+	cl_float optimizeTime;
+};
+
+
+/**
+ * Find all OBJ files in a directory.
+ * @param  {const std::string}        dir Path to the directory.
+ * @return {std::vector<std::string>}     Sorted file names.
+ */
+vector<string> findModels( const string dir ) {
+	vector<string> models;
+	DIR* dp = opendir( dir.c_str() );
+
+	if( dp == NULL ) {
+		return models;
+	}
+
+	struct dirent* entry;
+
+	while( ( entry = readdir( dp ) ) != NULL ) {
+		string name( entry->d_name );
+
+		if( name.length() > 4 && name.compare( name.length() - 4, 4, ".obj" ) == 0 ) {
+			models.push_back( name );
+		}
+	}
+
+	closedir( dp );
+	std::sort( models.begin(), models.end() );
+
+	return models;
+}
+
+
+/**
+ * Build each model of a directory with every build strategy
+ * and print the quality metrics of the resulting BVHs.
+ */
+int main( int argc, char** argv ) {
+	setlocale( LC_ALL, "C" );
+	Cfg::get().loadConfigFile( "config.json" );
+
+	string dir = ( argc > 1 ) ? string( argv[1] ) : string( "resources/models/testing/" );
+
+	if( dir[dir.length() - 1] != '/' ) {
+		dir.append( "/" );
+	}
+
+	vector<string> models = findModels( dir );
+
+	if( models.size() == 0 ) {
+		Logger::logError( "Usage: PBR_bvhcompare [directory with OBJ files]" );
+		return EXIT_FAILURE;
+	}
+
+	const cl_uint bins = 32;
+	const buildStrategy strategies[] = {
+		{ "Mean split", BVH_BUILD_SAH, 0, 0, 0.0f },
+		{ "Full SAH", BVH_BUILD_SAH, 0, UINT_MAX, 0.0f },
+		{ "Binned SAH", BVH_BUILD_SAH, bins, 0, 0.0f },
+		{ "Binned+Opt", BVH_BUILD_SAH, bins, 0, 1000.0f },
+		{ "LBVH", BVH_BUILD_LBVH, bins, 0, 0.0f },
+		{ "LBVH+Opt", BVH_BUILD_LBVH, bins, 0, 1000.0f },
+		{ "SBVH", BVH_BUILD_SBVH, bins, 0, 0.0f }
+	};
+	const cl_uint numStrategies = sizeof( strategies ) / sizeof( strategies[0] );
+
+	// Only the table, no build messages.
+	Cfg::get().value( Cfg::LOG_LEVEL, 1 );
+	Cfg::get().value( Cfg::BVH_STATSEPO, true );
+
+	printf(
+		"%-20s %-12s %10s %8s %8s %6s %9s %10s %9s %7s\n",
+		"Model", "Strategy", "Build [ms]", "Nodes", "Leaves", "Depth",
+		"SAH cost", "Faces/leaf", "Overlap", "EPO"
+	);
+
+	for( cl_uint i = 0; i < models.size(); i++ ) {
+		ModelLoader* ml = new ModelLoader();
+		ml->loadModel( dir, models[i] );
+		ObjParser* op = ml->getObjParser();
+
+		for( cl_uint j = 0; j < numStrategies; j++ ) {
+			Cfg::get().value( Cfg::BVH_BUILDMETHOD, strategies[j].buildMethod );
+			Cfg::get().value( Cfg::BVH_SAHBINS, strategies[j].sahBins );
+			Cfg::get().value( Cfg::BVH_SAHFACESLIMIT, strategies[j].sahFacesLimit );
+			Cfg::get().value( Cfg::BVH_OPTIMIZETIME, strategies[j].optimizeTime );
+
+			BVH* bvh = new BVH( op->getObjects(), op->getVertices(), op->getNormals(), op->getInstances() );
+			BVHStats stats = bvh->getStats();
+
+			printf(
+				"%-20s %-12s %10.0f %8lu %8lu %6u %9.2f %10.2f %8.2f%% %7.2f\n",
+				models[i].c_str(), strategies[j].name, stats.buildTime,
+				bvh->getNodes().size(), bvh->getLeafNodes().size(), bvh->getDepth(),
+				stats.sahCost, stats.avgLeafFaces, stats.overlap * 100.0f, stats.epo
+			);
+
+			delete bvh;
+		}
+
+		delete ml;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+#include <clocale>
+#include <cstdlib>
+#include <string>
+
+#include "source/Cfg.h"
+#include "source/Logger.h"
+#include "source/OfflineRenderer.h"
+
+using std::string;
+
+
+int main( int argc, char** argv ) {
+	setlocale( LC_ALL, "C" );
+	Cfg::get().loadConfigFile( "config.json" );
+
+	if( argc < 2 ) {
+		Logger::logError( "Usage: PBR_headless <model.obj> [samples per pixel] [output image]" );
+		return EXIT_FAILURE;
+	}
+
+	string model( argv[1] );
+	cl_uint samples = ( argc > 2 ) ? atoi( argv[2] ) : 100;
+	string output = ( argc > 3 ) ? string( argv[3] ) : string( "render.png" );
+
+	size_t lastPath = model.rfind( "/" );
+	string filepath = ( lastPath == string::npos ) ? string( "./" ) : model.substr( 0, lastPath + 1 );
+	string filename = ( lastPath == string::npos ) ? model : model.substr( lastPath + 1 );
+
+	OfflineRenderer renderer;
+	renderer.loadModel( filepath, filename );
+	renderer.render( samples );
+
+	return renderer.saveImage( output ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
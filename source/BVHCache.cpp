@@ -0,0 +1,312 @@
+#include "BVHCache.h"
+
+using std::string;
+using std::vector;
+
+
+/**
+ * Constructor.
+ * @param {std::string} filepath Path to the OBJ file.
+ * @param {std::string} filename Name of the OBJ file.
+ */
+BVHCache::BVHCache( string filepath, string filename ) {
+	mModelFile = filepath + filename;
+	mCacheFile = mModelFile + ".bvhcache";
+	mData = NULL;
+	mSize = 0;
+	mKey = this->calcKey();
+}
+
+
+/**
+ * Destructor.
+ */
+BVHCache::~BVHCache() {
+	this->unload();
+}
+
+
+/**
+ * Calculate the key of the cache file. It changes with the model, its
+ * MTL and INSTANCES file and every setting that influences the BVH.
+ * @return {cl_ulong} The key.
+ */
+cl_ulong BVHCache::calcKey() {
+	cl_ulong hash = 14695981039346656037UL;
+
+	this->hashFile( mModelFile, &hash );
+
+	const char* sidecars[] = { ".mtl", ".instances" };
+
+	for( cl_uint i = 0; i < 2; i++ ) {
+		string file = mModelFile;
+		size_t extensionIndex = file.rfind( ".obj" );
+
+		if( extensionIndex != string::npos ) {
+			file.replace( extensionIndex, 4, sidecars[i] );
+			this->hashFile( file, &hash );
+		}
+	}
+
+	const char* keys[] = {
+		Cfg::ACCEL_STRUCT,
+		Cfg::BVH_BUILDMETHOD,
+		Cfg::BVH_LBVH_MORTONBITS,
+		Cfg::BVH_LBVH_SAHFACES,
+		Cfg::BVH_MAXFACES,
+		Cfg::BVH_NEARFIRST,
+		Cfg::BVH_OPTIMIZETIME,
+		Cfg::BVH_QUANTIZE,
+		Cfg::BVH_SAHBINS,
+		Cfg::BVH_SAHFACECOST,
+		Cfg::BVH_SAHFACESLIMIT,
+		Cfg::BVH_SBVH_ALPHA,
+		Cfg::BVH_SBVH_DUPLICATES,
+		Cfg::BVH_SKIPAHEAD,
+		Cfg::BVH_SKIPAHEAD_CMP,
+		Cfg::BVH_WIDTH,
+		Cfg::RENDER_PHONGTESS
+	};
+
+	for( cl_uint i = 0; i < sizeof( keys ) / sizeof( keys[0] ); i++ ) {
+		string value = Cfg::get().value<string>( keys[i] );
+		this->hashBytes( value.c_str(), value.length() + 1, &hash );
+	}
+
+	return hash;
+}
+
+
+/**
+ * Get the faces (normal indices) of the loaded cache.
+ * @return {const cl_uint4*} The faces.
+ */
+const cl_uint4* BVHCache::getFacesN() {
+	return (cl_uint4*) ( (char*) this->getFacesV() + sizeof( cl_uint4 ) * this->getHeader()->numFacesV );
+}
+
+
+/**
+ * Get the faces (vertex indices and material) of the loaded cache.
+ * @return {const cl_uint4*} The faces.
+ */
+const cl_uint4* BVHCache::getFacesV() {
+	return (cl_uint4*) ( (char*) this->getInstances() + sizeof( bvhInstance_cl ) * this->getHeader()->numInstances );
+}
+
+
+/**
+ * Get the header of the loaded cache.
+ * @return {const bvhCacheHeader*} The header.
+ */
+const bvhCacheHeader* BVHCache::getHeader() {
+	return (bvhCacheHeader*) mData;
+}
+
+
+/**
+ * Get the instances of the loaded cache.
+ * @return {const bvhInstance_cl*} The instances.
+ */
+const bvhInstance_cl* BVHCache::getInstances() {
+	const bvhCacheHeader* header = this->getHeader();
+
+	return (bvhInstance_cl*) ( this->getNodes() + (size_t) header->nodeSize * header->numNodes );
+}
+
+
+/**
+ * Get the BVH nodes of the loaded cache. Their type
+ * depends on the width of the BVH, see nodeSize of the header.
+ * @return {const char*} The nodes.
+ */
+const char* BVHCache::getNodes() {
+	return mData + sizeof( bvhCacheHeader );
+}
+
+
+/**
+ * Add data to a hash (FNV-1a, but on 8 bytes at a time
+ * to keep up with the size of the model files).
+ * @param {const void*}  data Data to add.
+ * @param {const size_t} size Size of the data in bytes.
+ * @param {cl_ulong*}    hash The hash to update.
+ */
+void BVHCache::hashBytes( const void* data, const size_t size, cl_ulong* hash ) {
+	const unsigned char* bytes = (const unsigned char*) data;
+	const cl_ulong prime = 1099511628211UL;
+	size_t i = 0;
+
+	for( ; i + 8 <= size; i += 8 ) {
+		cl_ulong word;
+		memcpy( &word, bytes + i, 8 );
+		*hash = ( *hash ^ word ) * prime;
+	}
+
+	for( ; i < size; i++ ) {
+		*hash = ( *hash ^ bytes[i] ) * prime;
+	}
+}
+
+
+/**
+ * Add the content of a file to a hash. A missing file only adds its absence.
+ * @param {const std::string} file File path and name.
+ * @param {cl_ulong*}         hash The hash to update.
+ */
+void BVHCache::hashFile( const string file, cl_ulong* hash ) {
+	int fd = open( file.c_str(), O_RDONLY );
+	struct stat st;
+
+	if( fd < 0 || fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+		if( fd >= 0 ) {
+			close( fd );
+		}
+		this->hashBytes( "-", 1, hash );
+
+		return;
+	}
+
+	void* content = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if( content == MAP_FAILED ) {
+		this->hashBytes( "-", 1, hash );
+
+		return;
+	}
+
+	cl_ulong size = st.st_size;
+	this->hashBytes( &size, sizeof( size ), hash );
+	this->hashBytes( content, st.st_size, hash );
+	munmap( content, st.st_size );
+}
+
+
+/**
+ * Map the cache file into memory, if it exists and fits the model and settings.
+ * @return {bool} True, if a valid cache has been loaded.
+ */
+bool BVHCache::load() {
+	this->unload();
+
+	int fd = open( mCacheFile.c_str(), O_RDONLY );
+
+	if( fd < 0 ) {
+		return false;
+	}
+
+	struct stat st;
+
+	if( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( bvhCacheHeader ) ) {
+		close( fd );
+
+		return false;
+	}
+
+	void* data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if( data == MAP_FAILED ) {
+		return false;
+	}
+
+	mData = (char*) data;
+	mSize = st.st_size;
+
+	const bvhCacheHeader* header = this->getHeader();
+	size_t expectedSize = sizeof( bvhCacheHeader ) +
+		(size_t) header->nodeSize * header->numNodes +
+		sizeof( bvhInstance_cl ) * header->numInstances +
+		sizeof( cl_uint4 ) * ( header->numFacesV + header->numFacesN );
+
+	if(
+		memcmp( header->magic, "PBR_BVH", 8 ) != 0 ||
+		header->version != BVH_CACHE_VERSION ||
+		header->key != mKey ||
+		expectedSize != mSize
+	) {
+		Logger::logDebug( "[BVHCache] Cache file is outdated. Rebuilding the BVH." );
+		this->unload();
+
+		return false;
+	}
+
+	char msg[256];
+	snprintf( msg, 256, "[BVHCache] Loaded BVH from \"%s\".", mCacheFile.c_str() );
+	Logger::logInfo( msg );
+
+	return true;
+}
+
+
+/**
+ * Unmap the cache file.
+ */
+void BVHCache::unload() {
+	if( mData != NULL ) {
+		munmap( mData, mSize );
+		mData = NULL;
+		mSize = 0;
+	}
+}
+
+
+/**
+ * Write the buffers of a built BVH to the cache file.
+ * The file is written under a temporary name first, so an aborted
+ * write never leaves a broken cache behind.
+ * @param  {const void*}                        nodes            BVH nodes.
+ * @param  {const size_t}                       numNodes         Number of BVH nodes.
+ * @param  {const cl_uint}                      nodeSize         Bytes per BVH node.
+ * @param  {const std::vector<bvhInstance_cl>*} instances        Instances.
+ * @param  {const std::vector<cl_uint4>*}       facesV           Faces (vertex indices and material).
+ * @param  {const std::vector<cl_uint4>*}       facesN           Faces (normal indices).
+ * @param  {const cl_uint}                      numTopLevelNodes Nodes of the main tree.
+ * @param  {const cl_uint}                      stackSize        Stack entries the traversal needs.
+ * @return {bool}                                                True, if the file has been written.
+ */
+bool BVHCache::write(
+	const void* nodes, const size_t numNodes, const cl_uint nodeSize,
+	const vector<bvhInstance_cl>* instances,
+	const vector<cl_uint4>* facesV, const vector<cl_uint4>* facesN,
+	const cl_uint numTopLevelNodes, const cl_uint stackSize
+) {
+	bvhCacheHeader header;
+	memset( &header, 0, sizeof( bvhCacheHeader ) );
+	memcpy( header.magic, "PBR_BVH", 8 );
+	header.version = BVH_CACHE_VERSION;
+	header.numTopLevelNodes = numTopLevelNodes;
+	header.key = mKey;
+	header.numNodes = numNodes;
+	header.numInstances = instances->size();
+	header.numFacesV = facesV->size();
+	header.numFacesN = facesN->size();
+	header.nodeSize = nodeSize;
+	header.stackSize = stackSize;
+
+	string tmpFile = mCacheFile + ".tmp";
+	std::ofstream fileOut( tmpFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+
+	fileOut.write( (const char*) &header, sizeof( bvhCacheHeader ) );
+	fileOut.write( (const char*) nodes, (size_t) nodeSize * numNodes );
+	fileOut.write( (const char*) instances->data(), sizeof( bvhInstance_cl ) * instances->size() );
+	fileOut.write( (const char*) facesV->data(), sizeof( cl_uint4 ) * facesV->size() );
+	fileOut.write( (const char*) facesN->data(), sizeof( cl_uint4 ) * facesN->size() );
+	fileOut.close();
+
+	char msg[256];
+
+	if( fileOut.fail() || rename( tmpFile.c_str(), mCacheFile.c_str() ) != 0 ) {
+		remove( tmpFile.c_str() );
+		snprintf( msg, 256, "[BVHCache] Could not write \"%s\".", mCacheFile.c_str() );
+		Logger::logWarning( msg );
+
+		return false;
+	}
+
+	snprintf( msg, 256, "[BVHCache] Wrote BVH to \"%s\".", mCacheFile.c_str() );
+	Logger::logInfo( msg );
+
+	return true;
+}
@@ -0,0 +1,79 @@
+#ifndef BVHCACHE_H
+#define BVHCACHE_H
+
+#include "cl.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Cfg.h"
+#include "Logger.h"
+#include "PathTracer.h"
+
+// Increase if the layout of the file or of the stored structs changes.
+#define BVH_CACHE_VERSION 4
+
+using std::string;
+using std::vector;
+
+
+/**
+ * Layout of a cache file:
+ * header, BVH nodes, instances, facesV, facesN.
+ * The header has 64 bytes, so the arrays following it stay 16 byte aligned.
+ */
+struct bvhCacheHeader {
+	char magic[8];
+	cl_uint version;
+	cl_uint numTopLevelNodes;
+	cl_ulong key;
+	cl_ulong numNodes;
+	cl_ulong numInstances;
+	cl_ulong numFacesV;
+	cl_ulong numFacesN;
+	cl_uint nodeSize;  // Bytes per node, depending on the width of the BVH
+	cl_uint stackSize; // Stack entries the traversal of a wide BVH needs
+};
+
+
+class BVHCache {
+
+	public:
+		BVHCache( string filepath, string filename );
+		~BVHCache();
+		const cl_uint4* getFacesN();
+		const cl_uint4* getFacesV();
+		const bvhCacheHeader* getHeader();
+		const bvhInstance_cl* getInstances();
+		const char* getNodes();
+		bool load();
+		bool write(
+			const void* nodes, const size_t numNodes, const cl_uint nodeSize,
+			const vector<bvhInstance_cl>* instances,
+			const vector<cl_uint4>* facesV, const vector<cl_uint4>* facesN,
+			const cl_uint numTopLevelNodes, const cl_uint stackSize
+		);
+
+	protected:
+		cl_ulong calcKey();
+		void hashBytes( const void* data, const size_t size, cl_ulong* hash );
+		void hashFile( const string file, cl_ulong* hash );
+		void unload();
+
+	private:
+		string mCacheFile;
+		string mModelFile;
+		cl_ulong mKey;
+
+		char* mData;
+		size_t mSize;
+
+};
+
+#endif
@@ -9,10 +9,22 @@ using std::vector;
  */
 CL::CL( const bool silent ) {
 	mCommandQueue = NULL;
+	mTransferQueue = NULL;
 	mContext = NULL;
 	mDevice = NULL;
 	mPlatform = NULL;
 	mProgram = NULL;
+	mFlushEvent = NULL;
+
+	mReadbackIndex = 0;
+	mReadbackSize = 0;
+
+	for( cl_uint i = 0; i < 2; i++ ) {
+		mReadbackBuffers[i] = NULL;
+		mReadbackPinned[i] = NULL;
+		mReadbackData[i] = NULL;
+		mReadbackEvents[i] = NULL;
+	}
 
 	mDoCheckErrors = Cfg::get().value<bool>( Cfg::OPENCL_CHECKERRORS );
 	mWorkWidth = Cfg::get().value<cl_uint>( Cfg::WINDOW_WIDTH );
@@ -30,13 +42,16 @@ CL::CL( const bool silent ) {
 CL::~CL() {
 	cl_int err;
 
+	this->finish();
+	this->freeReadbackBuffers();
 	this->freeBuffers();
 
-	for( uint i = 0; i < mKernels.size(); i++ ) {
-		err = clReleaseKernel( mKernels[i] );
-		this->checkError( err, "clReleaseKernel" );
+	if( mFlushEvent != NULL ) {
+		clReleaseEvent( mFlushEvent );
 	}
 
+	this->freeKernels();
+
 	if( mProgram ) {
 		err = clReleaseProgram( mProgram );
 		this->checkError( err, "clReleaseProgram" );
@@ -45,6 +60,10 @@ CL::~CL() {
 		err = clReleaseCommandQueue( mCommandQueue );
 		this->checkError( err, "clReleaseCommandQueue" );
 	}
+	if( mTransferQueue ) {
+		err = clReleaseCommandQueue( mTransferQueue );
+		this->checkError( err, "clReleaseCommandQueue" );
+	}
 	if( mContext ) {
 		err = clReleaseContext( mContext );
 		this->checkError( err, "clReleaseContext" );
@@ -127,6 +146,22 @@ string CL::combineParts( string filepath ) {
 }
 
 
+/**
+ * Create a buffer and fill it with data from any host memory, e.g. a mapped file.
+ * @param  {const void*} data Data to copy into the buffer.
+ * @param  {size_t}      size Size of the data in bytes.
+ * @return {cl_mem}           Handle for the buffer.
+ */
+cl_mem CL::createBuffer( const void* data, size_t size ) {
+	cl_int err;
+	cl_mem buffer = clCreateBuffer( mContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, (void*) data, &err );
+	this->checkError( err, "clCreateBuffer" );
+	mMemObjects.push_back( buffer );
+
+	return buffer;
+}
+
+
 /**
  * Create an empty buffer that can be updated with data later.
  * @param  {size_t}       size  Size of the buffer.
@@ -163,15 +198,36 @@ cl_mem CL::createImage2DReadOnly( size_t width, size_t height, cl_float* data )
 
 	size_t origin[] = { 0, 0, 0 }; // Defines the offset in pixels in the image from where to write.
 	size_t region[] = { width, height, 1 }; // Size of object to be transferred
-	cl_event event;
 
-	const cl_event* eventWaitList = ( mEvents.size() == 0 ) ? NULL : &( mEvents[0] );
-	err = clEnqueueWriteImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, data, (cl_uint) mEvents.size(), eventWaitList, &event );
+	err = clEnqueueWriteImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, data, 0, NULL, NULL );
 	this->checkError( err, "clEnqueueWriteImage" );
 
-	if( event != NULL ) {
-		mEvents.push_back( event );
-	}
+	return image;
+}
+
+
+/**
+ * Create a buffer for a 2D image that can be read and written in the OpenCL context, and fill it with data.
+ * @param  {size_t}    width  Width of the image.
+ * @param  {size_t}    height Height of the image.
+ * @param  {cl_float*} data   Data of the image.
+ * @return {cl_mem}           Handle for the buffer.
+ */
+cl_mem CL::createImage2DReadWrite( size_t width, size_t height, cl_float* data ) {
+	cl_int err;
+	cl_image_format format;
+
+	format.image_channel_order = CL_RGBA;
+	format.image_channel_data_type = CL_FLOAT;
+
+	cl_mem image = clCreateImage2D( mContext, CL_MEM_READ_WRITE, &format, width, height, 0, NULL, &err );
+	this->checkError( err, "clCreateImage2D" );
+
+	size_t origin[] = { 0, 0, 0 };
+	size_t region[] = { width, height, 1 };
+
+	err = clEnqueueWriteImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, data, 0, NULL, NULL );
+	this->checkError( err, "clEnqueueWriteImage" );
 
 	return image;
 }
@@ -283,7 +339,8 @@ const char* CL::errorCodeToName( cl_int errorCode ) {
 
 
 /**
- * Execute a kernel.
+ * Execute a kernel. Only enqueues it, use flush() or finish() to wait for it.
+ * The command queue is in order, so later commands see its results.
  * @param {cl_kernel} kernel Handle of the kernel to execute.
  */
 void CL::execute( cl_kernel kernel ) {
@@ -295,24 +352,78 @@ void CL::execute( cl_kernel kernel ) {
 		Cfg::get().value<size_t>( Cfg::OPENCL_LOCALGROUPSIZE ),
 		Cfg::get().value<size_t>( Cfg::OPENCL_LOCALGROUPSIZE )
 	};
-	const cl_event* eventWaitList = ( mEvents.size() == 0 ) ? NULL : &( mEvents[0] );
-	err = clEnqueueNDRangeKernel( mCommandQueue, kernel, 2, NULL, globalWorkSize, localWorkSize, (cl_uint) mEvents.size(), eventWaitList, &event );
+	err = clEnqueueNDRangeKernel( mCommandQueue, kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, &event );
 	this->checkError( err, "clEnqueueNDRangeKernel" );
 
-	if( event != NULL ) {
-		mEvents.push_back( event );
-		mKernelTime[kernel] = this->getKernelExecutionTime( event );
-	}
+	this->setKernelEvent( kernel, event );
+}
+
+
+/**
+ * Execute a kernel in one dimension.
+ * @param {cl_kernel} kernel       Handle of the kernel to execute.
+ * @param {size_t}    numWorkItems Number of work items needed. Rounded up to the local group size.
+ */
+void CL::execute( cl_kernel kernel, size_t numWorkItems ) {
+	cl_int err;
+	cl_event event;
+
+	size_t lgs = Cfg::get().value<size_t>( Cfg::OPENCL_LOCALGROUPSIZE );
+	size_t localWorkSize = lgs * lgs;
+	size_t globalWorkSize = ( ( numWorkItems + localWorkSize - 1 ) / localWorkSize ) * localWorkSize;
+
+	err = clEnqueueNDRangeKernel( mCommandQueue, kernel, 1, NULL, &globalWorkSize, &localWorkSize, 0, NULL, &event );
+	this->checkError( err, "clEnqueueNDRangeKernel" );
+
+	this->setKernelEvent( kernel, event );
 }
 
 
 /**
- * Finish a kernel execution by flushing the command queue and clearing all events.
+ * Finish all enqueued commands, including the transfers.
  */
 void CL::finish() {
 	clFlush( mCommandQueue );
 	clFinish( mCommandQueue );
-	mEvents.clear();
+	clFinish( mTransferQueue );
+}
+
+
+/**
+ * Submit the enqueued commands without waiting for them. Waits for the
+ * commands submitted up to the previous call instead, so the host can
+ * prepare the next frame while the device works, but stays at most
+ * one frame ahead.
+ */
+void CL::flush() {
+	cl_event event;
+	cl_int err = clEnqueueMarker( mCommandQueue, &event );
+	this->checkError( err, "clEnqueueMarker" );
+	clFlush( mCommandQueue );
+
+	if( mFlushEvent != NULL ) {
+		clWaitForEvents( 1, &mFlushEvent );
+		clReleaseEvent( mFlushEvent );
+	}
+
+	mFlushEvent = event;
+}
+
+
+/**
+ * Free a single memory object.
+ * @param {cl_mem} buffer Handle of the buffer.
+ */
+void CL::freeBuffer( cl_mem buffer ) {
+	vector<cl_mem>::iterator it = std::find( mMemObjects.begin(), mMemObjects.end(), buffer );
+
+	if( it == mMemObjects.end() ) {
+		return;
+	}
+
+	cl_int err = clReleaseMemObject( buffer );
+	this->checkError( err, "clReleaseMemObject" );
+	mMemObjects.erase( it );
 }
 
 
@@ -331,6 +442,62 @@ void CL::freeBuffers() {
 }
 
 
+/**
+ * Release all kernels, for example before creating them anew from a rebuilt program.
+ * Their names and execution times are discarded as well.
+ */
+void CL::freeKernels() {
+	cl_int err;
+
+	for( map<cl_kernel, cl_event>::iterator it = mKernelEvents.begin(); it != mKernelEvents.end(); it++ ) {
+		clReleaseEvent( it->second );
+	}
+
+	for( uint i = 0; i < mKernels.size(); i++ ) {
+		err = clReleaseKernel( mKernels[i] );
+		this->checkError( err, "clReleaseKernel" );
+	}
+
+	mKernels.clear();
+	mKernelEvents.clear();
+	mKernelNames.clear();
+	mKernelTime.clear();
+}
+
+
+/**
+ * Free the pinned host buffers of the readback.
+ */
+void CL::freeReadbackBuffers() {
+	cl_int err;
+
+	for( cl_uint i = 0; i < 2; i++ ) {
+		if( mReadbackEvents[i] != NULL ) {
+			clWaitForEvents( 1, &mReadbackEvents[i] );
+			clReleaseEvent( mReadbackEvents[i] );
+			mReadbackEvents[i] = NULL;
+		}
+
+		if( mReadbackPinned[i] != NULL ) {
+			err = clEnqueueUnmapMemObject( mTransferQueue, mReadbackPinned[i], mReadbackData[i], 0, NULL, NULL );
+			this->checkError( err, "clEnqueueUnmapMemObject" );
+			clFinish( mTransferQueue );
+
+			err = clReleaseMemObject( mReadbackPinned[i] );
+			this->checkError( err, "clReleaseMemObject" );
+			err = clReleaseMemObject( mReadbackBuffers[i] );
+			this->checkError( err, "clReleaseMemObject" );
+
+			mReadbackPinned[i] = NULL;
+			mReadbackBuffers[i] = NULL;
+			mReadbackData[i] = NULL;
+		}
+	}
+
+	mReadbackSize = 0;
+}
+
+
 /**
  * Get the default device of the platform.
  * @param {const bool} silent
@@ -475,12 +642,12 @@ void CL::getDefaultPlatform( const bool silent ) {
 
 /**
  * Returns the kernel execution time in milliseconds.
+ * The kernel has to be finished.
  * @return {double} Time it took to execute the kernel in milliseconds.
  */
 double CL::getKernelExecutionTime( cl_event kernelEvent ) {
 	cl_ulong timeEnd, timeStart;
 
-	clWaitForEvents( 1, &kernelEvent );
 	clGetEventProfilingInfo( kernelEvent, CL_PROFILING_COMMAND_START, sizeof( timeStart ), &timeStart, NULL );
 	clGetEventProfilingInfo( kernelEvent, CL_PROFILING_COMMAND_END, sizeof( timeEnd ), &timeEnd, NULL );
 
@@ -498,10 +665,28 @@ map<cl_kernel, string> CL::getKernelNames() {
 
 
 /**
- * Get the last profiled kernel execution times.
+ * Get the last profiled kernel execution times. The times are only taken
+ * here, from the kernels that have finished by now, so profiling does
+ * not hold up the command queue.
  * @return {std::map<cl_kernel, double>} Map of kernel ID to execution time [ms].
  */
 map<cl_kernel, double> CL::getKernelTimes() {
+	map<cl_kernel, cl_event>::iterator it = mKernelEvents.begin();
+
+	while( it != mKernelEvents.end() ) {
+		cl_int status;
+		clGetEventInfo( it->second, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof( status ), &status, NULL );
+
+		if( status != CL_COMPLETE ) {
+			it++;
+			continue;
+		}
+
+		mKernelTime[it->first] = this->getKernelExecutionTime( it->second );
+		clReleaseEvent( it->second );
+		mKernelEvents.erase( it++ );
+	}
+
 	return mKernelTime;
 }
 
@@ -531,7 +716,8 @@ void CL::initContext( cl_device_id* devices ) {
 
 
 /**
- * Initialise the OpenCL command queue.
+ * Initialise the OpenCL command queues. One for the kernels and one
+ * for the readback, so transfers can run while the kernels do.
  */
 void CL::initCommandQueue() {
 	cl_int err;
@@ -541,12 +727,48 @@ void CL::initCommandQueue() {
 		exit( EXIT_FAILURE );
 	}
 
+	mTransferQueue = clCreateCommandQueue( mContext, mDevice, 0, &err );
+
+	if( !this->checkError( err, "clCreateCommandQueue" ) ) {
+		exit( EXIT_FAILURE );
+	}
+
 	char msg[64];
-	snprintf( msg, 64, "[OpenCL] Command queue created." );
+	snprintf( msg, 64, "[OpenCL] Command queues created." );
 	Logger::logDebug( msg );
 }
 
 
+/**
+ * Create two buffers on the device and two in pinned host memory
+ * for the double-buffered readback.
+ * @param {size_t} size Size of each buffer in bytes.
+ */
+void CL::initReadbackBuffers( size_t size ) {
+	cl_int err;
+
+	this->freeReadbackBuffers();
+
+	for( cl_uint i = 0; i < 2; i++ ) {
+		mReadbackBuffers[i] = clCreateBuffer( mContext, CL_MEM_WRITE_ONLY, size, NULL, &err );
+		this->checkError( err, "clCreateBuffer" );
+
+		mReadbackPinned[i] = clCreateBuffer( mContext, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, &err );
+		this->checkError( err, "clCreateBuffer" );
+
+		// The mapped pointer stays valid and page-locked until the buffer is unmapped.
+		mReadbackData[i] = (cl_float*) clEnqueueMapBuffer(
+			mTransferQueue, mReadbackPinned[i], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+			0, size, 0, NULL, NULL, &err
+		);
+		this->checkError( err, "clEnqueueMapBuffer" );
+	}
+
+	mReadbackIndex = 0;
+	mReadbackSize = size;
+}
+
+
 /**
  * Load a program.
  * @param {string} filepath Path to the CL code file.
@@ -559,6 +781,13 @@ void CL::loadProgram( string filepath ) {
 	const size_t clProgramLength = clProgramString.size();
 
 	cl_int err;
+
+	// Kernels created from the old program keep it alive as long as they need it.
+	if( mProgram ) {
+		err = clReleaseProgram( mProgram );
+		this->checkError( err, "clReleaseProgram" );
+	}
+
 	mProgram = clCreateProgramWithSource( mContext, 1, &clProgramChar, &clProgramLength, &err );
 
 	if( !this->checkError( err, "clCreateProgramWithSource" ) ) {
@@ -571,6 +800,39 @@ void CL::loadProgram( string filepath ) {
 }
 
 
+/**
+ * Read the content of a buffer.
+ * @param {cl_mem} buffer Handle of the buffer.
+ * @param {size_t} size   Size of the data to read in bytes.
+ * @param {void*}  data   Write target for the data.
+ */
+void CL::readBuffer( cl_mem buffer, size_t size, void* data ) {
+	cl_int err;
+
+	err = clEnqueueReadBuffer( mCommandQueue, buffer, CL_TRUE, 0, size, data, 0, NULL, NULL );
+	this->checkError( err, "clEnqueueReadBuffer" );
+}
+
+
+/**
+ * Read the content of a buffer without waiting for it. The target
+ * has to stay valid until the returned event has completed.
+ * @param  {cl_mem}   buffer Handle of the buffer.
+ * @param  {size_t}   size   Size of the data to read in bytes.
+ * @param  {void*}    data   Write target for the data.
+ * @return {cl_event}        Event of the read. Release it with waitForEvent() or releaseEvent().
+ */
+cl_event CL::readBufferAsync( cl_mem buffer, size_t size, void* data ) {
+	cl_int err;
+	cl_event event;
+
+	err = clEnqueueReadBuffer( mCommandQueue, buffer, CL_FALSE, 0, size, data, 0, NULL, &event );
+	this->checkError( err, "clEnqueueReadBuffer" );
+
+	return event;
+}
+
+
 /**
  * Read the content of an image buffer.
  * @param {cl_mem}    image        Handle to the image buffer.
@@ -580,17 +842,71 @@ void CL::loadProgram( string filepath ) {
  */
 void CL::readImageOutput( cl_mem image, size_t width, size_t height, cl_float* outputTarget ) {
 	cl_int err;
-	cl_event event;
 	size_t origin[] = { 0, 0, 0 };
 	size_t region[] = { width, height, 1 };
 
-	const cl_event* eventWaitList = ( mEvents.size() == 0 ) ? NULL : &( mEvents[0] );
-	err = clEnqueueReadImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, outputTarget, (cl_uint) mEvents.size(), eventWaitList, &event );
+	err = clEnqueueReadImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, outputTarget, 0, NULL, NULL );
 	this->checkError( err, "clEnqueueReadImage" );
+}
 
-	if( event != NULL ) {
-		mEvents.push_back( event );
+
+/**
+ * Start reading an image into one of two alternating pinned host buffers
+ * and get the data of the previous call. The image is copied on the device
+ * after the kernels enqueued so far, and the transfer to the host runs on
+ * its own queue, so it overlaps with the kernels of the next frame.
+ * @param  {cl_mem}    image  Handle to the image buffer.
+ * @param  {size_t}    width  Width of the image.
+ * @param  {size_t}    height Height of the image.
+ * @return {cl_float*}        Image data of the previous call. NULL on the first call.
+ *                            Valid until the next call.
+ */
+cl_float* CL::readImageOutputAsync( cl_mem image, size_t width, size_t height ) {
+	size_t size = width * height * 4 * sizeof( cl_float );
+
+	if( size != mReadbackSize ) {
+		this->initReadbackBuffers( size );
 	}
+
+	cl_int err;
+	cl_event copyEvent;
+	cl_uint i = mReadbackIndex;
+	size_t origin[] = { 0, 0, 0 };
+	size_t region[] = { width, height, 1 };
+
+	// The transfer of this buffer has been waited for by the previous call.
+	err = clEnqueueCopyImageToBuffer( mCommandQueue, image, mReadbackBuffers[i], origin, region, 0, 0, NULL, &copyEvent );
+	this->checkError( err, "clEnqueueCopyImageToBuffer" );
+	clFlush( mCommandQueue );
+
+	if( mReadbackEvents[i] != NULL ) {
+		clReleaseEvent( mReadbackEvents[i] );
+	}
+
+	err = clEnqueueReadBuffer( mTransferQueue, mReadbackBuffers[i], CL_FALSE, 0, size, mReadbackData[i], 1, &copyEvent, &mReadbackEvents[i] );
+	this->checkError( err, "clEnqueueReadBuffer" );
+	clFlush( mTransferQueue );
+	clReleaseEvent( copyEvent );
+
+	mReadbackIndex = 1 - i;
+
+	if( mReadbackEvents[mReadbackIndex] == NULL ) {
+		return NULL;
+	}
+
+	clWaitForEvents( 1, &mReadbackEvents[mReadbackIndex] );
+
+	return mReadbackData[mReadbackIndex];
+}
+
+
+/**
+ * Release an event without waiting for it.
+ * @param {cl_event} event The event.
+ */
+void CL::releaseEvent( cl_event event ) {
+	cl_int err = clReleaseEvent( event );
+	this->checkError( err, "clReleaseEvent" );
 }
 
 
@@ -607,6 +923,26 @@ void CL::setKernelArg( cl_kernel kernel, cl_uint index, size_t size, void* data
 }
 
 
+/**
+ * Keep the event of the last execution of a kernel, to profile it later.
+ * @param {cl_kernel} kernel Handle of the kernel.
+ * @param {cl_event}  event  Event of the execution.
+ */
+void CL::setKernelEvent( cl_kernel kernel, cl_event event ) {
+	if( event == NULL ) {
+		return;
+	}
+
+	map<cl_kernel, cl_event>::iterator it = mKernelEvents.find( kernel );
+
+	if( it != mKernelEvents.end() ) {
+		clReleaseEvent( it->second );
+	}
+
+	mKernelEvents[kernel] = event;
+}
+
+
 /**
  * Set a string replacement to apply it later to the CL code.
  * @param {std::string} before Old value.
@@ -637,24 +973,30 @@ string CL::setValues( string clProgramString ) {
 	valueReplace.clear();
 	valueReplace.push_back( "ACCEL_STRUCT" );
 	valueReplace.push_back( "BRDF" );
+	valueReplace.push_back( "DEBUG_IMAGE" );
 	valueReplace.push_back( "IMG_HEIGHT" );
 	valueReplace.push_back( "IMG_WIDTH" );
 	valueReplace.push_back( "SHADOW_RAYS" );
 	valueReplace.push_back( "MAX_DEPTH" );
 	valueReplace.push_back( "MAX_ADDED_DEPTH" );
+	valueReplace.push_back( "PATH_REGENERATION" );
 	valueReplace.push_back( "PHONGTESS" );
 	valueReplace.push_back( "SAMPLES" );
+	valueReplace.push_back( "WAVEFRONT" );
 
 	vector<cl_uint> configInt;
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::ACCEL_STRUCT ) );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::RENDER_BRDF ) );
+	configInt.push_back( Cfg::get().value<bool>( Cfg::RENDER_DEBUGIMAGE ) ? 1 : 0 );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::WINDOW_HEIGHT ) );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::WINDOW_WIDTH ) );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::RENDER_SHADOWRAYS ) );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::RENDER_MAXDEPTH ) );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::RENDER_MAXADDEDDEPTH ) );
+	configInt.push_back( Cfg::get().value<bool>( Cfg::RENDER_PATHREGENERATION ) ? 1 : 0 );
 	configInt.push_back( PhongTess_ALPHA > 0.0f ? 1 : 0 );
 	configInt.push_back( Cfg::get().value<cl_uint>( Cfg::RENDER_SAMPLES ) );
+	configInt.push_back( Cfg::get().value<bool>( Cfg::RENDER_WAVEFRONT ) ? 1 : 0 );
 
 	for( int i = 0; i < valueReplace.size(); i++ ) {
 		search = "#" + valueReplace[i] + "#";
@@ -707,22 +1049,17 @@ string CL::setValues( string clProgramString ) {
 
 /**
  * Update the data of a buffer.
- * @param  {cl_mem} buffer Handle of the buffer.
- * @param  {size_t} size   Size of the data to write into it.
- * @param  {void*}  data   Pointer to the data.
- * @return {cl_mem}        Handle of the buffer.
+ * @param  {cl_mem}       buffer Handle of the buffer.
+ * @param  {size_t}       size   Size of the data to write into it.
+ * @param  {void*}        data   Pointer to the data.
+ * @param  {const size_t} offset Offset in bytes in the buffer to start writing at.
+ * @return {cl_mem}              Handle of the buffer.
  */
-cl_mem CL::updateBuffer( cl_mem buffer, size_t size, void* data ) {
-	cl_event event;
+cl_mem CL::updateBuffer( cl_mem buffer, size_t size, void* data, const size_t offset ) {
 
-	const cl_event* eventWaitList = ( mEvents.size() == 0 ) ? NULL : &( mEvents[0] );
-	cl_int err = clEnqueueWriteBuffer( mCommandQueue, buffer, CL_TRUE, 0, size, data, (cl_uint) mEvents.size(), eventWaitList, &event );
+	cl_int err = clEnqueueWriteBuffer( mCommandQueue, buffer, CL_TRUE, offset, size, data, 0, NULL, NULL );
 	this->checkError( err, "clEnqueueWriteBuffer" );
 
-	if( event != NULL ) {
-		mEvents.push_back( event );
-	}
-
 	return buffer;
 }
 
@@ -739,15 +1076,21 @@ cl_mem CL::updateImageReadOnly( cl_mem image, size_t width, size_t height, cl_fl
 	size_t origin[] = { 0, 0, 0 };
 	size_t region[] = { width, height, 1 };
 	cl_int err;
-	cl_event event;
 
-	const cl_event* eventWaitList = ( mEvents.size() == 0 ) ? NULL : &( mEvents[0] );
-	err = clEnqueueWriteImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, data, (cl_uint) mEvents.size(), eventWaitList, &event );
+	err = clEnqueueWriteImage( mCommandQueue, image, CL_TRUE, origin, region, 0, 0, data, 0, NULL, NULL );
 	this->checkError( err, "clEnqueueWriteImage" );
 
-	if( event != NULL ) {
-		mEvents.push_back( event );
-	}
-
 	return image;
 }
+
+
+/**
+ * Wait for an event to complete and release it.
+ * @param {cl_event} event The event.
+ */
+void CL::waitForEvent( cl_event event ) {
+	cl_int err = clWaitForEvents( 1, &event );
+	this->checkError( err, "clWaitForEvents" );
+
+	this->releaseEvent( event );
+}
@@ -3,8 +3,9 @@
 
 #include "cl.hpp"
 #include <GL/gl.h>
+#include <algorithm>
 #include <iostream>
-#include <QGLWidget>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -32,32 +33,46 @@ class CL {
 			return buffer;
 		}
 
+		cl_mem createBuffer( const void* data, size_t size );
 		cl_mem createEmptyBuffer( size_t size, cl_mem_flags flags );
 		cl_mem createImage2DReadOnly( size_t width, size_t height, cl_float* data );
+		cl_mem createImage2DReadWrite( size_t width, size_t height, cl_float* data );
 		cl_mem createImage2DWriteOnly( size_t width, size_t height );
 		cl_kernel createKernel( const char* functionName );
 		void execute( cl_kernel kernel );
+		void execute( cl_kernel kernel, size_t numWorkItems );
 		void finish();
+		void flush();
+		void freeBuffer( cl_mem buffer );
 		void freeBuffers();
+		void freeKernels();
 		map<cl_kernel, string> getKernelNames();
 		map<cl_kernel, double> getKernelTimes();
 		void loadProgram( string filepath );
+		void readBuffer( cl_mem buffer, size_t size, void* data );
+		cl_event readBufferAsync( cl_mem buffer, size_t size, void* data );
 		void readImageOutput( cl_mem image, size_t width, size_t height, cl_float* outputTarget );
+		cl_float* readImageOutputAsync( cl_mem image, size_t width, size_t height );
+		void releaseEvent( cl_event event );
 		void setKernelArg( cl_kernel kernel, cl_uint index, size_t size, void* data );
 		void setReplacement( string before, string after );
-		cl_mem updateBuffer( cl_mem buffer, size_t size, void* data );
+		cl_mem updateBuffer( cl_mem buffer, size_t size, void* data, const size_t offset = 0 );
 		cl_mem updateImageReadOnly( cl_mem image, size_t width, size_t height, cl_float* data );
+		void waitForEvent( cl_event event );
 
 	protected:
 		void buildProgram();
 		bool checkError( cl_int err, const char* functionName );
 		string combineParts( string filepath );
 		const char* errorCodeToName( cl_int errorCode );
+		void freeReadbackBuffers();
 		void getDefaultDevice( const bool silent = false );
 		void getDefaultPlatform( const bool silent = false );
 		double getKernelExecutionTime( cl_event kernelEvent );
 		void initCommandQueue();
 		void initContext( cl_device_id* devices );
+		void initReadbackBuffers( size_t size );
+		void setKernelEvent( cl_kernel kernel, cl_event event );
 		string setValues( string clProgramString );
 
 	private:
@@ -66,16 +81,27 @@ class CL {
 		cl_uint mWorkWidth;
 
 		cl_command_queue mCommandQueue;
+		cl_command_queue mTransferQueue;
 		cl_context mContext;
 		cl_device_id mDevice;
 		cl_kernel mKernel;
 		cl_platform_id mPlatform;
 		cl_program mProgram;
 
+		cl_event mFlushEvent;
+
+		// Double-buffered readback
+		cl_uint mReadbackIndex;
+		size_t mReadbackSize;
+		cl_mem mReadbackBuffers[2]; // Copies of the image on the device
+		cl_mem mReadbackPinned[2];  // Page-locked host memory
+		cl_float* mReadbackData[2]; // Mapped pointers of mReadbackPinned
+		cl_event mReadbackEvents[2];
+
 		vector<cl_kernel> mKernels;
-		vector<cl_event> mEvents;
 		vector<cl_mem> mMemObjects;
 
+		map<cl_kernel, cl_event> mKernelEvents; // Not profiled yet
 		map<cl_kernel, string> mKernelNames;
 		map<cl_kernel, double> mKernelTime;
 		map<string, string> mReplaceString;
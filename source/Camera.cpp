@@ -1,5 +1,9 @@
 #include "Camera.h"
 
+#ifndef PBR_HEADLESS
+	#include "qt/GLWidget.h"
+#endif
+
 using std::vector;
 
 
@@ -245,7 +249,9 @@ void Camera::updateCameraRot( int moveX, int moveY ) {
  * Inform the parent object that the camera has been changed.
  */
 void Camera::updateParent() {
-	if( mParent != NULL ) {
-		mParent->cameraUpdate();
-	}
+	#ifndef PBR_HEADLESS
+		if( mParent != NULL ) {
+			mParent->cameraUpdate();
+		}
+	#endif
 }
@@ -6,7 +6,6 @@
 #include <vector>
 
 #include "Cfg.h"
-#include "qt/GLWidget.h"
 #include "MathHelp.h"
 
 using std::vector;
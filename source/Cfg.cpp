@@ -2,10 +2,27 @@
 
 
 const char* Cfg::ACCEL_STRUCT = "accel_struct";
+const char* Cfg::BVH_BUILDMETHOD = "bvh.build_method";
+const char* Cfg::BVH_BUILDTHREADS = "bvh.build_threads";
+const char* Cfg::BVH_CACHE = "bvh.cache";
+const char* Cfg::BVH_LBVH_MORTONBITS = "bvh.lbvh_morton_bits";
+const char* Cfg::BVH_LBVH_SAHFACES = "bvh.lbvh_sah_faces";
 const char* Cfg::BVH_MAXFACES = "bvh.max_faces";
+const char* Cfg::BVH_NEARFIRST = "bvh.near_first";
+const char* Cfg::BVH_OPTIMIZETIME = "bvh.optimize_time";
+const char* Cfg::BVH_PARALLELFACES = "bvh.build_parallel_faces";
+const char* Cfg::BVH_PROFILEFRAMES = "bvh.profile_frames";
+const char* Cfg::BVH_PROFILESWAP = "bvh.profile_swap";
+const char* Cfg::BVH_QUANTIZE = "bvh.quantize";
+const char* Cfg::BVH_SAHBINS = "bvh.sah_bins";
+const char* Cfg::BVH_SAHFACECOST = "bvh.sah_face_cost";
 const char* Cfg::BVH_SAHFACESLIMIT = "bvh.sah_faces_limit";
+const char* Cfg::BVH_SBVH_ALPHA = "bvh.sbvh_alpha";
+const char* Cfg::BVH_SBVH_DUPLICATES = "bvh.sbvh_duplicates";
 const char* Cfg::BVH_SKIPAHEAD = "bvh.skip_ahead";
 const char* Cfg::BVH_SKIPAHEAD_CMP = "bvh.skip_ahead_compare";
+const char* Cfg::BVH_STATSEPO = "bvh.stats_epo";
+const char* Cfg::BVH_WIDTH = "bvh.width";
 const char* Cfg::CAM_CENTER_X = "camera.center.x";
 const char* Cfg::CAM_CENTER_Y = "camera.center.y";
 const char* Cfg::CAM_CENTER_Z = "camera.center.z";
@@ -27,12 +44,16 @@ const char* Cfg::PERS_ZFAR = "camera.perspective.zfar";
 const char* Cfg::PERS_ZNEAR = "camera.perspective.znear";
 const char* Cfg::RENDER_ANTIALIAS = "render.antialiasing";
 const char* Cfg::RENDER_BRDF = "render.brdf";
+const char* Cfg::RENDER_DEBUGIMAGE = "render.debug_image";
 const char* Cfg::RENDER_INTERVAL = "render.interval";
 const char* Cfg::RENDER_MAXADDEDDEPTH = "render.max_added_depth";
 const char* Cfg::RENDER_MAXDEPTH = "render.max_depth";
+const char* Cfg::RENDER_PATHREGENERATION = "render.path_regeneration";
 const char* Cfg::RENDER_PHONGTESS = "render.phong_tessellation";
+const char* Cfg::RENDER_READBACKINTERVAL = "render.readback_interval";
 const char* Cfg::RENDER_SAMPLES = "render.samples";
 const char* Cfg::RENDER_SHADOWRAYS = "render.shadow_rays";
+const char* Cfg::RENDER_WAVEFRONT = "render.wavefront";
 const char* Cfg::SHADER_NAME = "shader.name";
 const char* Cfg::SHADER_PATH = "shader.path";
 const char* Cfg::WINDOW_HEIGHT = "window.height";
@@ -16,15 +16,32 @@ class Cfg {
 		template<typename T> T value( const char* key ) {
 			return mPropTree.get<T>( key );
 		}
-		void value( const char* key, void* value ) {
+		template<typename T> void value( const char* key, T value ) {
 			mPropTree.put( key, value );
 		}
 
 		static const char* ACCEL_STRUCT;
+		static const char* BVH_BUILDMETHOD;
+		static const char* BVH_BUILDTHREADS;
+		static const char* BVH_CACHE;
+		static const char* BVH_LBVH_MORTONBITS;
+		static const char* BVH_LBVH_SAHFACES;
 		static const char* BVH_MAXFACES;
+		static const char* BVH_NEARFIRST;
+		static const char* BVH_OPTIMIZETIME;
+		static const char* BVH_PARALLELFACES;
+		static const char* BVH_PROFILEFRAMES;
+		static const char* BVH_PROFILESWAP;
+		static const char* BVH_QUANTIZE;
+		static const char* BVH_SAHBINS;
+		static const char* BVH_SAHFACECOST;
 		static const char* BVH_SAHFACESLIMIT;
+		static const char* BVH_SBVH_ALPHA;
+		static const char* BVH_SBVH_DUPLICATES;
 		static const char* BVH_SKIPAHEAD;
 		static const char* BVH_SKIPAHEAD_CMP;
+		static const char* BVH_STATSEPO;
+		static const char* BVH_WIDTH;
 		static const char* CAM_CENTER_X;
 		static const char* CAM_CENTER_Y;
 		static const char* CAM_CENTER_Z;
@@ -46,12 +63,16 @@ class Cfg {
 		static const char* PERS_ZNEAR;
 		static const char* RENDER_ANTIALIAS;
 		static const char* RENDER_BRDF;
+		static const char* RENDER_DEBUGIMAGE;
 		static const char* RENDER_INTERVAL;
 		static const char* RENDER_MAXADDEDDEPTH;
 		static const char* RENDER_MAXDEPTH;
+		static const char* RENDER_PATHREGENERATION;
 		static const char* RENDER_PHONGTESS;
+		static const char* RENDER_READBACKINTERVAL;
 		static const char* RENDER_SAMPLES;
 		static const char* RENDER_SHADOWRAYS;
+		static const char* RENDER_WAVEFRONT;
 		static const char* SHADER_NAME;
 		static const char* SHADER_PATH;
 		static const char* WINDOW_HEIGHT;
@@ -0,0 +1,125 @@
+#include "InstanceParser.h"
+
+using std::string;
+using std::vector;
+
+
+/**
+ * Get an instance with some default values, meant to be overwritten.
+ * @return {instance_t} Default instance.
+ */
+instance_t InstanceParser::getEmptyInstance() {
+	cl_float4 zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+	cl_float4 noRotation = { 0.0f, 1.0f, 0.0f, 0.0f };
+
+	instance_t instance;
+	instance.instanceName = "";
+	instance.objectName = "";
+	instance.pos = zero;
+	instance.rotation = noRotation;
+	instance.scale = 1.0f;
+
+	return instance;
+}
+
+
+/**
+ * Get the loaded instances.
+ * @return {std::vector<instance_t>} The instances.
+ */
+vector<instance_t> InstanceParser::getInstances() {
+	return mInstances;
+}
+
+
+/**
+ * Load the instances from the file.
+ * The file is optional, so a missing one is not an error.
+ * @param {std::string} file File path and name of the INSTANCES file.
+ */
+void InstanceParser::load( string file ) {
+	mInstances.clear();
+
+	std::ifstream fileIn( file.c_str() );
+	instance_t instance;
+	int numInstancesFound = 0;
+
+	if( !fileIn ) {
+		return;
+	}
+
+	while( fileIn.good() ) {
+		string line;
+		getline( fileIn, line );
+		boost::algorithm::trim( line );
+
+		if( line.length() < 3 || line[0] == '#' ) {
+			continue;
+		}
+
+		vector<string> parts;
+		boost::split( parts, line, boost::is_any_of( " \t" ) );
+
+		// Beginning of a new instance
+		if( parts[0] == "newinstance" ) {
+			if( parts.size() < 2 ) {
+				Logger::logWarning( "[InstanceParser] No name for <newinstance>. Ignoring entry." );
+				continue;
+			}
+			if( numInstancesFound > 0 ) {
+				mInstances.push_back( instance );
+			}
+			numInstancesFound++;
+
+			instance = this->getEmptyInstance();
+			instance.instanceName = parts[1];
+		}
+		// Object to place
+		else if( parts[0] == "object" ) {
+			if( parts.size() < 2 ) {
+				Logger::logWarning( "[InstanceParser] Not enough parameters for <object>. Ignoring attribute." );
+				continue;
+			}
+			instance.objectName = parts[1];
+		}
+		// Translation
+		else if( parts[0] == "pos" ) {
+			if( parts.size() < 4 ) {
+				Logger::logWarning( "[InstanceParser] Not enough parameters for <pos>. Ignoring attribute." );
+				continue;
+			}
+			instance.pos.x = atof( parts[1].c_str() );
+			instance.pos.y = atof( parts[2].c_str() );
+			instance.pos.z = atof( parts[3].c_str() );
+		}
+		// Rotation around an axis
+		else if( parts[0] == "rotate" ) {
+			if( parts.size() < 5 ) {
+				Logger::logWarning( "[InstanceParser] Not enough parameters for <rotate>. Ignoring attribute." );
+				continue;
+			}
+			instance.rotation.x = atof( parts[1].c_str() );
+			instance.rotation.y = atof( parts[2].c_str() );
+			instance.rotation.z = atof( parts[3].c_str() );
+			instance.rotation.w = atof( parts[4].c_str() );
+		}
+		// Uniform scale
+		else if( parts[0] == "scale" ) {
+			if( parts.size() < 2 ) {
+				Logger::logWarning( "[InstanceParser] Not enough parameters for <scale>. Ignoring attribute." );
+				continue;
+			}
+			instance.scale = atof( parts[1].c_str() );
+		}
+	}
+
+	if( numInstancesFound > 0 ) {
+		mInstances.push_back( instance );
+	}
+
+	fileIn.close();
+
+	char msg[64];
+	snprintf( msg, 64, "[InstanceParser] Loaded %lu instance(s).", mInstances.size() );
+	Logger::logInfo( msg );
+}
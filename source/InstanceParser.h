@@ -0,0 +1,49 @@
+#ifndef INSTANCEPARSER_H
+#define INSTANCEPARSER_H
+
+#include <boost/algorithm/string.hpp>
+#include "cl.hpp"
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+
+using std::string;
+using std::vector;
+
+
+/**
+ * # Instance:
+ * newinstance - Name of the instance.
+ * object      - Name of the object ("o" in the OBJ) to place.
+ * pos         - Translation (xyz).
+ * rotate      - Rotation axis (xyz) and angle in degree.
+ * scale       - Uniform scale factor.
+ *
+ * Objects used by an instance are only rendered through their instances.
+ */
+struct instance_t {
+	string instanceName;
+	string objectName;
+	cl_float4 pos;
+	cl_float4 rotation; // xyz: axis, w: angle in degree
+	cl_float scale;
+};
+
+
+class InstanceParser {
+
+	public:
+		vector<instance_t> getInstances();
+		void load( string file );
+
+	protected:
+		instance_t getEmptyInstance();
+
+	private:
+		vector<instance_t> mInstances;
+
+};
+
+#endif
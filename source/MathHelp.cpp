@@ -119,6 +119,62 @@ void MathHelp::getTriangleAABB( cl_float4 v0, cl_float4 v1, cl_float4 v2, glm::v
 }
 
 
+/**
+ * Get the area of the part of a triangle that lies inside an AABB.
+ * The triangle is clipped against the six planes of the box.
+ * @param  {const glm::vec3} v0    Vertex of the triangle.
+ * @param  {const glm::vec3} v1    Vertex of the triangle.
+ * @param  {const glm::vec3} v2    Vertex of the triangle.
+ * @param  {const glm::vec3} bbMin Minimum of the AABB.
+ * @param  {const glm::vec3} bbMax Maximum of the AABB.
+ * @return {cl_float}              Area of the clipped triangle.
+ */
+cl_float MathHelp::getTriangleAreaInAABB(
+	const glm::vec3 v0, const glm::vec3 v1, const glm::vec3 v2,
+	const glm::vec3 bbMin, const glm::vec3 bbMax
+) {
+	// A triangle clipped by six planes has at most nine vertices.
+	glm::vec3 poly[9] = { v0, v1, v2 };
+	glm::vec3 clipped[9];
+	cl_uint numPoly = 3;
+
+	for( cl_uint plane = 0; plane < 6 && numPoly > 0; plane++ ) {
+		const cl_uint axis = plane % 3;
+		const bool isMax = ( plane >= 3 );
+		const cl_float pos = isMax ? bbMax[axis] : bbMin[axis];
+		cl_uint numClipped = 0;
+
+		for( cl_uint i = 0; i < numPoly; i++ ) {
+			const glm::vec3 a = poly[i];
+			const glm::vec3 b = poly[( i + 1 ) % numPoly];
+			const cl_float da = isMax ? pos - a[axis] : a[axis] - pos;
+			const cl_float db = isMax ? pos - b[axis] : b[axis] - pos;
+
+			if( da >= 0.0f ) {
+				clipped[numClipped++] = a;
+			}
+			if( ( da >= 0.0f ) != ( db >= 0.0f ) && numClipped < 9 ) {
+				clipped[numClipped++] = a + ( b - a ) * ( da / ( da - db ) );
+			}
+		}
+
+		numPoly = numClipped;
+
+		for( cl_uint i = 0; i < numPoly; i++ ) {
+			poly[i] = clipped[i];
+		}
+	}
+
+	glm::vec3 cross( 0.0f );
+
+	for( cl_uint i = 1; i + 1 < numPoly; i++ ) {
+		cross += glm::cross( poly[i] - poly[0], poly[i + 1] - poly[0] );
+	}
+
+	return 0.5f * glm::length( cross );
+}
+
+
 /**
  * Get the center point of the bounding box of a triangle.
  * @param  {cl_float4} v0 Vertex of the triangle.
@@ -32,6 +32,10 @@ class MathHelp {
 		static void getTriangleAABB(
 			cl_float4 v0, cl_float4 v1, cl_float4 v2, glm::vec3* bbMin, glm::vec3* bbMax
 		);
+		static cl_float getTriangleAreaInAABB(
+			const glm::vec3 v0, const glm::vec3 v1, const glm::vec3 v2,
+			const glm::vec3 bbMin, const glm::vec3 bbMax
+		);
 		static glm::vec3 getTriangleCenter(
 			cl_float4 v0, cl_float4 v1, cl_float4 v2
 		);
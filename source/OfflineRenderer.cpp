@@ -0,0 +1,158 @@
+#include "OfflineRenderer.h"
+
+using std::string;
+using std::vector;
+
+
+/**
+ * Constructor.
+ */
+OfflineRenderer::OfflineRenderer() {
+	mWidth = Cfg::get().value<cl_uint>( Cfg::WINDOW_WIDTH );
+	mHeight = Cfg::get().value<cl_uint>( Cfg::WINDOW_HEIGHT );
+
+	mTextureOut = vector<cl_float>( mWidth * mHeight * 4, 0.0f );
+
+	mAccelStruct = NULL;
+	mCamera = new Camera( NULL );
+	mPathTracer = new PathTracer();
+	mPathTracer->setCamera( mCamera );
+	mPathTracer->setWidthAndHeight( mWidth, mHeight );
+
+	ilInit();
+}
+
+
+/**
+ * Destructor.
+ */
+OfflineRenderer::~OfflineRenderer() {
+	delete mPathTracer;
+	delete mCamera;
+
+	if( mAccelStruct != NULL ) {
+		delete mAccelStruct;
+	}
+}
+
+
+/**
+ * Load 3D model and prepare the path tracer for it.
+ * @param {std::string} filepath Path to the file, without file name.
+ * @param {std::string} filename Name of the file.
+ */
+void OfflineRenderer::loadModel( string filepath, string filename ) {
+	ModelLoader* ml = new ModelLoader();
+	ml->loadModel( filepath, filename );
+
+	ObjParser* op = ml->getObjParser();
+
+	vector<cl_uint> faces = op->getFacesV();
+	vector<cl_float> normals = op->getNormals();
+	vector<cl_float> vertices = op->getVertices();
+
+	const short usedAccelStruct = Cfg::get().value<short>( Cfg::ACCEL_STRUCT );
+
+	// Kept by the path tracer for updating transformed objects.
+	if( mAccelStruct != NULL ) {
+		delete mAccelStruct;
+		mAccelStruct = NULL;
+	}
+
+	if( usedAccelStruct == ACCELSTRUCT_BVH && !mPathTracer->loadBVHCache( filepath, filename ) ) {
+		mAccelStruct = new BVH( op->getObjects(), vertices, normals, op->getInstances() );
+	}
+
+	mPathTracer->initOpenCLBuffers( vertices, faces, normals, ml, mAccelStruct );
+	mPathTracer->resetSampleCount();
+
+	delete ml;
+}
+
+
+/**
+ * Render the loaded model. Runs the path tracing kernel back to back
+ * until the requested number of samples per pixel has been reached.
+ * @param {const cl_uint} samples Samples per pixel.
+ */
+void OfflineRenderer::render( const cl_uint samples ) {
+	const cl_uint samplesPerPass = fmax( Cfg::get().value<cl_uint>( Cfg::RENDER_SAMPLES ), 1 );
+	const cl_uint passes = ( samples + samplesPerPass - 1 ) / samplesPerPass;
+	char msg[256];
+
+	snprintf(
+		msg, 256, "[OfflineRenderer] Rendering %u samples per pixel in %u passes (%u\u00D7%upx) ...",
+		passes * samplesPerPass, passes, mWidth, mHeight
+	);
+	Logger::logInfo( msg );
+
+	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
+	boost::posix_time::ptime timerLog = timerStart;
+
+	for( cl_uint i = 0; i < passes; i++ ) {
+		mPathTracer->generateImage();
+
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+
+		if( ( now - timerLog ).total_milliseconds() >= 5000 ) {
+			snprintf( msg, 256, "[OfflineRenderer] Pass %u/%u.", i + 1, passes );
+			Logger::logDebug( msg );
+			timerLog = now;
+		}
+	}
+
+	// The passes are accumulated on the device. Only the final image is needed.
+	mPathTracer->readImage( &mTextureOut, NULL );
+
+	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
+	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds() * 0.001f;
+
+	snprintf(
+		msg, 256, "[OfflineRenderer] ... Done in %.2f s (%.2f passes/s).",
+		timeDiff, ( timeDiff > 0.0f ) ? passes / timeDiff : 0.0f
+	);
+	Logger::logInfo( msg );
+}
+
+
+/**
+ * Save the rendered image to disk. The file type is derived from the file extension.
+ * @param  {std::string} filename Path and name of the file.
+ * @return {bool}                 True, if the image has been saved, false otherwise.
+ */
+bool OfflineRenderer::saveImage( string filename ) {
+	vector<ILubyte> pixels( mWidth * mHeight * 4 );
+
+	for( cl_uint i = 0; i < mWidth * mHeight; i++ ) {
+		pixels[i * 4 + 0] = (ILubyte) ( fmin( fmax( mTextureOut[i * 4 + 0], 0.0f ), 1.0f ) * 255.0f );
+		pixels[i * 4 + 1] = (ILubyte) ( fmin( fmax( mTextureOut[i * 4 + 1], 0.0f ), 1.0f ) * 255.0f );
+		pixels[i * 4 + 2] = (ILubyte) ( fmin( fmax( mTextureOut[i * 4 + 2], 0.0f ), 1.0f ) * 255.0f );
+		// The alpha channel is used for the focus distance.
+		pixels[i * 4 + 3] = 255;
+	}
+
+	// Same orientation as the texture shown in the GLWidget.
+	ilEnable( IL_ORIGIN_SET );
+	ilOriginFunc( IL_ORIGIN_LOWER_LEFT );
+	ilEnable( IL_FILE_OVERWRITE );
+
+	ILuint imageID;
+	ilGenImages( 1, &imageID );
+	ilBindImage( imageID );
+	ilTexImage( mWidth, mHeight, 1, 4, IL_RGBA, IL_UNSIGNED_BYTE, &pixels[0] );
+
+	bool success = ( ilSaveImage( filename.c_str() ) == IL_TRUE );
+	ilDeleteImages( 1, &imageID );
+
+	if( !success ) {
+		char msg[256];
+		snprintf( msg, 256, "[OfflineRenderer] Could not save image \"%s\" (DevIL error %d).", filename.c_str(), ilGetError() );
+		Logger::logError( msg );
+
+		return false;
+	}
+
+	Logger::logInfo( string( "[OfflineRenderer] Saved image " ).append( filename ) );
+
+	return true;
+}
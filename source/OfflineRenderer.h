@@ -0,0 +1,42 @@
+#ifndef OFFLINE_RENDERER_H
+#define OFFLINE_RENDERER_H
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <IL/il.h>
+#include <string>
+#include <vector>
+
+#include "accelstructures/BVH.h"
+#include "Camera.h"
+#include "Cfg.h"
+#include "Logger.h"
+#include "ModelLoader.h"
+#include "PathTracer.h"
+#include "utils.h"
+
+using std::string;
+using std::vector;
+
+
+class OfflineRenderer {
+
+	public:
+		OfflineRenderer();
+		~OfflineRenderer();
+		void loadModel( string filepath, string filename );
+		void render( const cl_uint samples );
+		bool saveImage( string filename );
+
+	private:
+		cl_uint mHeight;
+		cl_uint mWidth;
+
+		AccelStructure* mAccelStruct;
+		Camera* mCamera;
+		PathTracer* mPathTracer;
+
+		vector<cl_float> mTextureOut;
+
+};
+
+#endif
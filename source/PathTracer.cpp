@@ -1,4 +1,5 @@
 #include "PathTracer.h"
+#include "BVHCache.h"
 
 using std::string;
 using std::vector;
@@ -6,16 +7,53 @@ using std::vector;
 
 /**
  * Constructor.
- * @param {GLWidget*} parent
  */
-PathTracer::PathTracer( GLWidget* parent ) {
+PathTracer::PathTracer() {
 	srand( (unsigned) time( 0 ) );
 
 	mWidth = Cfg::get().value<cl_uint>( Cfg::WINDOW_WIDTH );
 	mHeight = Cfg::get().value<cl_uint>( Cfg::WINDOW_HEIGHT );
 
-	mGLWidget = parent;
 	mCL = NULL;
+	mKernelArgTextures = 0;
+	mBVH = NULL;
+	mBVHCache = NULL;
+	mBVHWidth = Cfg::get().value<cl_uint>( Cfg::BVH_WIDTH );
+
+	if( mBVHWidth != 2 && mBVHWidth != 4 && mBVHWidth != 8 ) {
+		char msg[128];
+		snprintf( msg, 128, "[PathTracer] BVH width has to be 2, 4 or 8, but is %u. Using 2.", mBVHWidth );
+		Logger::logWarning( msg );
+		mBVHWidth = 2;
+	}
+
+	mBVHQuantize = Cfg::get().value<cl_uint>( Cfg::BVH_QUANTIZE );
+
+	if( mBVHQuantize != 0 && mBVHQuantize != 8 && mBVHQuantize != 16 ) {
+		char msg[128];
+		snprintf( msg, 128, "[PathTracer] BVH quantization has to be 0, 8 or 16 bits, but is %u. Using 0.", mBVHQuantize );
+		Logger::logWarning( msg );
+		mBVHQuantize = 0;
+	}
+	// The stackless traversal of the binary BVH does not
+	// know the parent of a node, which is needed for decoding.
+	else if( mBVHQuantize > 0 && mBVHWidth == 2 ) {
+		Logger::logWarning( "[PathTracer] BVH quantization needs a BVH width of 4 or 8. Using full precision." );
+		mBVHQuantize = 0;
+	}
+
+	mBVHNearFirst = Cfg::get().value<bool>( Cfg::BVH_NEARFIRST );
+
+	// Wide nodes already order their children on their own.
+	if( mBVHNearFirst && mBVHWidth != 2 ) {
+		Logger::logWarning( "[PathTracer] Near child first traversal is only used for a BVH width of 2. Ignoring it." );
+		mBVHNearFirst = false;
+	}
+
+	this->resetBVHProfileFrames();
+
+	mWavefront = Cfg::get().value<bool>( Cfg::RENDER_WAVEFRONT );
+	mDebugImage = Cfg::get().value<bool>( Cfg::RENDER_DEBUGIMAGE );
 
 	mFOV = Cfg::get().value<cl_float>( Cfg::PERS_FOV );
 	mSampleCount = 0;
@@ -32,15 +70,119 @@ PathTracer::PathTracer( GLWidget* parent ) {
  * Destructor.
  */
 PathTracer::~PathTracer() {
+	delete mBVHCache;
 	delete mCL;
 }
 
 
+/**
+ * Append the faces of a leaf node to the face buffers.
+ * @param {BVH*}                        bvh      The BVH.
+ * @param {BVHNode*}                    node     The leaf node.
+ * @param {const std::vector<cl_uint>*} faces    Faces of the model.
+ * @param {const std::vector<cl_uint>*} facesVN  Normal indices of the faces.
+ * @param {const std::vector<cl_int>*}  facesMtl Material of each face.
+ * @param {std::vector<cl_uint4>*}      facesV   Faces (vertex indices and material) for the kernel.
+ * @param {std::vector<cl_uint4>*}      facesN   Faces (normal indices) for the kernel.
+ */
+void PathTracer::appendFacesOfNode(
+	BVH* bvh, BVHNode* node, const vector<cl_uint>* faces,
+	const vector<cl_uint>* facesVN, const vector<cl_int>* facesMtl,
+	vector<cl_uint4>* facesV, vector<cl_uint4>* facesN
+) {
+	for( cl_uint j = 0; j < node->numFaces; j++ ) {
+		Tri tri = bvh->getFace( node, j );
+		cl_uint4 fv;
+		cl_uint4 fn;
+
+		fv.x = (*faces)[tri.face.w * 3];
+		fv.y = (*faces)[tri.face.w * 3 + 1];
+		fv.z = (*faces)[tri.face.w * 3 + 2];
+		// Material of face
+		fv.w = (*facesMtl)[tri.face.w];
+
+		fn.x = (*facesVN)[tri.normals.w * 3];
+		fn.y = (*facesVN)[tri.normals.w * 3 + 1];
+		fn.z = (*facesVN)[tri.normals.w * 3 + 2];
+		fn.w = 0;
+
+		facesV->push_back( fv );
+		facesN->push_back( fn );
+	}
+}
+
+
+/**
+ * Lay out the binary BVH again with the box tests and hits counted by the kernel
+ * and rebuild the kernel without the counting. The faces keep their place.
+ */
+void PathTracer::applyBVHProfile() {
+	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
+
+	// While profiling no nodes are skipped, so the index of a node is its ID.
+	vector<cl_uint> profile( mBVHNodesCL.size() * 2 );
+	mCL->readBuffer( mBufBVHProfile, sizeof( cl_uint ) * profile.size(), &profile[0] );
+	mCL->freeBuffer( mBufBVHProfile );
+
+	// The leaves keep their faces, but get new IDs.
+	vector<BVHNode*> nodesBefore = mBVH->getNodes();
+	vector<cl_int> firstFacesBefore( nodesBefore.size() );
+
+	for( cl_uint i = 0; i < nodesBefore.size(); i++ ) {
+		memcpy( &firstFacesBefore[i], &mBVHNodesCL[i].bbMin.w, sizeof( cl_int ) );
+	}
+
+	mBVH->layoutByProfile( &profile, Cfg::get().value<bool>( Cfg::BVH_PROFILESWAP ) );
+
+	vector<cl_int> firstFaces( nodesBefore.size() );
+
+	for( cl_uint i = 0; i < nodesBefore.size(); i++ ) {
+		firstFaces[nodesBefore[i]->id] = firstFacesBefore[i];
+	}
+
+	vector<bvhNode_cl> bvhNodesCL;
+	vector<bvhInstance_cl> instancesCL;
+	cl_uint numTopLevelNodes;
+	this->flattenBinaryNodes( mBVH, &firstFaces, &bvhNodesCL, &instancesCL, &numTopLevelNodes );
+
+	// Without the profiling nodes may be skipped, so the new layout fits into the old buffer.
+	mCL->updateBuffer( mBufBVH, sizeof( bvhNode_cl ) * bvhNodesCL.size(), &bvhNodesCL[0] );
+	mCL->updateBuffer( mBufBVHInstances, sizeof( bvhInstance_cl ) * instancesCL.size(), &instancesCL[0] );
+	mBVHNodesCL.swap( bvhNodesCL );
+
+	char msg[256];
+	snprintf( msg, 256, "%u", numTopLevelNodes );
+	mCL->setReplacement( string( "#BVH_NUM_NODES#" ), string( msg ) );
+	mCL->setReplacement( string( "#BVH_PROFILE#" ), string( "0" ) );
+	snprintf( msg, 256, "%lu", mBVHNodesCL.size() );
+	mCL->setReplacement( string( "#DEBUG_NUM_NODES#" ), string( msg ) );
+
+	mCL->freeKernels();
+	mCL->loadProgram( Cfg::get().value<string>( Cfg::OPENCL_PROGRAM ) );
+	this->createKernels();
+	this->initKernelArgs();
+
+	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
+	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+
+	snprintf(
+		msg, 256, "[PathTracer] Laid out the BVH by its profile in %g ms. %lu nodes in the buffer.",
+		timeDiff, mBVHNodesCL.size()
+	);
+	Logger::logInfo( msg );
+}
+
+
 /**
  * OpenCL: Find the paths in the scene and accumulate the colors of hit surfaces.
  * @param {cl_float} timeSinceStart Time since start of the program in seconds.
  */
 void PathTracer::clPathTracing( cl_float timeSinceStart ) {
+	if( mWavefront ) {
+		this->clPathTracingWavefront( timeSinceStart );
+		return;
+	}
+
 	cl_float pixelWeight = mSampleCount / (cl_float) ( mSampleCount + 1 );
 
 	mCL->setKernelArg( mKernelPathTracing, 0, sizeof( cl_float ), &timeSinceStart );
@@ -48,26 +190,393 @@ void PathTracer::clPathTracing( cl_float timeSinceStart ) {
 	mCL->setKernelArg( mKernelPathTracing, 3, sizeof( camera_cl ), &mStructCam );
 
 	mCL->execute( mKernelPathTracing );
-	mCL->finish();
+	mCL->flush();
+}
+
+
+/**
+ * OpenCL: Path tracing split into kernels. The rays of the paths that are
+ * still alive are collected in a queue, so every round only works on them.
+ * @param {cl_float} timeSinceStart Time since start of the program in seconds.
+ */
+void PathTracer::clPathTracingWavefront( cl_float timeSinceStart ) {
+	cl_float pixelWeight = mSampleCount / (cl_float) ( mSampleCount + 1 );
+
+	mCL->setKernelArg( mKernelGenerate, 0, sizeof( cl_float ), &timeSinceStart );
+	mCL->setKernelArg( mKernelGenerate, 2, sizeof( camera_cl ), &mStructCam );
+	mCL->setKernelArg( mKernelShade, 1, sizeof( camera_cl ), &mStructCam );
+	mCL->setKernelArg( mKernelAccumulate, 0, sizeof( cl_float ), &pixelWeight );
+
+	// Each round takes every path at least one bounce further or to its next
+	// sample, so this many rounds finish all paths.
+	const cl_uint maxDepth = Cfg::get().value<cl_uint>( Cfg::RENDER_MAXDEPTH );
+	const cl_uint maxAddedDepth = Cfg::get().value<cl_uint>( Cfg::RENDER_MAXADDEDDEPTH );
+	const cl_uint samples = fmax( Cfg::get().value<cl_uint>( Cfg::RENDER_SAMPLES ), 1 );
+	const cl_uint numRounds = samples * ( maxDepth + maxAddedDepth );
+
+	// The queue never grows, so an older size is an upper bound for the
+	// current one. The sizes are read back without blocking and used
+	// WAVEFRONT_READBACK_LAG rounds later, while the device still has the
+	// rounds in between to work on. Work items beyond the actual queue size
+	// return at once, the swapQueues kernel keeps the counters on the device.
+	cl_event sizeEvents[WAVEFRONT_READBACK_LAG] = { NULL };
+	cl_uint queueSize = mWidth * mHeight;
+	cl_uint q = 0;
+
+	mCL->execute( mKernelGenerate );
+
+	for( cl_uint i = 0; i < numRounds; i++ ) {
+		cl_uint slot = i % WAVEFRONT_READBACK_LAG;
+
+		if( sizeEvents[slot] != NULL ) {
+			mCL->waitForEvent( sizeEvents[slot] );
+			sizeEvents[slot] = NULL;
+			queueSize = fmin( queueSize, mQueueSizes[slot] );
+
+			if( queueSize == 0 ) {
+				break;
+			}
+		}
+
+		mCL->setKernelArg( mKernelExtend, 0, sizeof( cl_mem ), &mBufQueues[q] );
+		mCL->setKernelArg( mKernelShade, 2, sizeof( cl_mem ), &mBufQueues[q] );
+		mCL->setKernelArg( mKernelShade, 3, sizeof( cl_mem ), &mBufQueues[1 - q] );
+
+		mCL->execute( mKernelExtend, queueSize );
+		mCL->execute( mKernelShade, queueSize );
+		mCL->execute( mKernelShadowRays, queueSize );
+		mCL->execute( mKernelSwapQueues, 1 );
+
+		sizeEvents[slot] = mCL->readBufferAsync( mBufQueueCounters, sizeof( cl_uint ), &mQueueSizes[slot] );
+
+		q = 1 - q;
+	}
+
+	// The in-order queue finishes the remaining readbacks
+	// before those of the next frame, no need to wait.
+	for( cl_uint i = 0; i < WAVEFRONT_READBACK_LAG; i++ ) {
+		if( sizeEvents[i] != NULL ) {
+			mCL->releaseEvent( sizeEvents[i] );
+		}
+	}
+
+	mCL->execute( mKernelAccumulate );
+	mCL->flush();
 }
 
 
 /**
- * Generate the path traced image, which is basically just a 2D texture.
- * @return {std::vector<cl_float>} Float vector representing a 2D image.
+ * Create the kernels of the loaded program.
  */
-vector<cl_float> PathTracer::generateImage( vector<cl_float>* textureDebug ) {
+void PathTracer::createKernels() {
+	if( mWavefront ) {
+		mKernelGenerate = mCL->createKernel( "generatePaths" );
+		mKernelExtend = mCL->createKernel( "extendPaths" );
+		mKernelShade = mCL->createKernel( "shadePaths" );
+		mKernelShadowRays = mCL->createKernel( "traceShadowRays" );
+		mKernelSwapQueues = mCL->createKernel( "swapQueues" );
+		mKernelAccumulate = mCL->createKernel( "accumulatePaths" );
+	}
+	else {
+		mKernelPathTracing = mCL->createKernel( "pathTracing" );
+	}
+}
+
+
+/**
+ * Let the inner nodes of the binary BVH point to their right child instead of the
+ * next node to visit, together with the axis the children are split on. The
+ * traversal then visits the child nearer to the ray origin first and keeps the
+ * other one on a stack. The split order is not updated on refits, a stale one
+ * only costs performance.
+ * @param  {BVH*}                     bvh     The BVH.
+ * @param  {std::vector<bvhNode_cl>*} nodesCL Nodes of the binary BVH. None may have been skipped.
+ * @return {cl_uint}                          Stack entries the traversal needs.
+ */
+cl_uint PathTracer::encodeNearFirst( BVH* bvh, vector<bvhNode_cl>* nodesCL ) {
+	vector<BVHNode*> bvhNodes = bvh->getNodes();
+	vector<cl_uint> depths( bvhNodes.size(), 1 );
+	cl_uint maxDepth = 1;
+
+	// The nodes are ordered by ID, so a parent comes before its children.
+	for( cl_uint i = 0; i < bvhNodes.size(); i++ ) {
+		const BVHNode* node = bvhNodes[i];
+
+		if( node->parent != NULL ) {
+			depths[node->id] = depths[node->parent->id] + 1;
+			maxDepth = std::max( maxDepth, depths[node->id] );
+		}
+
+		// Leaf or instance node.
+		if( node->leftChild == NULL ) {
+			continue;
+		}
+
+		// Split on the axis the centers of the children are the furthest apart on.
+		glm::vec3 diff = ( node->rightChild->bbMin + node->rightChild->bbMax ) -
+		                 ( node->leftChild->bbMin + node->leftChild->bbMax );
+		cl_int axis = ( fabs( diff[1] ) > fabs( diff[0] ) ) ? 1 : 0;
+		axis = ( fabs( diff[2] ) > fabs( diff[axis] ) ) ? 2 : axis;
+
+		// The left child is always next in memory.
+		cl_int leftIsUpper = ( diff[axis] < 0.0f ) ? 1 : 0;
+		cl_int bbMaxW = ( mBVHNodeIndicesCL[node->rightChild->id] << 3 ) | ( leftIsUpper << 2 ) | axis;
+		memcpy( &(*nodesCL)[mBVHNodeIndicesCL[node->id]].bbMax.w, &bbMaxW, sizeof( cl_int ) );
+	}
+
+	// The far child of each inner node on the way down, except for the deepest leaf.
+	return std::max( maxDepth - 1, (cl_uint) 1 );
+}
+
+
+/**
+ * Flatten the binary BVH for the stackless traversal in the kernel.
+ * @param  {BVH*}                         bvh              The BVH.
+ * @param  {const std::vector<cl_int>*}   firstFaces       Index of the first face in the face buffers, by node ID.
+ * @param  {std::vector<bvhNode_cl>*}     nodesCL          Nodes of the binary BVH.
+ * @param  {std::vector<bvhInstance_cl>*} instancesCL      Instances, at least one.
+ * @param  {cl_uint*}                     numTopLevelNodes Nodes before the first tree of an instanced object.
+ * @return {cl_uint}                                       Stack entries the traversal needs.
+ */
+cl_uint PathTracer::flattenBinaryNodes(
+	BVH* bvh, const vector<cl_int>* firstFaces, vector<bvhNode_cl>* nodesCL,
+	vector<bvhInstance_cl>* instancesCL, cl_uint* numTopLevelNodes
+) {
+	vector<BVHNode*> bvhNodes = bvh->getNodes();
+
+	// Skipped nodes are not part of the buffer, so the
+	// index of a node in it can differ from its ID.
+	mBVHNodeIndicesCL = vector<cl_int>( bvhNodes.size(), -1 );
+
+	// The near child first traversal needs all nodes, it cannot assume a child to be hit.
+	// While profiling, all nodes are needed to measure them.
+	const bool useSkipAhead = ( !mBVHNearFirst && mBVHProfileFrames == 0 );
+	bool skipNext = false;
+
+
+	for( cl_uint i = 0; i < bvhNodes.size(); i++ ) {
+		BVHNode* node = bvhNodes[i];
+
+		if( skipNext ) {
+			skipNext = node->skipNextLeft;
+			continue;
+		}
+
+		cl_float4 bbMin = { node->bbMin[0], node->bbMin[1], node->bbMin[2], 0.0f };
+		cl_float4 bbMax = { node->bbMax[0], node->bbMax[1], node->bbMax[2], 0.0f };
+
+		bvhNode_cl sn;
+		sn.bbMin = bbMin;
+		sn.bbMax = bbMax;
+
+		cl_uint fvecLen = node->numFaces;
+		// Leaf node: first face and number of faces.
+		cl_int bbMinW = ( fvecLen > 0 ) ? (*firstFaces)[node->id] : -1;
+		cl_int bbMaxW = ( fvecLen > 0 ) ? (cl_int) fvecLen : -1;
+
+		// Instance node. The tree of the object follows the main tree.
+		if( node->instance >= 0 ) {
+			bbMinW = -2 - node->instance;
+		}
+
+		// Set the flag to skip the next left child node.
+		if( fvecLen == 0 && node->skipNextLeft && useSkipAhead ) {
+			skipNext = true;
+		}
+
+		// No parent means it's the root node.
+		// Otherwise it is some other node, including leaves.
+		// Also for leaf nodes the next node to visit is given by the position in memory.
+		if( node->parent != NULL && fvecLen == 0 ) {
+			// The right sibling of the node or of the closest parent that is a left node.
+			const BVHNode* next = bvh->getSkipNode( node );
+
+			if( next != NULL ) {
+				bbMaxW = next->id - ( useSkipAhead ? next->numSkipsToHere : 0 );
+			}
+		}
+
+		// Stored as the bits of an int. A float is only
+		// exact for indices up to 2^24 (16.7M).
+		memcpy( &sn.bbMin.w, &bbMinW, sizeof( cl_int ) );
+		memcpy( &sn.bbMax.w, &bbMaxW, sizeof( cl_int ) );
+
+		mBVHNodeIndicesCL[node->id] = nodesCL->size();
+		nodesCL->push_back( sn );
+	}
+
+	cl_uint stackSize = 1;
+
+	if( mBVHNearFirst ) {
+		stackSize = this->encodeNearFirst( bvh, nodesCL );
+	}
+
+	// Instances. The main tree ends where the first tree of an instanced object begins.
+	vector<BVHInstance> instances = bvh->getInstances();
+	*numTopLevelNodes = nodesCL->size();
+
+	for( cl_uint i = 0; i < instances.size(); i++ ) {
+		glm::mat4 inv = glm::inverse( instances[i].transform );
+		cl_uint endID = instances[i].root->id + instances[i].numNodes;
+
+		bvhInstance_cl ic;
+		ic.invRow0 = { inv[0][0], inv[1][0], inv[2][0], inv[3][0] };
+		ic.invRow1 = { inv[0][1], inv[1][1], inv[2][1], inv[3][1] };
+		ic.invRow2 = { inv[0][2], inv[1][2], inv[2][2], inv[3][2] };
+		ic.nodes.x = mBVHNodeIndicesCL[instances[i].root->id];
+		ic.nodes.y = ( endID < bvhNodes.size() ) ? mBVHNodeIndicesCL[endID] : nodesCL->size();
+		ic.nodes.z = 0;
+		ic.nodes.w = 0;
+		instancesCL->push_back( ic );
+
+		*numTopLevelNodes = std::min( *numTopLevelNodes, (cl_uint) ic.nodes.x );
+	}
+
+	// The buffer may not be empty.
+	if( instancesCL->size() == 0 ) {
+		bvhInstance_cl ic = {};
+		instancesCL->push_back( ic );
+	}
+
+	return stackSize;
+}
+
+
+/**
+ * Add a node to the wide BVH, which holds the collapsed binary tree
+ * below <node>. Inner child nodes are added recursively.
+ * @param  {BVH*}                       bvh         The BVH.
+ * @param  {BVHNode*}                   node        Node of the binary tree.
+ * @param  {const std::vector<cl_int>*} faceOffsets Index of the first face in the face buffers for each leaf.
+ * @param  {std::vector<T>*}            nodesCL     Nodes of the wide BVH.
+ * @param  {cl_uint*}                   stackSize   Stack entries the traversal needs for this sub tree.
+ * @return {cl_uint}                                Index of the added node.
+ */
+template<typename T>
+cl_uint PathTracer::flattenWideNode(
+	BVH* bvh, BVHNode* node, const vector<cl_int>* faceOffsets,
+	vector<T>* nodesCL, cl_uint* stackSize
+) {
+	const cl_uint width = sizeof( T::children ) / sizeof( cl_int );
+	const cl_uint index = nodesCL->size();
+	vector<BVHNode*> children = bvh->collapseNode( node, width );
+
+	T wn;
+	memset( &wn, 0, sizeof( T ) );
+
+	for( cl_uint i = 0; i < width; i++ ) {
+		wn.children.s[i] = -1;
+	}
+
+	nodesCL->push_back( wn );
+
+	// The kernel pushes all hit inner and instance nodes on the
+	// stack at once. The first one is taken from the stack first.
+	cl_uint numPushed = 0;
+	cl_uint numPopped = 0;
+
+	for( cl_uint i = 0; i < children.size(); i++ ) {
+		numPushed += ( children[i]->numFaces == 0 ) ? 1 : 0;
+	}
+
+	*stackSize = numPushed;
+
+	for( cl_uint i = 0; i < children.size(); i++ ) {
+		BVHNode* child = children[i];
+		cl_int childIndex;
+		cl_int numFaces;
+
+		// Leaf node
+		if( child->numFaces > 0 ) {
+			childIndex = (*faceOffsets)[child->id];
+			numFaces = child->numFaces;
+		}
+		// Instance node
+		else if( child->instance >= 0 ) {
+			childIndex = child->instance;
+			numFaces = -1;
+			numPopped++;
+		}
+		// Inner node. Its siblings taken from the stack
+		// after it are still there while it is traversed.
+		else {
+			cl_uint childStackSize = 0;
+			childIndex = this->flattenWideNode( bvh, child, faceOffsets, nodesCL, &childStackSize );
+			numFaces = 0;
+			*stackSize = std::max( *stackSize, numPushed - 1 - numPopped + childStackSize );
+			numPopped++;
+		}
+
+		// The vector may have grown, so get the node again.
+		T* wnp = &(*nodesCL)[index];
+		wnp->bbMinX.s[i] = child->bbMin[0];
+		wnp->bbMinY.s[i] = child->bbMin[1];
+		wnp->bbMinZ.s[i] = child->bbMin[2];
+		wnp->bbMaxX.s[i] = child->bbMax[0];
+		wnp->bbMaxY.s[i] = child->bbMax[1];
+		wnp->bbMaxZ.s[i] = child->bbMax[2];
+		wnp->children.s[i] = childIndex;
+		wnp->numFaces.s[i] = numFaces;
+
+		mBVHNodeIndicesCL[child->id] = index * width + i;
+	}
+
+	return index;
+}
+
+
+/**
+ * Render the next frame of the path traced image. The image stays on the
+ * device: The output is the input of the next frame, so nothing is copied
+ * between host and device. Use readImage() to get the result.
+ */
+void PathTracer::generateImage() {
 	this->updateEyeBuffer();
-	mCL->updateImageReadOnly( mBufTextureIn, mWidth, mHeight, &mTextureOut[0] );
 
 	cl_float timeSinceStart = this->getTimeSinceStart();
 	this->clPathTracing( timeSinceStart );
 
-	mCL->readImageOutput( mBufTextureOut, mWidth, mHeight, &mTextureOut[0] );
-	mCL->readImageOutput( mBufTextureDebug, mWidth, mHeight, &(*textureDebug)[0] );
+	if( mBVHProfileFrames > 0 && --mBVHProfileFrames == 0 ) {
+		this->applyBVHProfile();
+	}
+
+	std::swap( mBufTextureIn, mBufTextureOut );
+	this->initKernelArgs_Textures();
 	mSampleCount++;
+}
+
 
-	return mTextureOut;
+/**
+ * Get the OpenCL handler used for the path tracing.
+ * @return {CL*} The OpenCL handler or NULL, if no model has been loaded yet.
+ */
+CL* PathTracer::getCL() {
+	return mCL;
+}
+
+
+/**
+ * Get the number of objects, which can be moved with transformObject().
+ * @return {cl_uint} Number of objects.
+ */
+cl_uint PathTracer::getNumObjects() {
+	return mObjectVertices.size();
+}
+
+
+/**
+ * Get the center of the bounding box of an object, as it is after the last transformObject().
+ * @param  {const cl_uint} objectIndex Index of the object.
+ * @return {glm::vec3}                 Center of the object or the origin, if it is unknown.
+ */
+glm::vec3 PathTracer::getObjectCenter( const cl_uint objectIndex ) {
+	BVHNode* root = ( mBVH != NULL ) ? mBVH->getObjectRoot( objectIndex ) : NULL;
+
+	if( root == NULL ) {
+		return glm::vec3( 0.0f );
+	}
+
+	return ( root->bbMin + root->bbMax ) * 0.5f;
 }
 
 
@@ -95,15 +604,77 @@ void PathTracer::initKernelArgs() {
 	Logger::logDebugVerbose( msg );
 
 	cl_uint i = 0;
+
+	if( mWavefront ) {
+		i++; // 0: timeSinceStart
+		mCL->setKernelArg( mKernelGenerate, i++, sizeof( cl_float ), &pxDim );
+		mCL->setKernelArg( mKernelGenerate, i++, sizeof( camera_cl ), &mStructCam );
+		i++; // 3: imageIn
+		mCL->setKernelArg( mKernelGenerate, i++, sizeof( cl_mem ), &mBufPaths );
+		mCL->setKernelArg( mKernelGenerate, i++, sizeof( cl_mem ), &mBufQueues[0] );
+		mCL->setKernelArg( mKernelGenerate, i++, sizeof( cl_mem ), &mBufQueueCounters );
+
+		i = 0;
+		i++; // 0: queue
+		mCL->setKernelArg( mKernelExtend, i++, sizeof( cl_mem ), &mBufQueueCounters );
+		mCL->setKernelArg( mKernelExtend, i++, sizeof( cl_mem ), &mBufPaths );
+		this->initKernelArgs_Scene( mKernelExtend, i );
+
+		i = 0;
+		mCL->setKernelArg( mKernelShade, i++, sizeof( cl_float ), &pxDim );
+		mCL->setKernelArg( mKernelShade, i++, sizeof( camera_cl ), &mStructCam );
+		i++; // 2: queueIn
+		i++; // 3: queueOut
+		mCL->setKernelArg( mKernelShade, i++, sizeof( cl_mem ), &mBufQueueCounters );
+		mCL->setKernelArg( mKernelShade, i++, sizeof( cl_mem ), &mBufPaths );
+		mCL->setKernelArg( mKernelShade, i++, sizeof( cl_mem ), &mBufShadowRays );
+		this->initKernelArgs_Scene( mKernelShade, i );
+
+		i = 0;
+		mCL->setKernelArg( mKernelShadowRays, i++, sizeof( cl_mem ), &mBufQueueCounters );
+		mCL->setKernelArg( mKernelShadowRays, i++, sizeof( cl_mem ), &mBufShadowRays );
+		mCL->setKernelArg( mKernelShadowRays, i++, sizeof( cl_mem ), &mBufPaths );
+		this->initKernelArgs_Scene( mKernelShadowRays, i );
+
+		mCL->setKernelArg( mKernelSwapQueues, 0, sizeof( cl_mem ), &mBufQueueCounters );
+
+		i = 0;
+		i++; // 0: pixelWeight
+		mCL->setKernelArg( mKernelAccumulate, i++, sizeof( cl_mem ), &mBufPaths );
+
+		this->initKernelArgs_Textures();
+
+		return;
+	}
+
 	i++; // 0: timeSinceStart
 	i++; // 1: pixelWeight
 	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_float ), &pxDim );
 	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( camera_cl ), &mStructCam );
 
+	mKernelArgTextures = this->initKernelArgs_Scene( mKernelPathTracing, i );
+	this->initKernelArgs_Textures();
+}
+
+
+/**
+ * Set the kernel arguments of the acceleration structure, geometry,
+ * materials and lights. They are in the same order for all kernels.
+ * @param  {cl_kernel} kernel The kernel.
+ * @param  {cl_uint}   i      Index of the first argument.
+ * @return {cl_uint}          Index of the argument after the last one set.
+ */
+cl_uint PathTracer::initKernelArgs_Scene( cl_kernel kernel, cl_uint i ) {
 	switch( Cfg::get().value<int>( Cfg::ACCEL_STRUCT ) ) {
 
 		case ACCELSTRUCT_BVH:
-			mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufBVH );
+			mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufBVH );
+			mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufBVHInstances );
+
+			if( mBVHProfileFrames > 0 ) {
+				mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufBVHProfile );
+			}
+
 			break;
 
 		default:
@@ -112,16 +683,43 @@ void PathTracer::initKernelArgs() {
 
 	}
 
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufFacesV );
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufFacesN );
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufVertices );
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufNormals );
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufMaterials );
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufLights );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufFacesV );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufFacesN );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufTris );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufVertices );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufNormals );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufMaterials );
+	mCL->setKernelArg( kernel, i++, sizeof( cl_mem ), &mBufLights );
+
+	return i;
+}
+
+
+/**
+ * Set the kernel arguments of the images. Has to be done again
+ * after each frame, because input and output are swapped.
+ */
+void PathTracer::initKernelArgs_Textures() {
+	if( mWavefront ) {
+		mCL->setKernelArg( mKernelGenerate, 3, sizeof( cl_mem ), &mBufTextureIn );
+		mCL->setKernelArg( mKernelAccumulate, 2, sizeof( cl_mem ), &mBufTextureIn );
+		mCL->setKernelArg( mKernelAccumulate, 3, sizeof( cl_mem ), &mBufTextureOut );
+
+		if( mDebugImage ) {
+			mCL->setKernelArg( mKernelAccumulate, 4, sizeof( cl_mem ), &mBufTextureDebug );
+		}
+
+		return;
+	}
+
+	cl_uint i = mKernelArgTextures;
 
 	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufTextureIn );
 	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufTextureOut );
-	mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufTextureDebug );
+
+	if( mDebugImage ) {
+		mCL->setKernelArg( mKernelPathTracing, i++, sizeof( cl_mem ), &mBufTextureDebug );
+	}
 }
 
 
@@ -131,7 +729,7 @@ void PathTracer::initKernelArgs() {
  * @param {std::vector<cl_uint>}  faces      Faces (triangles) of the model.
  * @param {std::vector<cl_float>} normals    Normals of the model.
  * @param {ModelLoader*}          ml         Model loader already holding the needed model data.
- * @param {AccelStructure*}       accelStruc The generated acceleration structure.
+ * @param {AccelStructure*}       accelStruc The generated acceleration structure. NULL if taken from the cache.
  */
 void PathTracer::initOpenCLBuffers(
 	vector<cl_float> vertices, vector<cl_uint> faces, vector<cl_float> normals,
@@ -178,8 +776,44 @@ void PathTracer::initOpenCLBuffers(
 	string accelName;
 
 	if( usedAccelStruct == ACCELSTRUCT_BVH ) {
-		bytes = this->initOpenCLBuffers_BVH( (BVH*) accelStruc, ml, faces );
-		accelName = "BVH";
+		if( accelStruc == NULL && mBVHCache != NULL ) {
+			bytes = this->initOpenCLBuffers_BVHCache();
+			accelName = "BVH (cached)";
+		}
+		else if( mBVHWidth == 4 ) {
+			bytes = this->initOpenCLBuffers_BVHWide( (BVH*) accelStruc, ml, faces, &mBVHNodes4CL );
+			accelName = "BVH (4-wide)";
+		}
+		else if( mBVHWidth == 8 ) {
+			bytes = this->initOpenCLBuffers_BVHWide( (BVH*) accelStruc, ml, faces, &mBVHNodes8CL );
+			accelName = "BVH (8-wide)";
+		}
+		else {
+			bytes = this->initOpenCLBuffers_BVH( (BVH*) accelStruc, ml, faces );
+			accelName = "BVH";
+		}
+
+		// Box tests and hits of each node.
+		if( mBVHProfileFrames > 0 ) {
+			vector<cl_uint> profile( mBVHNodesCL.size() * 2, 0 );
+			mBufBVHProfile = mCL->createEmptyBuffer( sizeof( cl_uint ) * profile.size(), CL_MEM_READ_WRITE );
+			mCL->updateBuffer( mBufBVHProfile, sizeof( cl_uint ) * profile.size(), &profile[0] );
+		}
+
+		snprintf( msg, MSG_LENGTH, "%d", mBVHNearFirst ? 1 : 0 );
+		mCL->setReplacement( string( "#BVH_NEAR_FIRST#" ), string( msg ) );
+		snprintf( msg, MSG_LENGTH, "%d", ( mBVHProfileFrames > 0 ) ? 1 : 0 );
+		mCL->setReplacement( string( "#BVH_PROFILE#" ), string( msg ) );
+		snprintf( msg, MSG_LENGTH, "%u", mBVHQuantize );
+		mCL->setReplacement( string( "#BVH_QUANTIZE#" ), string( msg ) );
+		snprintf( msg, MSG_LENGTH, "%u", mBVHWidth );
+		mCL->setReplacement( string( "#BVH_WIDTH#" ), string( msg ) );
+	}
+
+	// The cache has either been uploaded or written by now.
+	if( mBVHCache != NULL ) {
+		delete mBVHCache;
+		mBVHCache = NULL;
 	}
 
 	timerEnd = boost::posix_time::microsec_clock::local_time();
@@ -188,6 +822,15 @@ void PathTracer::initOpenCLBuffers(
 	snprintf( msg, MSG_LENGTH, "[PathTracer] Created %s buffer in %g ms -- %.2f %s.", accelName.c_str(), timeDiff, bytesFloat, unit.c_str() );
 	Logger::logInfo( msg );
 
+	// Buffer: Triangles
+	timerStart = boost::posix_time::microsec_clock::local_time();
+	bytes = this->initOpenCLBuffers_Tris();
+	timerEnd = boost::posix_time::microsec_clock::local_time();
+	timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+	utils::formatBytes( bytes, &bytesFloat, &unit );
+	snprintf( msg, MSG_LENGTH, "[PathTracer] Created triangle buffer in %g ms -- %.2f %s.", timeDiff, bytesFloat, unit.c_str() );
+	Logger::logInfo( msg );
+
 	// Buffer: Material(s)
 	timerStart = boost::posix_time::microsec_clock::local_time();
 	bytes = this->initOpenCLBuffers_Materials( ml );
@@ -218,14 +861,23 @@ void PathTracer::initOpenCLBuffers(
 	snprintf( msg, MSG_LENGTH, "[PathTracer] Created texture buffer in %g ms -- %.2f %s.", timeDiff, bytesFloat, unit.c_str() );
 	Logger::logInfo( msg );
 
+	// Buffer: Path states and queues
+	if( mWavefront ) {
+		timerStart = boost::posix_time::microsec_clock::local_time();
+		bytes = this->initOpenCLBuffers_Wavefront();
+		timerEnd = boost::posix_time::microsec_clock::local_time();
+		timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+		utils::formatBytes( bytes, &bytesFloat, &unit );
+		snprintf( msg, MSG_LENGTH, "[PathTracer] Created wavefront buffers in %g ms -- %.2f %s.", timeDiff, bytesFloat, unit.c_str() );
+		Logger::logInfo( msg );
+	}
+
 	Logger::indent( 0 );
 	Logger::logInfo( "[PathTracer] ... Done." );
 
 
 	mCL->loadProgram( Cfg::get().value<string>( Cfg::OPENCL_PROGRAM ) );
-	mKernelPathTracing = mCL->createKernel( "pathTracing" );
-	mGLWidget->createKernelWindow( mCL );
-
+	this->createKernels();
 	this->initKernelArgs();
 }
 
@@ -237,105 +889,229 @@ void PathTracer::initOpenCLBuffers(
  */
 size_t PathTracer::initOpenCLBuffers_BVH( BVH* bvh, ModelLoader* ml, vector<cl_uint> faces ) {
 	vector<BVHNode*> bvhNodes = bvh->getNodes();
-	vector<bvhNode_cl> bvhNodesCL;
+	mBVH = bvh;
 
 	vector<cl_uint> facesVN = ml->getObjParser()->getFacesVN();
 	vector<cl_int> facesMtl = ml->getObjParser()->getFacesMtl();
 	vector<cl_uint4> facesV;
 	vector<cl_uint4> facesN;
 
-	bool skipNext = false;
+	// Faces, in the order of the leaf nodes. The faces of a leaf are stored contiguously.
+	vector<cl_int> firstFaces( bvhNodes.size(), -1 );
+
+	for( cl_uint i = 0; i < bvhNodes.size(); i++ ) {
+		if( bvhNodes[i]->numFaces > 0 ) {
+			firstFaces[i] = facesV.size();
+			this->appendFacesOfNode( bvh, bvhNodes[i], &faces, &facesVN, &facesMtl, &facesV, &facesN );
+		}
+	}
+
+	vector<bvhNode_cl> bvhNodesCL;
+	vector<bvhInstance_cl> instancesCL;
+	cl_uint numTopLevelNodes;
+	cl_uint stackSize = this->flattenBinaryNodes( bvh, &firstFaces, &bvhNodesCL, &instancesCL, &numTopLevelNodes );
+
+	if( mBVHCache != NULL ) {
+		mBVHCache->write(
+			bvhNodesCL.data(), bvhNodesCL.size(), sizeof( bvhNode_cl ),
+			&instancesCL, &facesV, &facesN, numTopLevelNodes, stackSize
+		);
+	}
+
+	size_t bytesBVH = sizeof( bvhNode_cl ) * bvhNodesCL.size();
+	mBufBVH = mCL->createBuffer( bvhNodesCL, bytesBVH );
+	mBVHNodesCL.swap( bvhNodesCL );
+
+	size_t bytesInstances = sizeof( bvhInstance_cl ) * instancesCL.size();
+	mBufBVHInstances = mCL->createBuffer( instancesCL, bytesInstances );
+
+	char msg[16];
+	snprintf( msg, 16, "%u", numTopLevelNodes );
+	mCL->setReplacement( string( "#BVH_NUM_NODES#" ), string( msg ) );
+	snprintf( msg, 16, "%u", stackSize );
+	mCL->setReplacement( string( "#BVH_STACK_SIZE#" ), string( msg ) );
+	snprintf( msg, 16, "%lu", facesV.size() );
+	mCL->setReplacement( string( "#DEBUG_NUM_FACES#" ), string( msg ) );
+	snprintf( msg, 16, "%lu", mBVHNodesCL.size() );
+	mCL->setReplacement( string( "#DEBUG_NUM_NODES#" ), string( msg ) );
+
+	size_t bytesFV = sizeof( cl_uint4 ) * facesV.size();
+	mBufFacesV = mCL->createBuffer( facesV, bytesFV );
+
+	size_t bytesFN = sizeof( cl_uint4 ) * facesN.size();
+	mBufFacesN = mCL->createBuffer( facesN, bytesFN );
+
+	// Kept for the triangles, see initOpenCLBuffers_Tris().
+	mFacesV.swap( facesV );
+
+	return bytesBVH + bytesInstances + bytesFV + bytesFN;
+}
+
 
+/**
+ * Init OpenCL buffers for the BVH from the mapped cache file.
+ * No BVH object exists in this case, so objects cannot be transformed.
+ * @return {size_t} Buffer size.
+ */
+size_t PathTracer::initOpenCLBuffers_BVHCache() {
+	const bvhCacheHeader* header = mBVHCache->getHeader();
+
+	mBVH = NULL;
+	mBVHNodesCL.clear();
+	mBVHNodes4CL.clear();
+	mBVHNodes8CL.clear();
+	mBVHNodeIndicesCL.clear();
+
+	size_t bytesBVH = (size_t) header->nodeSize * header->numNodes;
+	mBufBVH = mCL->createBuffer( mBVHCache->getNodes(), bytesBVH );
+
+	size_t bytesInstances = sizeof( bvhInstance_cl ) * header->numInstances;
+	mBufBVHInstances = mCL->createBuffer( mBVHCache->getInstances(), bytesInstances );
+
+	char msg[16];
+	snprintf( msg, 16, "%u", header->numTopLevelNodes );
+	mCL->setReplacement( string( "#BVH_NUM_NODES#" ), string( msg ) );
+	snprintf( msg, 16, "%u", header->stackSize );
+	mCL->setReplacement( string( "#BVH_STACK_SIZE#" ), string( msg ) );
+	snprintf( msg, 16, "%lu", header->numFacesV );
+	mCL->setReplacement( string( "#DEBUG_NUM_FACES#" ), string( msg ) );
+	snprintf( msg, 16, "%lu", header->numNodes );
+	mCL->setReplacement( string( "#DEBUG_NUM_NODES#" ), string( msg ) );
+
+	size_t bytesFV = sizeof( cl_uint4 ) * header->numFacesV;
+	mBufFacesV = mCL->createBuffer( mBVHCache->getFacesV(), bytesFV );
+
+	size_t bytesFN = sizeof( cl_uint4 ) * header->numFacesN;
+	mBufFacesN = mCL->createBuffer( mBVHCache->getFacesN(), bytesFN );
+
+	// Kept for the triangles, see initOpenCLBuffers_Tris().
+	mFacesV.assign( mBVHCache->getFacesV(), mBVHCache->getFacesV() + header->numFacesV );
+
+	return bytesBVH + bytesInstances + bytesFV + bytesFN;
+}
+
+
+/**
+ * Init OpenCL buffers for a wide BVH. The binary BVH is collapsed
+ * into nodes with 4 or 8 children, depending on the node type.
+ * @param  {BVH*}                 bvh     The generated Bounding Volume Hierarchy.
+ * @param  {ModelLoader*}         ml      Model loader holding the model data.
+ * @param  {std::vector<cl_uint>} faces   Faces of the model.
+ * @param  {std::vector<T>*}      nodesCL Nodes of the wide BVH. Kept for updating single objects.
+ * @return {size_t}                       Buffer size.
+ */
+template<typename T>
+size_t PathTracer::initOpenCLBuffers_BVHWide(
+	BVH* bvh, ModelLoader* ml, vector<cl_uint> faces, vector<T>* nodesCL
+) {
+	vector<BVHNode*> bvhNodes = bvh->getNodes();
+
+	// Only nodes, which are a child of a wide node, are part of the
+	// buffer. The index of such a node is: wide node * width + slot.
+	mBVH = bvh;
+	mBVHNodeIndicesCL = vector<cl_int>( bvhNodes.size(), -1 );
+
+	vector<cl_uint> facesVN = ml->getObjParser()->getFacesVN();
+	vector<cl_int> facesMtl = ml->getObjParser()->getFacesMtl();
+	vector<cl_uint4> facesV;
+	vector<cl_uint4> facesN;
+	vector<cl_int> faceOffsets( bvhNodes.size(), -1 );
 
 	for( cl_uint i = 0; i < bvhNodes.size(); i++ ) {
 		BVHNode* node = bvhNodes[i];
 
-		if( skipNext ) {
-			skipNext = node->skipNextLeft;
-			continue;
+		if( node->numFaces > 0 ) {
+			faceOffsets[node->id] = facesV.size();
+			this->appendFacesOfNode( bvh, node, &faces, &facesVN, &facesMtl, &facesV, &facesN );
 		}
+	}
 
-		cl_float4 bbMin = { node->bbMin[0], node->bbMin[1], node->bbMin[2], 0.0f };
-		cl_float4 bbMax = { node->bbMax[0], node->bbMax[1], node->bbMax[2], 0.0f };
+	nodesCL->clear();
 
-		bvhNode_cl sn;
-		sn.bbMin = bbMin;
-		sn.bbMax = bbMax;
+	cl_uint stackSize = 0;
+	this->flattenWideNode( bvh, bvh->getRoot(), &faceOffsets, nodesCL, &stackSize );
+	cl_uint numTopLevelNodes = nodesCL->size();
 
-		vector<Tri> facesVec = node->faces;
-		cl_uint fvecLen = facesVec.size();
-		sn.bbMin.w = ( fvecLen > 0 ) ? (cl_float) facesV.size() + 0 : -1.0f;
-		sn.bbMax.w = ( fvecLen > 1 ) ? (cl_float) facesV.size() + 1 : -1.0f;
+	// Instances. The tree of an instanced object is added only once.
+	vector<BVHInstance> instances = bvh->getInstances();
+	vector<bvhInstance_cl> instancesCL;
+	std::map<BVHNode*, cl_uint> objectRootsCL;
 
-		// Set the flag to skip the next left child node.
-		if( fvecLen == 0 && node->skipNextLeft ) {
-			skipNext = true;
-		}
+	for( cl_uint i = 0; i < instances.size(); i++ ) {
+		BVHNode* root = instances[i].root;
 
-		// No parent means it's the root node.
-		// Otherwise it is some other node, including leaves.
-		// Also for leaf nodes the next node to visit is given by the position in memory.
-		if( node->parent != NULL && fvecLen == 0 ) {
-			bool isLeftNode = ( node->parent->leftChild == node );
-
-			if( !isLeftNode ) {
-				if( node->parent->parent != NULL ) {
-					BVHNode* dummy = new BVHNode();
-					dummy->parent = node->parent;
-
-					// As long as we are on the right side of a (sub)tree,
-					// skip parents until we either are at the root or
-					// our parent has a true sibling again.
-					while( dummy->parent->parent->rightChild == dummy->parent ) {
-						dummy->parent = dummy->parent->parent;
-
-						if( dummy->parent->parent == NULL ) {
-							break;
-						}
-					}
-
-					// Reached a parent with a true sibling.
-					if( dummy->parent->parent != NULL ) {
-						sn.bbMax.w = dummy->parent->parent->rightChild->id - dummy->parent->parent->rightChild->numSkipsToHere;
-					}
-				}
-			}
-			// Node on the left, go to the right sibling.
-			else {
-				sn.bbMax.w = node->parent->rightChild->id - node->parent->rightChild->numSkipsToHere;
-			}
+		if( objectRootsCL.count( root ) == 0 ) {
+			cl_uint objectStackSize = 0;
+			objectRootsCL[root] = this->flattenWideNode( bvh, root, &faceOffsets, nodesCL, &objectStackSize );
+			stackSize = std::max( stackSize, objectStackSize );
 		}
 
-		bvhNodesCL.push_back( sn );
+		glm::mat4 inv = glm::inverse( instances[i].transform );
+
+		bvhInstance_cl ic;
+		ic.invRow0 = { inv[0][0], inv[1][0], inv[2][0], inv[3][0] };
+		ic.invRow1 = { inv[0][1], inv[1][1], inv[2][1], inv[3][1] };
+		ic.invRow2 = { inv[0][2], inv[1][2], inv[2][2], inv[3][2] };
+		ic.nodes.x = objectRootsCL[root];
+		ic.nodes.y = 0;
+		ic.nodes.z = 0;
+		ic.nodes.w = 0;
+		instancesCL.push_back( ic );
+	}
 
-		// Faces
-		for( int j = 0; j < fvecLen; j++) {
-			Tri tri = facesVec[j];
-			cl_uint4 fv;
-			cl_uint4 fn;
+	// The buffer may not be empty.
+	if( instancesCL.size() == 0 ) {
+		bvhInstance_cl ic = {};
+		instancesCL.push_back( ic );
+	}
 
-			fv.x = faces[tri.face.w * 3];
-			fv.y = faces[tri.face.w * 3 + 1];
-			fv.z = faces[tri.face.w * 3 + 2];
-			// Material of face
-			fv.w = facesMtl[tri.face.w];
+	// The root node is on the stack at the beginning.
+	stackSize = std::max( stackSize, (cl_uint) 1 );
 
-			fn.x = facesVN[tri.normals.w * 3];
-			fn.y = facesVN[tri.normals.w * 3 + 1];
-			fn.z = facesVN[tri.normals.w * 3 + 2];
-			fn.w = 0;
+	char msg[128];
+	snprintf(
+		msg, 128, "[PathTracer] Collapsed BVH to %lu nodes with %lu children. Stack size: %u.",
+		nodesCL->size(), sizeof( T::children ) / sizeof( cl_int ), stackSize
+	);
+	Logger::logDebug( msg );
+
+	// The nodes are kept in full precision for updating single
+	// objects, but only their quantized version is uploaded.
+	const void* nodesData = nodesCL->data();
+	size_t nodeSize = sizeof( T );
+
+	if( mBVHQuantize > 0 ) {
+		nodeSize = this->quantizeWideNodes( nodesCL, NULL );
+		nodesData = mBVHNodesQuantizedCL.data();
+
+		snprintf(
+			msg, 128, "[PathTracer] Quantized BVH nodes to %lu bits. Node size: %lu instead of %lu bytes.",
+			(size_t) mBVHQuantize, nodeSize, sizeof( T )
+		);
+		Logger::logDebug( msg );
+	}
 
-			facesV.push_back( fv );
-			facesN.push_back( fn );
-		}
+	if( mBVHCache != NULL ) {
+		mBVHCache->write(
+			nodesData, nodesCL->size(), nodeSize,
+			&instancesCL, &facesV, &facesN, numTopLevelNodes, stackSize
+		);
 	}
 
-	size_t bytesBVH = sizeof( bvhNode_cl ) * bvhNodesCL.size();
-	mBufBVH = mCL->createBuffer( bvhNodesCL, bytesBVH );
+	size_t bytesBVH = nodeSize * nodesCL->size();
+	mBufBVH = mCL->createBuffer( nodesData, bytesBVH );
 
-	char msg[16];
-	snprintf( msg, 16, "%lu", bvhNodesCL.size() );
+	size_t bytesInstances = sizeof( bvhInstance_cl ) * instancesCL.size();
+	mBufBVHInstances = mCL->createBuffer( instancesCL, bytesInstances );
+
+	snprintf( msg, 128, "%u", numTopLevelNodes );
 	mCL->setReplacement( string( "#BVH_NUM_NODES#" ), string( msg ) );
+	snprintf( msg, 128, "%u", stackSize );
+	mCL->setReplacement( string( "#BVH_STACK_SIZE#" ), string( msg ) );
+	snprintf( msg, 128, "%lu", facesV.size() );
+	mCL->setReplacement( string( "#DEBUG_NUM_FACES#" ), string( msg ) );
+	snprintf( msg, 128, "%lu", nodesCL->size() );
+	mCL->setReplacement( string( "#DEBUG_NUM_NODES#" ), string( msg ) );
 
 	size_t bytesFV = sizeof( cl_uint4 ) * facesV.size();
 	mBufFacesV = mCL->createBuffer( facesV, bytesFV );
@@ -343,7 +1119,10 @@ size_t PathTracer::initOpenCLBuffers_BVH( BVH* bvh, ModelLoader* ml, vector<cl_u
 	size_t bytesFN = sizeof( cl_uint4 ) * facesN.size();
 	mBufFacesN = mCL->createBuffer( facesN, bytesFN );
 
-	return bytesBVH + bytesFV + bytesFN;
+	// Kept for the triangles, see initOpenCLBuffers_Tris().
+	mFacesV.swap( facesV );
+
+	return bytesBVH + bytesInstances + bytesFV + bytesFN;
 }
 
 
@@ -376,6 +1155,27 @@ size_t PathTracer::initOpenCLBuffers_Faces(
 	mBufVertices = mCL->createBuffer( vertices4, bytesV );
 	mBufNormals = mCL->createBuffer( normals4, bytesN );
 
+	// Vertices and normals used by each object, to be able to transform it later on.
+	vector<object3D> objects = ml->getObjParser()->getObjects();
+	mObjectVertices = vector< vector<cl_uint> >( objects.size() );
+	mObjectNormals = vector< vector<cl_uint> >( objects.size() );
+
+	for( cl_uint i = 0; i < objects.size(); i++ ) {
+		vector<cl_uint>* ov = &mObjectVertices[i];
+		vector<cl_uint>* on = &mObjectNormals[i];
+
+		ov->assign( objects[i].facesV.begin(), objects[i].facesV.end() );
+		std::sort( ov->begin(), ov->end() );
+		ov->erase( std::unique( ov->begin(), ov->end() ), ov->end() );
+
+		on->assign( objects[i].facesVN.begin(), objects[i].facesVN.end() );
+		std::sort( on->begin(), on->end() );
+		on->erase( std::unique( on->begin(), on->end() ), on->end() );
+	}
+
+	mVertices4.swap( vertices4 );
+	mNormals4.swap( normals4 );
+
 	return bytesV + bytesN;
 }
 
@@ -523,13 +1323,243 @@ size_t PathTracer::initOpenCLBuffers_MaterialsRGB( vector<material_t> materials
  * Init OpenCL buffers of the textures.
  */
 size_t PathTracer::initOpenCLBuffers_Textures() {
-	mTextureOut = vector<cl_float>( mWidth * mHeight * 4, 0.0f );
+	vector<cl_float> textureEmpty( mWidth * mHeight * 4, 0.0f );
+
+	// Input and output are swapped after each frame, so both have to be read-write.
+	mBufTextureIn = mCL->createImage2DReadWrite( mWidth, mHeight, &textureEmpty[0] );
+	mBufTextureOut = mCL->createImage2DReadWrite( mWidth, mHeight, &textureEmpty[0] );
+
+	if( !mDebugImage ) {
+		return sizeof( cl_float ) * textureEmpty.size() * 2.0f;
+	}
 
-	mBufTextureIn = mCL->createImage2DReadOnly( mWidth, mHeight, &mTextureOut[0] );
-	mBufTextureOut = mCL->createImage2DWriteOnly( mWidth, mHeight );
 	mBufTextureDebug = mCL->createImage2DWriteOnly( mWidth, mHeight );
 
-	return sizeof( cl_float ) * mTextureOut.size() * 3.0f;
+	return sizeof( cl_float ) * textureEmpty.size() * 3.0f;
+}
+
+
+/**
+ * Init the OpenCL buffer of the triangles. There is one triangle per face
+ * in the face buffers, so the faces of a leaf node are contiguous in it, too.
+ * @return {size_t} Buffer size.
+ */
+size_t PathTracer::initOpenCLBuffers_Tris() {
+	mTris = vector<tri_cl>( mFacesV.size() );
+
+	for( cl_uint i = 0; i < mFacesV.size(); i++ ) {
+		this->updateTri( i );
+	}
+
+	// Triangles of each object, to be able to transform it later on.
+	vector<cl_int> vertexObjects( mVertices4.size(), -1 );
+	mObjectTris = vector< vector<cl_uint> >( mObjectVertices.size() );
+
+	for( cl_uint i = 0; i < mObjectVertices.size(); i++ ) {
+		for( cl_uint j = 0; j < mObjectVertices[i].size(); j++ ) {
+			vertexObjects[mObjectVertices[i][j]] = i;
+		}
+	}
+
+	for( cl_uint i = 0; i < mFacesV.size(); i++ ) {
+		cl_int objectIndex = vertexObjects[mFacesV[i].x];
+
+		if( objectIndex >= 0 ) {
+			mObjectTris[objectIndex].push_back( i );
+		}
+	}
+
+	size_t bytesTris = sizeof( tri_cl ) * mTris.size();
+	mBufTris = mCL->createBuffer( mTris, bytesTris );
+
+	return bytesTris;
+}
+
+
+/**
+ * Init the OpenCL buffers for the wavefront path tracing:
+ * The state of each path, two queues of rays and the shadow rays.
+ * @return {size_t} Buffer size.
+ */
+size_t PathTracer::initOpenCLBuffers_Wavefront() {
+	const size_t numPaths = mWidth * mHeight;
+
+	size_t bytesPaths = sizeof( pathState_cl ) * numPaths;
+	size_t bytesQueue = sizeof( cl_uint ) * numPaths;
+	size_t bytesShadowRays = sizeof( shadowRay_cl ) * numPaths;
+	size_t bytesCounters = sizeof( cl_uint ) * 3;
+
+	mBufPaths = mCL->createEmptyBuffer( bytesPaths, CL_MEM_READ_WRITE );
+	mBufQueues[0] = mCL->createEmptyBuffer( bytesQueue, CL_MEM_READ_WRITE );
+	mBufQueues[1] = mCL->createEmptyBuffer( bytesQueue, CL_MEM_READ_WRITE );
+	mBufShadowRays = mCL->createEmptyBuffer( bytesShadowRays, CL_MEM_READ_WRITE );
+	mBufQueueCounters = mCL->createEmptyBuffer( bytesCounters, CL_MEM_READ_WRITE );
+
+	return bytesPaths + bytesQueue * 2 + bytesShadowRays + bytesCounters;
+}
+
+
+/**
+ * Quantize the child boxes of wide BVH nodes (4 children).
+ * @param  {const std::vector<bvhNode4_cl>*} nodesCL Nodes in full precision.
+ * @param  {const std::vector<cl_uint>*}     indices Nodes to quantize. NULL for all nodes.
+ * @return {size_t}                                  Size of a quantized node in bytes.
+ */
+size_t PathTracer::quantizeWideNodes( const vector<bvhNode4_cl>* nodesCL, const vector<cl_uint>* indices ) {
+	if( mBVHQuantize == 8 ) {
+		return this->quantizeWideNodes<bvhNode4_cl, bvhNode4Q8_cl>( nodesCL, indices );
+	}
+
+	return this->quantizeWideNodes<bvhNode4_cl, bvhNode4Q16_cl>( nodesCL, indices );
+}
+
+
+/**
+ * Quantize the child boxes of wide BVH nodes (8 children).
+ * @param  {const std::vector<bvhNode8_cl>*} nodesCL Nodes in full precision.
+ * @param  {const std::vector<cl_uint>*}     indices Nodes to quantize. NULL for all nodes.
+ * @return {size_t}                                  Size of a quantized node in bytes.
+ */
+size_t PathTracer::quantizeWideNodes( const vector<bvhNode8_cl>* nodesCL, const vector<cl_uint>* indices ) {
+	if( mBVHQuantize == 8 ) {
+		return this->quantizeWideNodes<bvhNode8_cl, bvhNode8Q8_cl>( nodesCL, indices );
+	}
+
+	return this->quantizeWideNodes<bvhNode8_cl, bvhNode8Q16_cl>( nodesCL, indices );
+}
+
+
+/**
+ * Quantize the child boxes of wide BVH nodes into mBVHNodesQuantizedCL.
+ * The frame of a node is the box around all its children. It is split
+ * into steps, which are a power of 2, so the kernel decodes the boxes
+ * without rounding errors in the step size. Boxes are rounded outwards.
+ * @param  {const std::vector<T>*}       nodesCL Nodes in full precision.
+ * @param  {const std::vector<cl_uint>*} indices Nodes to quantize. NULL for all nodes.
+ * @return {size_t}                              Size of a quantized node in bytes.
+ */
+template<typename T, typename Q>
+size_t PathTracer::quantizeWideNodes( const vector<T>* nodesCL, const vector<cl_uint>* indices ) {
+	const cl_uint width = sizeof( T::children ) / sizeof( cl_int );
+	const cl_int steps = ( sizeof( Q::bbMinX ) / width == 1 ) ? 255 : 65535;
+
+	mBVHNodesQuantizedCL.resize( sizeof( Q ) * nodesCL->size() );
+	Q* nodesQ = (Q*) mBVHNodesQuantizedCL.data();
+
+	size_t numNodes = ( indices == NULL ) ? nodesCL->size() : indices->size();
+
+	for( size_t n = 0; n < numNodes; n++ ) {
+		const size_t index = ( indices == NULL ) ? n : (*indices)[n];
+		const T* node = &(*nodesCL)[index];
+		const cl_float* bbMin[3] = { node->bbMinX.s, node->bbMinY.s, node->bbMinZ.s };
+		const cl_float* bbMax[3] = { node->bbMaxX.s, node->bbMaxY.s, node->bbMaxZ.s };
+
+		Q nq;
+		memset( &nq, 0, sizeof( Q ) );
+		nq.children = node->children;
+
+		cl_int qMin[3][8] = {};
+		cl_int qMax[3][8] = {};
+
+		for( cl_uint axis = 0; axis < 3; axis++ ) {
+			cl_float frameMin = FLT_MAX;
+			cl_float frameMax = -FLT_MAX;
+
+			for( cl_uint i = 0; i < width; i++ ) {
+				if( node->children.s[i] >= 0 ) {
+					frameMin = fmin( frameMin, bbMin[axis][i] );
+					frameMax = fmax( frameMax, bbMax[axis][i] );
+				}
+			}
+
+			// Smallest power of 2, so that the steps cover the frame.
+			int exponent = 0;
+			cl_float scale = 1.0f;
+
+			if( frameMax > frameMin ) {
+				frexp( ( frameMax - frameMin ) / steps, &exponent );
+				scale = ldexp( 1.0f, exponent );
+
+				while( scale * steps < frameMax - frameMin ) {
+					scale *= 2.0f;
+				}
+			}
+			else {
+				frameMax = frameMin;
+			}
+
+			nq.origin.s[axis] = frameMin;
+			nq.scale.s[axis] = scale;
+
+			for( cl_uint i = 0; i < width; i++ ) {
+				if( node->children.s[i] < 0 ) {
+					continue;
+				}
+
+				cl_int lo = floor( ( bbMin[axis][i] - frameMin ) / scale );
+				cl_int hi = ceil( ( bbMax[axis][i] - frameMin ) / scale );
+				lo = std::min( std::max( lo, 0 ), steps );
+				hi = std::min( std::max( hi, 0 ), steps );
+
+				// The division may have been rounded inwards. Check the
+				// decoded box, which is calculated like in the kernel.
+				while( lo > 0 && frameMin + lo * scale > bbMin[axis][i] ) {
+					lo--;
+				}
+				while( hi < steps && frameMin + hi * scale < bbMax[axis][i] ) {
+					hi++;
+				}
+
+				qMin[axis][i] = lo;
+				qMax[axis][i] = hi;
+			}
+		}
+
+		for( cl_uint i = 0; i < width; i++ ) {
+			nq.bbMinX.s[i] = qMin[0][i];
+			nq.bbMinY.s[i] = qMin[1][i];
+			nq.bbMinZ.s[i] = qMin[2][i];
+			nq.bbMaxX.s[i] = qMax[0][i];
+			nq.bbMaxY.s[i] = qMax[1][i];
+			nq.bbMaxZ.s[i] = qMax[2][i];
+			nq.numFaces.s[i] = node->numFaces.s[i];
+		}
+
+		nodesQ[index] = nq;
+	}
+
+	return sizeof( Q );
+}
+
+
+/**
+ * Look for a cached BVH of the model. Has to be called before initOpenCLBuffers().
+ * If there is no valid cache, the BVH has to be built and is then written to the cache.
+ * @param  {std::string} filepath Path to the OBJ file.
+ * @param  {std::string} filename Name of the OBJ file.
+ * @return {bool}                 True, if the BVH can be taken from the cache.
+ */
+bool PathTracer::loadBVHCache( string filepath, string filename ) {
+	// Each loaded model is profiled anew.
+	this->resetBVHProfileFrames();
+
+	if( mBVHCache != NULL ) {
+		delete mBVHCache;
+		mBVHCache = NULL;
+	}
+
+	// Profiling needs the BVH object for the new layout.
+	if(
+		Cfg::get().value<short>( Cfg::ACCEL_STRUCT ) != ACCELSTRUCT_BVH ||
+		!Cfg::get().value<bool>( Cfg::BVH_CACHE ) ||
+		mBVHProfileFrames > 0
+	) {
+		return false;
+	}
+
+	mBVHCache = new BVHCache( filepath, filename );
+
+	return mBVHCache->load();
 }
 
 
@@ -570,6 +1600,55 @@ void PathTracer::moveSun( const int key ) {
 }
 
 
+/**
+ * Read the last rendered image back from the device.
+ * @param {std::vector<cl_float>*} textureOut   Target for the image.
+ * @param {std::vector<cl_float>*} textureDebug Target for the debug image. Skipped if NULL
+ *                                              or if the debug image is disabled.
+ */
+void PathTracer::readImage( vector<cl_float>* textureOut, vector<cl_float>* textureDebug ) {
+	mCL->readImageOutput( mBufTextureIn, mWidth, mHeight, &(*textureOut)[0] );
+
+	if( textureDebug != NULL && mDebugImage ) {
+		mCL->readImageOutput( mBufTextureDebug, mWidth, mHeight, &(*textureDebug)[0] );
+	}
+}
+
+
+/**
+ * Start reading the last rendered image back from the device and get the
+ * one started by the previous call. The transfer runs while the next frames
+ * are rendered, so the image is one readback behind.
+ * @param  {std::vector<cl_float>*} textureOut Target for the image.
+ * @return {bool}                              True, if the target has been updated.
+ */
+bool PathTracer::readImageAsync( vector<cl_float>* textureOut ) {
+	cl_float* data = mCL->readImageOutputAsync( mBufTextureIn, mWidth, mHeight );
+
+	if( data == NULL ) {
+		return false;
+	}
+
+	memcpy( &(*textureOut)[0], data, sizeof( cl_float ) * mWidth * mHeight * 4 );
+
+	return true;
+}
+
+
+/**
+ * Set the number of frames to profile the BVH for from the config.
+ */
+void PathTracer::resetBVHProfileFrames() {
+	mBVHProfileFrames = Cfg::get().value<cl_uint>( Cfg::BVH_PROFILEFRAMES );
+
+	// Only the stackless traversal depends on the order of the children and skip-ahead.
+	if( mBVHProfileFrames > 0 && ( mBVHWidth != 2 || mBVHNearFirst ) ) {
+		Logger::logWarning( "[PathTracer] BVH profiling is only used for the stackless traversal of the binary BVH. Ignoring it." );
+		mBVHProfileFrames = 0;
+	}
+}
+
+
 /**
  * Reset the sample counter. Should be done whenever the camera is changed.
  */
@@ -598,7 +1677,6 @@ void PathTracer::setFocus( int x, int y ) {
 	mStructCam.focusPoint.y = y;
 
 	this->resetSampleCount();
-	mGLWidget->resetRenderTime();
 }
 
 
@@ -622,6 +1700,142 @@ void PathTracer::setWidthAndHeight( cl_uint width, cl_uint height ) {
 }
 
 
+/**
+ * Apply a transformation to one object of the model, e.g. to move it
+ * around. Instead of building a new BVH, the one of the object and its
+ * ancestors are refitted. Only the changed parts of the BVH, vertex and
+ * normal buffers are uploaded. Vertices used by other objects as well
+ * are moved for them, too, but their BVH nodes are not refitted, so the
+ * objects should not share vertices.
+ * @param {const cl_uint}   objectIndex Index of the object.
+ * @param {const glm::mat4} transform   Rigid transformation, applied to the current positions.
+ */
+void PathTracer::transformObject( const cl_uint objectIndex, const glm::mat4 transform ) {
+	if( mBVH == NULL ) {
+		Logger::logWarning( "[PathTracer] Cannot transform objects of a BVH loaded from the cache." );
+
+		return;
+	}
+
+	if( objectIndex >= mObjectVertices.size() ) {
+		char msg[128];
+		snprintf( msg, 128, "[PathTracer] Cannot transform object %u. No such object.", objectIndex );
+		Logger::logWarning( msg );
+
+		return;
+	}
+
+	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
+
+	const vector<cl_uint>* ov = &mObjectVertices[objectIndex];
+	const vector<cl_uint>* on = &mObjectNormals[objectIndex];
+	glm::mat3 normalMatrix = glm::mat3( glm::inverseTranspose( transform ) );
+
+	for( cl_uint i = 0; i < ov->size(); i++ ) {
+		cl_float4* v = &mVertices4[(*ov)[i]];
+		glm::vec4 p = transform * glm::vec4( v->x, v->y, v->z, 1.0f );
+		v->x = p[0];
+		v->y = p[1];
+		v->z = p[2];
+	}
+
+	for( cl_uint i = 0; i < on->size(); i++ ) {
+		cl_float4* n = &mNormals4[(*on)[i]];
+		glm::vec3 nt = glm::normalize( normalMatrix * glm::vec3( n->x, n->y, n->z ) );
+		n->x = nt[0];
+		n->y = nt[1];
+		n->z = nt[2];
+	}
+
+	vector<BVHNode*> changed = mBVH->refitObject( objectIndex, &mVertices4, &mNormals4 );
+	size_t numChangedCL;
+
+	if( mBVHWidth == 4 ) {
+		numChangedCL = this->updateWideNodes( &changed, &mBVHNodes4CL );
+	}
+	else if( mBVHWidth == 8 ) {
+		numChangedCL = this->updateWideNodes( &changed, &mBVHNodes8CL );
+	}
+	else {
+		vector<cl_uint> changedCL;
+
+		for( cl_uint i = 0; i < changed.size(); i++ ) {
+			cl_int index = mBVHNodeIndicesCL[changed[i]->id];
+
+			// Node has been skipped.
+			if( index < 0 ) {
+				continue;
+			}
+
+			// Keep the w components, the structure has not changed.
+			bvhNode_cl* sn = &mBVHNodesCL[index];
+			sn->bbMin.x = changed[i]->bbMin[0];
+			sn->bbMin.y = changed[i]->bbMin[1];
+			sn->bbMin.z = changed[i]->bbMin[2];
+			sn->bbMax.x = changed[i]->bbMax[0];
+			sn->bbMax.y = changed[i]->bbMax[1];
+			sn->bbMax.z = changed[i]->bbMax[2];
+
+			changedCL.push_back( index );
+		}
+
+		this->updateBufferRanges( mBufBVH, &mBVHNodesCL[0], sizeof( bvhNode_cl ), &changedCL );
+		numChangedCL = changedCL.size();
+	}
+
+	const vector<cl_uint>* ot = &mObjectTris[objectIndex];
+
+	for( cl_uint i = 0; i < ot->size(); i++ ) {
+		this->updateTri( (*ot)[i] );
+	}
+
+	this->updateBufferRanges( mBufVertices, &mVertices4[0], sizeof( cl_float4 ), ov );
+	this->updateBufferRanges( mBufNormals, &mNormals4[0], sizeof( cl_float4 ), on );
+	this->updateBufferRanges( mBufTris, &mTris[0], sizeof( tri_cl ), ot );
+	this->resetSampleCount();
+
+	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
+	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+
+	char msg[128];
+	snprintf(
+		msg, 128, "[PathTracer] Transformed object %u in %g ms. Updated %lu BVH nodes and %lu vertices.",
+		objectIndex, timeDiff, numChangedCL, ov->size()
+	);
+	Logger::logDebug( msg );
+}
+
+
+/**
+ * Write parts of a host array to its OpenCL buffer.
+ * Consecutive indices are combined into one write.
+ * @param {cl_mem}                      buffer      Handle of the buffer.
+ * @param {void*}                       data        The whole host array.
+ * @param {const size_t}                elementSize Size of one element in bytes.
+ * @param {const std::vector<cl_uint>*} indices     Ascending indices of the changed elements.
+ */
+void PathTracer::updateBufferRanges(
+	cl_mem buffer, void* data, const size_t elementSize, const vector<cl_uint>* indices
+) {
+	cl_uint i = 0;
+
+	while( i < indices->size() ) {
+		cl_uint first = (*indices)[i];
+		cl_uint count = 1;
+
+		while( i + count < indices->size() && (*indices)[i + count] == first + count ) {
+			count++;
+		}
+
+		mCL->updateBuffer(
+			buffer, count * elementSize,
+			(char*) data + first * elementSize, first * elementSize
+		);
+		i += count;
+	}
+}
+
+
 /**
  * Update the OpenCL buffer of the camera eye and related vectors.
  */
@@ -650,3 +1864,75 @@ void PathTracer::updateEyeBuffer() {
 	mStructCam.v.y = v[1];
 	mStructCam.v.z = v[2];
 }
+
+
+/**
+ * Calculate the edges and normal of a triangle from its current vertices.
+ * @param {const cl_uint} index Index of the face and triangle.
+ */
+void PathTracer::updateTri( const cl_uint index ) {
+	const cl_uint4 fv = mFacesV[index];
+	const glm::vec3 a( mVertices4[fv.x].x, mVertices4[fv.x].y, mVertices4[fv.x].z );
+	const glm::vec3 b( mVertices4[fv.y].x, mVertices4[fv.y].y, mVertices4[fv.y].z );
+	const glm::vec3 c( mVertices4[fv.z].x, mVertices4[fv.z].y, mVertices4[fv.z].z );
+	const glm::vec3 edge1 = b - a;
+	const glm::vec3 edge2 = c - a;
+	glm::vec3 normal = glm::cross( edge1, edge2 );
+
+	// Degenerated faces cannot be hit anyway.
+	if( glm::length( normal ) > 0.0f ) {
+		normal = glm::normalize( normal );
+	}
+
+	tri_cl* tri = &mTris[index];
+	tri->a = { a[0], a[1], a[2], normal[0] };
+	tri->edge1 = { edge1[0], edge1[1], edge1[2], normal[1] };
+	tri->edge2 = { edge2[0], edge2[1], edge2[2], normal[2] };
+}
+
+
+/**
+ * Update the child boxes of refitted nodes in a wide BVH and upload them.
+ * @param  {const std::vector<BVHNode*>*} changed Refitted nodes of the binary BVH.
+ * @param  {std::vector<T>*}              nodesCL Nodes of the wide BVH.
+ * @return {size_t}                               Number of updated wide nodes.
+ */
+template<typename T>
+size_t PathTracer::updateWideNodes( const vector<BVHNode*>* changed, vector<T>* nodesCL ) {
+	const cl_uint width = sizeof( T::children ) / sizeof( cl_int );
+	vector<cl_uint> changedCL;
+
+	for( cl_uint i = 0; i < changed->size(); i++ ) {
+		const BVHNode* node = (*changed)[i];
+		cl_int index = mBVHNodeIndicesCL[node->id];
+
+		// Node has been collapsed.
+		if( index < 0 ) {
+			continue;
+		}
+
+		cl_uint slot = index % width;
+		T* wn = &(*nodesCL)[index / width];
+		wn->bbMinX.s[slot] = node->bbMin[0];
+		wn->bbMinY.s[slot] = node->bbMin[1];
+		wn->bbMinZ.s[slot] = node->bbMin[2];
+		wn->bbMaxX.s[slot] = node->bbMax[0];
+		wn->bbMaxY.s[slot] = node->bbMax[1];
+		wn->bbMaxZ.s[slot] = node->bbMax[2];
+
+		changedCL.push_back( index / width );
+	}
+
+	std::sort( changedCL.begin(), changedCL.end() );
+	changedCL.erase( std::unique( changedCL.begin(), changedCL.end() ), changedCL.end() );
+
+	if( mBVHQuantize > 0 ) {
+		size_t nodeSize = this->quantizeWideNodes( nodesCL, &changedCL );
+		this->updateBufferRanges( mBufBVH, &mBVHNodesQuantizedCL[0], nodeSize, &changedCL );
+	}
+	else {
+		this->updateBufferRanges( mBufBVH, &(*nodesCL)[0], sizeof( T ), &changedCL );
+	}
+
+	return changedCL.size();
+}
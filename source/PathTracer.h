@@ -5,10 +5,14 @@
 
 #include <algorithm>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
 #include <ctime>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -16,9 +20,12 @@
 #include "CL.h"
 #include "Cfg.h"
 #include "MtlParser.h"
-#include "qt/GLWidget.h"
 #include "accelstructures/BVH.h"
 
+// Wavefront: Rounds between reading back the size of
+// the queue and sizing the kernel launches with it.
+#define WAVEFRONT_READBACK_LAG 2
+
 using std::vector;
 
 
@@ -36,6 +43,13 @@ struct face_cl {
 	cl_uint4 normals;
 };
 
+// Flat triangle for the intersection test, in the same order as the faces.
+struct tri_cl {
+	cl_float4 a;     // w: x of the normal
+	cl_float4 edge1; // b - a, w: y of the normal
+	cl_float4 edge2; // c - a, w: z of the normal
+};
+
 struct light_cl {
 	cl_float4 pos;
 	cl_float4 rgb;
@@ -67,39 +81,153 @@ struct material_shirley_ashikhmin_rgb {
 
 // BVH
 
+// The w components hold the bits of a cl_int.
 struct bvhNode_cl {
-	cl_float4 bbMin; // w: face index
-	cl_float4 bbMax; // w: face index or next node to visit
+	cl_float4 bbMin; // w: face index, -1 for inner nodes, -2 - instance index for instance nodes
+	cl_float4 bbMax; // w: number of faces for leaf nodes, otherwise the next node to visit
+	                 // (with "bvh.near_first": right child << 3 | left child is upper << 2 | split axis)
+};
+
+// Node of a wide (4-ary) BVH. The boxes of all children
+// are stored per axis, so they can be tested at once.
+struct bvhNode4_cl {
+	cl_float4 bbMinX;
+	cl_float4 bbMinY;
+	cl_float4 bbMinZ;
+	cl_float4 bbMaxX;
+	cl_float4 bbMaxY;
+	cl_float4 bbMaxZ;
+	cl_int4 children; // Node index, first face index or instance index. -1 for empty slots.
+	cl_int4 numFaces; // 0 for inner nodes, -1 for instance nodes
+};
+
+// Node of a wide (8-ary) BVH.
+struct bvhNode8_cl {
+	cl_float8 bbMinX;
+	cl_float8 bbMinY;
+	cl_float8 bbMinZ;
+	cl_float8 bbMaxX;
+	cl_float8 bbMaxY;
+	cl_float8 bbMaxZ;
+	cl_int8 children; // Node index, first face index or instance index. -1 for empty slots.
+	cl_int8 numFaces; // 0 for inner nodes, -1 for instance nodes
 };
 
+// Node of a wide BVH with quantized child boxes. The boxes are stored
+// as steps of <scale> from <origin>, the corner of the box around all
+// children, and rounded outwards.
+template<typename I, typename Q, typename C>
+struct bvhNodeQuantized_cl {
+	I children; // Node index, first face index or instance index. -1 for empty slots.
+	cl_float4 origin;
+	cl_float4 scale; // Powers of 2, so decoding the boxes is exact
+	Q bbMinX;
+	Q bbMinY;
+	Q bbMinZ;
+	Q bbMaxX;
+	Q bbMaxY;
+	Q bbMaxZ;
+	C numFaces; // 0 for inner nodes, -1 for instance nodes
+};
+
+typedef bvhNodeQuantized_cl<cl_int4, cl_uchar4, cl_char4> bvhNode4Q8_cl;
+typedef bvhNodeQuantized_cl<cl_int4, cl_ushort4, cl_char4> bvhNode4Q16_cl;
+typedef bvhNodeQuantized_cl<cl_int8, cl_uchar8, cl_char8> bvhNode8Q8_cl;
+typedef bvhNodeQuantized_cl<cl_int8, cl_ushort8, cl_char8> bvhNode8Q16_cl;
+
+struct bvhInstance_cl {
+	cl_float4 invRow0; // Rows of the inverse transformation (world to object)
+	cl_float4 invRow1;
+	cl_float4 invRow2;
+	cl_int4 nodes; // x: root node of the object, y: node after the last one of the object (binary BVH only)
+};
+
+
+// Wavefront
+
+// State of the path of a pixel between the kernels.
+struct pathState_cl {
+	cl_float4 rayOrigin;
+	cl_float4 rayDir;
+	cl_float4 rayNormal;
+	cl_float rayT;
+	cl_int rayHitFace;
+	cl_float4 color;
+	cl_float4 finalColor;
+	cl_float4 debugColor; // Only in the kernel with "render.debug_image", unused space otherwise
+	cl_float2 prevFocus; // x: tObject, y: tFocus
+	cl_float seed;
+	cl_float focus;
+	cl_uint secondaryPaths;
+	cl_uint sample;
+	cl_uint depth;
+	cl_int depthAdded;
+};
 
+struct shadowRay_cl {
+	cl_float4 origin; // w: distance to the light
+	cl_float4 dir;    // w: index of the path
+	cl_float4 color;
+};
+
+
+class BVHCache;
 class Camera;
-class GLWidget;
 
 
 class PathTracer {
 
 	public:
-		PathTracer( GLWidget* parent );
+		PathTracer();
 		~PathTracer();
-		vector<cl_float> generateImage( vector<cl_float>* textureDebug );
+		void generateImage();
+		CL* getCL();
+		cl_uint getNumObjects();
+		glm::vec3 getObjectCenter( const cl_uint objectIndex );
 		void initOpenCLBuffers(
 			vector<cl_float> vertices, vector<cl_uint> faces, vector<cl_float> normals,
 			ModelLoader* ml, AccelStructure* bvh
 		);
+		bool loadBVHCache( string filepath, string filename );
 		void moveSun( const int key );
+		void readImage( vector<cl_float>* textureOut, vector<cl_float>* textureDebug );
+		bool readImageAsync( vector<cl_float>* textureOut );
 		void resetSampleCount();
 		void setCamera( Camera* camera );
 		void setFocus( int x, int y );
 		void setFOV( cl_float fov );
 		void setWidthAndHeight( cl_uint width, cl_uint height );
+		void transformObject( const cl_uint objectIndex, const glm::mat4 transform );
 
 	protected:
+		void appendFacesOfNode(
+			BVH* bvh, BVHNode* node, const vector<cl_uint>* faces,
+			const vector<cl_uint>* facesVN, const vector<cl_int>* facesMtl,
+			vector<cl_uint4>* facesV, vector<cl_uint4>* facesN
+		);
+		void applyBVHProfile();
 		void clPathTracing( cl_float timeSinceStart );
+		void clPathTracingWavefront( cl_float timeSinceStart );
 		void clSetColors( cl_float timeSinceStart );
+		void createKernels();
+		cl_uint flattenBinaryNodes(
+			BVH* bvh, const vector<cl_int>* firstFaces, vector<bvhNode_cl>* nodesCL,
+			vector<bvhInstance_cl>* instancesCL, cl_uint* numTopLevelNodes
+		);
+		template<typename T> cl_uint flattenWideNode(
+			BVH* bvh, BVHNode* node, const vector<cl_int>* faceOffsets,
+			vector<T>* nodesCL, cl_uint* stackSize
+		);
+		cl_uint encodeNearFirst( BVH* bvh, vector<bvhNode_cl>* nodesCL );
 		cl_float getTimeSinceStart();
 		void initKernelArgs();
+		cl_uint initKernelArgs_Scene( cl_kernel kernel, cl_uint i );
+		void initKernelArgs_Textures();
 		size_t initOpenCLBuffers_BVH( BVH* bvh, ModelLoader* ml, vector<cl_uint> faces );
+		size_t initOpenCLBuffers_BVHCache();
+		template<typename T> size_t initOpenCLBuffers_BVHWide(
+			BVH* bvh, ModelLoader* ml, vector<cl_uint> faces, vector<T>* nodesCL
+		);
 		size_t initOpenCLBuffers_Faces(
 			ModelLoader* ml,
 			vector<cl_float> vertices, vector<cl_uint> faces, vector<cl_float> normals
@@ -108,7 +236,22 @@ class PathTracer {
 		size_t initOpenCLBuffers_Materials( ModelLoader* ml );
 		size_t initOpenCLBuffers_MaterialsRGB( vector<material_t> materials );
 		size_t initOpenCLBuffers_Textures();
+		size_t initOpenCLBuffers_Tris();
+		size_t initOpenCLBuffers_Wavefront();
+		size_t quantizeWideNodes( const vector<bvhNode4_cl>* nodesCL, const vector<cl_uint>* indices );
+		size_t quantizeWideNodes( const vector<bvhNode8_cl>* nodesCL, const vector<cl_uint>* indices );
+		template<typename T, typename Q> size_t quantizeWideNodes(
+			const vector<T>* nodesCL, const vector<cl_uint>* indices
+		);
+		void resetBVHProfileFrames();
+		void updateBufferRanges(
+			cl_mem buffer, void* data, const size_t elementSize, const vector<cl_uint>* indices
+		);
 		void updateEyeBuffer();
+		void updateTri( const cl_uint index );
+		template<typename T> size_t updateWideNodes(
+			const vector<BVHNode*>* changed, vector<T>* nodesCL
+		);
 
 	private:
 		cl_uint mHeight;
@@ -116,28 +259,66 @@ class PathTracer {
 		cl_float mFOV;
 		cl_uint mSampleCount;
 
-		vector<cl_float> mTextureOut;
-
 		// cl_kernel mKernelNoiseFiltering;
 		cl_kernel mKernelPathTracing;
+		cl_uint mKernelArgTextures; // Index of the first image argument of the path tracing kernel
+		bool mDebugImage;
+
+		// Wavefront
+		bool mWavefront;
+		cl_kernel mKernelGenerate;
+		cl_kernel mKernelExtend;
+		cl_kernel mKernelShade;
+		cl_kernel mKernelShadowRays;
+		cl_kernel mKernelSwapQueues;
+		cl_kernel mKernelAccumulate;
+		cl_mem mBufPaths;
+		cl_mem mBufQueues[2];
+		cl_mem mBufQueueCounters; // Rays in the current queue, rays in the next queue, shadow rays
+		cl_mem mBufShadowRays;
+		cl_uint mQueueSizes[WAVEFRONT_READBACK_LAG]; // Targets of the queue size readbacks
 
 		cl_mem mBufBVH;
+		cl_mem mBufBVHInstances;
 		cl_mem mBufBVHFaces;
+		cl_mem mBufBVHProfile;
 		cl_mem mBufFacesV;
 		cl_mem mBufFacesN;
+		cl_mem mBufTris;
 		cl_mem mBufVertices;
 		cl_mem mBufNormals;
 		cl_mem mBufMaterials;
 
 		camera_cl mStructCam;
-		cl_mem mBufTextureIn;
+		cl_mem mBufTextureIn; // Last accumulated image, swapped with the output after each frame
 		cl_mem mBufTextureOut;
 		cl_mem mBufTextureDebug;
 
 		vector<light_cl> mLights;
 		cl_mem mBufLights;
 
-		GLWidget* mGLWidget;
+		// Only set between loadBVHCache() and initOpenCLBuffers().
+		BVHCache* mBVHCache;
+
+		// Kept for updating single objects.
+		BVH* mBVH;
+		cl_uint mBVHWidth;
+		bool mBVHNearFirst;
+		cl_uint mBVHProfileFrames; // Frames left to profile
+		vector<bvhNode_cl> mBVHNodesCL;
+		vector<bvhNode4_cl> mBVHNodes4CL;
+		vector<bvhNode8_cl> mBVHNodes8CL;
+		cl_uint mBVHQuantize;
+		vector<cl_uchar> mBVHNodesQuantizedCL; // Node type depends on width and quantization
+		vector<cl_int> mBVHNodeIndicesCL;
+		vector<cl_uint4> mFacesV;
+		vector<tri_cl> mTris;
+		vector< vector<cl_uint> > mObjectTris;
+		vector<cl_float4> mVertices4;
+		vector<cl_float4> mNormals4;
+		vector< vector<cl_uint> > mObjectVertices;
+		vector< vector<cl_uint> > mObjectNormals;
+
 		Camera* mCamera;
 		CL* mCL;
 		// CL* mCLNoiseFilter;
@@ -3,6 +3,12 @@
 using std::vector;
 
 
+/**
+ * Destructor.
+ */
+AccelStructure::~AccelStructure() {}
+
+
 /**
  * Pack the list of single float values for the vertices as a list of cl_float4 values.
  * @param  {std::vector<cl_float>}  vertices The vertices to pack.
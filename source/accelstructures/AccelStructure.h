@@ -21,6 +21,7 @@ struct Tri {
 class AccelStructure {
 
 	public:
+		virtual ~AccelStructure();
 		static vector<cl_float4> packFloatAsFloat4( const vector<cl_float>* vertices );
 		virtual void visualize( vector<cl_float>* vertices, vector<cl_uint>* indices ) = 0;
 
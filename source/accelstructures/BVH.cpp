@@ -4,29 +4,151 @@ using std::vector;
 
 
 /**
- * Struct to use as comparator in std::sort() for the faces (cl_uint4).
+ * Struct to use as comparator in std::sort() for the face indices.
  */
 struct sortFacesCmp {
 
 	cl_uint axis;
+	const vector<Tri>* faces;
 
 	/**
 	 * Constructor.
-	 * @param {const cl_uint} axis Axis to compare the faces on.
+	 * @param {const cl_uint}           axis  Axis to compare the faces on.
+	 * @param {const std::vector<Tri>*} faces The faces the indices refer to.
 	 */
-	sortFacesCmp( const cl_uint axis ) {
+	sortFacesCmp( const cl_uint axis, const vector<Tri>* faces ) {
 		this->axis = axis;
+		this->faces = faces;
 	};
 
 	/**
 	 * Compare two faces.
-	 * @param  {const Tri} a Indizes for vertices that describe a face.
-	 * @param  {const Tri} b Indizes for vertices that describe a face.
-	 * @return {bool}        a < b
+	 * @param  {const cl_uint} a Index of a face.
+	 * @param  {const cl_uint} b Index of a face.
+	 * @return {bool}            a < b
 	 */
-	bool operator()( const Tri a, const Tri b ) {
-		cl_float cenA = ( a.bbMin[this->axis] + a.bbMax[this->axis] ) * 0.5f;
-		cl_float cenB = ( b.bbMin[this->axis] + b.bbMax[this->axis] ) * 0.5f;
+	bool operator()( const cl_uint a, const cl_uint b ) {
+		const Tri* triA = &(*this->faces)[a];
+		const Tri* triB = &(*this->faces)[b];
+		cl_float cenA = ( triA->bbMin[this->axis] + triA->bbMax[this->axis] ) * 0.5f;
+		cl_float cenB = ( triB->bbMin[this->axis] + triB->bbMax[this->axis] ) * 0.5f;
+
+		return cenA < cenB;
+	};
+
+};
+
+
+/**
+ * Struct to use as predicate in std::partition() for the face indices.
+ * Faces with their center left of (or on) the given position come first.
+ */
+struct splitFacesPred {
+
+	cl_uint axis;
+	cl_float pos;
+	const vector<Tri>* faces;
+
+	/**
+	 * Constructor.
+	 * @param {const cl_uint}           axis  Axis to split the faces on.
+	 * @param {const cl_float}          pos   Position of the split on the axis.
+	 * @param {const std::vector<Tri>*} faces The faces the indices refer to.
+	 */
+	splitFacesPred( const cl_uint axis, const cl_float pos, const vector<Tri>* faces ) {
+		this->axis = axis;
+		this->pos = pos;
+		this->faces = faces;
+	};
+
+	/**
+	 * Check the side of a face.
+	 * @param  {const cl_uint} a Index of a face.
+	 * @return {bool}            True, if the face is left of the split.
+	 */
+	bool operator()( const cl_uint a ) {
+		const Tri* tri = &(*this->faces)[a];
+
+		return ( tri->bbMin[this->axis] + tri->bbMax[this->axis] ) * 0.5f <= this->pos;
+	};
+
+};
+
+
+/**
+ * Struct to use as predicate in std::partition() for the face indices.
+ * Faces with their center in a bin left of the given split come first.
+ */
+struct binFacesPred {
+
+	cl_uint axis;
+	cl_float cenMin;
+	cl_float binFactor;
+	cl_uint numBins;
+	cl_uint split;
+	const vector<Tri>* faces;
+
+	/**
+	 * Constructor.
+	 * @param {const cl_uint}           axis      Axis to split the faces on.
+	 * @param {const cl_float}          cenMin    Position of the first bin on the axis.
+	 * @param {const cl_float}          binFactor Number of bins divided by the length of all bins.
+	 * @param {const cl_uint}           numBins   Number of bins.
+	 * @param {const cl_uint}           split     The first bin right of the split.
+	 * @param {const std::vector<Tri>*} faces     The faces the indices refer to.
+	 */
+	binFacesPred(
+		const cl_uint axis, const cl_float cenMin, const cl_float binFactor,
+		const cl_uint numBins, const cl_uint split, const vector<Tri>* faces
+	) {
+		this->axis = axis;
+		this->cenMin = cenMin;
+		this->binFactor = binFactor;
+		this->numBins = numBins;
+		this->split = split;
+		this->faces = faces;
+	};
+
+	/**
+	 * Check the side of a face.
+	 * @param  {const cl_uint} a Index of a face.
+	 * @return {bool}            True, if the face is left of the split.
+	 */
+	bool operator()( const cl_uint a ) {
+		const Tri* tri = &(*this->faces)[a];
+		cl_float cen = ( tri->bbMin[this->axis] + tri->bbMax[this->axis] ) * 0.5f;
+		cl_uint b = fmin( ( cen - this->cenMin ) * this->binFactor, this->numBins - 1 );
+
+		return b < this->split;
+	};
+
+};
+
+
+/**
+ * Struct to use as comparator in std::sort() for nodes.
+ */
+struct sortNodesCmp {
+
+	cl_uint axis;
+
+	/**
+	 * Constructor.
+	 * @param {const cl_uint} axis Axis to compare the node centers on.
+	 */
+	sortNodesCmp( const cl_uint axis ) {
+		this->axis = axis;
+	};
+
+	/**
+	 * Compare two nodes.
+	 * @param  {const BVHNode*} a A node.
+	 * @param  {const BVHNode*} b A node.
+	 * @return {bool}             a < b
+	 */
+	bool operator()( const BVHNode* a, const BVHNode* b ) {
+		cl_float cenA = a->bbMin[this->axis] + a->bbMax[this->axis];
+		cl_float cenB = b->bbMin[this->axis] + b->bbMax[this->axis];
 
 		return cenA < cenB;
 	};
@@ -42,152 +164,309 @@ BVH::BVH() {}
 
 /**
  * Build a BVH tree for each object in the scene and combine them into one big tree.
- * @param  {std::vector<object3D>} sceneObjects
- * @param  {std::vector<cl_float>} vertices
- * @param  {std::vector<cl_float>} normals
+ * Objects used by instances are not part of the big tree. Their trees are shared
+ * by all instances, which are leaves of the big tree.
+ * @param  {std::vector<object3D>}   sceneObjects
+ * @param  {std::vector<cl_float>}   vertices
+ * @param  {std::vector<cl_float>}   normals
+ * @param  {std::vector<instance_t>} instances
  * @return {BVH*}
  */
 BVH::BVH(
 	const vector<object3D> sceneObjects,
 	const vector<cl_float> vertices,
-	const vector<cl_float> normals
+	const vector<cl_float> normals,
+	const vector<instance_t> instances
 ) {
 	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
 	mDepthReached = 0;
+	mBuildMethod = Cfg::get().value<cl_uint>( Cfg::BVH_BUILDMETHOD );
+	mOptimizeTime = Cfg::get().value<cl_float>( Cfg::BVH_OPTIMIZETIME );
+	mMortonBits = ( Cfg::get().value<cl_uint>( Cfg::BVH_LBVH_MORTONBITS ) > 30 ) ? 63 : 30;
+	mLBVHSAHFaces = Cfg::get().value<cl_uint>( Cfg::BVH_LBVH_SAHFACES );
+	mSBVHAlpha = Cfg::get().value<cl_float>( Cfg::BVH_SBVH_ALPHA );
+	mSBVHDuplicates = Cfg::get().value<cl_float>( Cfg::BVH_SBVH_DUPLICATES );
+	mPhongTess = ( Cfg::get().value<cl_float>( Cfg::RENDER_PHONGTESS ) > 0.0f );
+	mStatsEPO = Cfg::get().value<bool>( Cfg::BVH_STATSEPO );
+	mSAHBins = Cfg::get().value<cl_uint>( Cfg::BVH_SAHBINS );
+	mSAHFaceCost = fmax( Cfg::get().value<cl_float>( Cfg::BVH_SAHFACECOST ), 0.0f );
+	mSAHFacesLimit = Cfg::get().value<cl_uint>( Cfg::BVH_SAHFACESLIMIT );
+	mParallelFaces = Cfg::get().value<cl_uint>( Cfg::BVH_PARALLELFACES );
+	mBuildThreads = Cfg::get().value<cl_uint>( Cfg::BVH_BUILDTHREADS );
+
+	if( mBuildThreads == 0 ) {
+		mBuildThreads = fmax( std::thread::hardware_concurrency(), 1 );
+	}
 	this->setMaxFaces( Cfg::get().value<cl_uint>( Cfg::BVH_MAXFACES ) );
 
 	vector<BVHNode*> subTrees = this->buildTreesFromObjects( &sceneObjects, &vertices, &normals );
-	mRoot = this->makeContainerNode( subTrees, true );
-	this->groupTreesToNodes( subTrees, mRoot, mDepthReached );
-	this->combineNodes( subTrees.size() );
-	this->logStats( timerStart );
-}
+	mObjectRoots = subTrees;
 
+	vector<BVHNode*> topNodes = this->createInstanceNodes( &sceneObjects, &instances, &subTrees );
+	std::map<const BVHNode*, cl_float> subTreeCosts;
 
-/**
- * Destructor.
- */
-BVH::~BVH() {
-	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
-		delete mNodes[i];
+	for( cl_uint i = 0; i < topNodes.size(); i++ ) {
+		subTreeCosts[topNodes[i]] = this->calcSubTreeCost( topNodes[i] );
 	}
+
+	mRoot = this->makeContainerNode( topNodes, true );
+	this->groupTreesToNodes( topNodes, &subTreeCosts, mRoot, mDepthReached );
+	this->combineNodes( topNodes.size() );
+	this->logStats( timerStart, &vertices );
 }
 
 
 /**
- * Assign faces to the created bins.
- * @param {const cl_uint}                              axis
- * @param {const cl_uint}                              splits
- * @param {const std::vector<Tri>*}                    faces
- * @param {const std::vector<std::vector<glm::vec3>>*} leftBin
- * @param {const std::vector<std::vector<glm::vec3>>*} rightBin
- * @param {std::vector<std::vector<Tri>>*}             leftBinFaces
- * @param {std::vector<std::vector<Tri>>*}             rightBinFaces
+ * Destructor. The nodes are released with the arena.
  */
-void BVH::assignFacesToBins(
-	const cl_uint axis, const cl_uint splits, const vector<Tri>* faces,
-	const vector< vector<glm::vec3> >* leftBin, const vector< vector<glm::vec3> >* rightBin,
-	vector< vector<Tri> >* leftBinFaces, vector< vector<Tri> >* rightBinFaces
-) {
-	for( cl_uint i = 0; i < splits; i++ ) {
-		vector<glm::vec3> leftAABB = (*leftBin)[i];
-		vector<glm::vec3> rightAABB = (*rightBin)[i];
-
-		for( cl_uint j = 0; j < faces->size(); j++ ) {
-			Tri tri = (*faces)[j];
-
-			if( tri.bbMin[axis] <= leftAABB[1][axis] && tri.bbMax[axis] >= leftAABB[0][axis] ) {
-				Tri triCpy;
-				triCpy.face = tri.face;
-				triCpy.bbMin = glm::vec3( tri.bbMin );
-				triCpy.bbMax = glm::vec3( tri.bbMax );
-				triCpy.bbMin[axis] = fmax( tri.bbMin[axis], leftAABB[0][axis] );
-				triCpy.bbMax[axis] = fmin( tri.bbMax[axis], leftAABB[1][axis] );
-
-				(*leftBinFaces)[i].push_back( triCpy );
-			}
-			if( tri.bbMin[axis] <= rightAABB[1][axis] && tri.bbMax[axis] >= rightAABB[0][axis] ) {
-				Tri triCpy;
-				triCpy.face = tri.face;
-				triCpy.bbMin = glm::vec3( tri.bbMin );
-				triCpy.bbMax = glm::vec3( tri.bbMax );
-				triCpy.bbMin[axis] = fmax( tri.bbMin[axis], rightAABB[0][axis] );
-				triCpy.bbMax[axis] = fmin( tri.bbMax[axis], rightAABB[1][axis] );
-
-				(*rightBinFaces)[i].push_back( triCpy );
-			}
-		}
-	}
-}
+BVH::~BVH() {}
 
 
 /**
  * Build the sphere tree.
- * @param  {std::vector<Tri>} faces
- * @param  {const glm::vec3}  bbMin
- * @param  {const glm::vec3}  bbMax
- * @param  {cl_uint}          depth  The current depth of the node in the tree. Starts at 1.
- * @param  {const cl_float}   rootSA
+ * @param  {const cl_uint}  faceOffset Index of the first face of the node in mFaceIndices.
+ * @param  {const cl_uint}  numFaces   Number of faces in the node.
+ * @param  {cl_uint}        depth      The current depth of the node in the tree. Starts at 1.
+ * @param  {const cl_float} rootSA
  * @return {BVHNode*}
  */
 BVHNode* BVH::buildTree(
-	vector<Tri> faces, const glm::vec3 bbMin, const glm::vec3 bbMax,
+	const cl_uint faceOffset, const cl_uint numFaces,
 	cl_uint depth, const cl_float rootSA
 ) {
-	BVHNode* containerNode = this->makeNode( faces, false );
-
+	BVHNode* containerNode = this->makeNode( faceOffset, numFaces );
 	containerNode->depth = depth;
-	mDepthReached = ( depth > mDepthReached ) ? depth : mDepthReached;
+
+	this->updateDepthReached( depth );
 
 	// leaf node
-	if( faces.size() <= mMaxFaces ) {
-		if( faces.size() <= 0 ) {
+	if( numFaces <= 1 ) {
+		if( numFaces <= 0 ) {
 			Logger::logWarning( "[BVH] No faces in node." );
 		}
 
-		containerNode->faces = faces;
+		containerNode->numFaces = numFaces;
 
 		return containerNode;
 	}
 
 
-	vector<Tri> leftFaces, rightFaces;
-	glm::vec3 bbMinLeft, bbMaxLeft, bbMinRight, bbMaxRight;
+	cl_uint numFacesLeft = 0;
+	cl_float splitSAH = FLT_MAX;
 
+	// Binned SAH is fast enough to be used for nodes of every size.
+	if( mSAHBins > 0 ) {
+		splitSAH = this->buildWithBinnedSAH( containerNode, faceOffset, numFaces, &numFacesLeft );
+	}
 	// SAH takes some time. Don't do it if there are too many faces.
-	if( faces.size() <= Cfg::get().value<cl_uint>( Cfg::BVH_SAHFACESLIMIT ) ) {
-		this->buildWithSAH(
-			containerNode, faces, &leftFaces, &rightFaces
-		);
+	else if( numFaces <= mSAHFacesLimit ) {
+		splitSAH = this->buildWithSAH( containerNode, faceOffset, numFaces, &numFacesLeft );
 	}
 	// Faster to build: Splitting at the midpoint of the longest axis.
 	else {
 		char msg[256];
-		snprintf( msg, 256, "[BVH] Too many faces in node for SAH. Splitting by mean position. (%lu faces)", faces.size() );
+		snprintf( msg, 256, "[BVH] Too many faces in node for SAH. Splitting by mean position. (%u faces)", numFaces );
 		Logger::logDebug( msg );
 
-		this->buildWithMeanSplit( containerNode, faces, &leftFaces, &rightFaces );
+		this->buildWithMeanSplit( containerNode, faceOffset, numFaces, &numFacesLeft );
 	}
 
-	if(
-		leftFaces.size() == 0 ||
-		rightFaces.size() == 0
-	) {
-		if( faces.size() > mMaxFaces ) {
-			Logger::logWarning( "[BVH] More faces than can be traversed in node." );
+	// leaf node, if testing all faces is cheaper than the split
+	if( this->isLeafCheaper( containerNode, numFaces, splitSAH ) ) {
+		containerNode->numFaces = numFaces;
+
+		return containerNode;
+	}
+
+	// The split did not separate the faces. Split at the object
+	// median instead, so no leaf exceeds the maximum number of faces.
+	if( numFacesLeft == 0 || numFacesLeft == numFaces ) {
+		numFacesLeft = numFaces / 2;
+	}
+
+	const cl_uint faceOffsetRight = faceOffset + numFacesLeft;
+	const cl_uint numFacesRight = numFaces - numFacesLeft;
+
+	// Build the right subtree on another thread, if
+	// it is big enough and a thread is available.
+	if( numFacesRight >= mParallelFaces && this->reserveThread() ) {
+		std::future<BVHNode*> rightFuture = std::async(
+			std::launch::async, &BVH::buildTree, this,
+			faceOffsetRight, numFacesRight, depth + 1, rootSA
+		);
+		containerNode->leftChild = this->buildTree( faceOffset, numFacesLeft, depth + 1, rootSA );
+		containerNode->rightChild = rightFuture.get();
+		this->releaseThread();
+	}
+	else {
+		containerNode->leftChild = this->buildTree( faceOffset, numFacesLeft, depth + 1, rootSA );
+		containerNode->rightChild = this->buildTree( faceOffsetRight, numFacesRight, depth + 1, rootSA );
+	}
+
+	return containerNode;
+}
+
+
+/**
+ * Build the sphere tree as linear BVH. The faces have to be sorted by their
+ * Morton codes. Nodes are split where the highest bit of the codes changes.
+ * Small nodes are handed to buildTree() to refine them with SAH.
+ * @param  {const cl_uint}  faceOffset Index of the first face of the node in mFaceIndices.
+ * @param  {const cl_uint}  numFaces   Number of faces in the node.
+ * @param  {cl_uint}        depth      The current depth of the node in the tree. Starts at 1.
+ * @param  {const cl_float} rootSA
+ * @return {BVHNode*}
+ */
+BVHNode* BVH::buildTreeLBVH(
+	const cl_uint faceOffset, const cl_uint numFaces,
+	cl_uint depth, const cl_float rootSA
+) {
+	if( numFaces <= mLBVHSAHFaces || numFaces <= mMaxFaces ) {
+		return this->buildTree( faceOffset, numFaces, depth, rootSA );
+	}
+
+	// The AABB is taken from the child nodes,
+	// so there is no need to iterate the faces.
+	BVHNode* containerNode = this->makeNode( faceOffset, 0 );
+	containerNode->depth = depth;
+
+	this->updateDepthReached( depth );
+
+	const cl_uint numFacesLeft = this->findMortonSplit( faceOffset, numFaces );
+	const cl_uint faceOffsetRight = faceOffset + numFacesLeft;
+	const cl_uint numFacesRight = numFaces - numFacesLeft;
+
+	if( numFacesRight >= mParallelFaces && this->reserveThread() ) {
+		std::future<BVHNode*> rightFuture = std::async(
+			std::launch::async, &BVH::buildTreeLBVH, this,
+			faceOffsetRight, numFacesRight, depth + 1, rootSA
+		);
+		containerNode->leftChild = this->buildTreeLBVH( faceOffset, numFacesLeft, depth + 1, rootSA );
+		containerNode->rightChild = rightFuture.get();
+		this->releaseThread();
+	}
+	else {
+		containerNode->leftChild = this->buildTreeLBVH( faceOffset, numFacesLeft, depth + 1, rootSA );
+		containerNode->rightChild = this->buildTreeLBVH( faceOffsetRight, numFacesRight, depth + 1, rootSA );
+	}
+
+	containerNode->bbMin = glm::min( containerNode->leftChild->bbMin, containerNode->rightChild->bbMin );
+	containerNode->bbMax = glm::max( containerNode->leftChild->bbMax, containerNode->rightChild->bbMax );
+
+	return containerNode;
+}
+
+
+/**
+ * Build the sphere tree with spatial splits (SBVH). Besides the object
+ * split found by the binned SAH, splits that cut the faces in two are
+ * evaluated. The faces cut this way are referenced by both child nodes.
+ * @param  {std::vector<cl_uint>*} refs  Indices of the references in the node. Will be emptied.
+ * @param  {cl_uint}               depth The current depth of the node in the tree. Starts at 1.
+ * @param  {SBVHBuild*}            build References and settings of the object that is being built.
+ * @return {BVHNode*}
+ */
+BVHNode* BVH::buildTreeSBVH( vector<cl_uint>* refs, cl_uint depth, SBVHBuild* build ) {
+	const cl_uint numRefs = refs->size();
+
+	BVHNode* containerNode = this->makeNode( 0, 0 );
+	containerNode->depth = depth;
+
+	this->updateDepthReached( depth );
+
+	for( cl_uint i = 0; i < numRefs; i++ ) {
+		const Tri* ref = &build->refs[(*refs)[i]];
+		containerNode->bbMin = ( i == 0 ) ? ref->bbMin : glm::min( containerNode->bbMin, ref->bbMin );
+		containerNode->bbMax = ( i == 0 ) ? ref->bbMax : glm::max( containerNode->bbMax, ref->bbMax );
+	}
+
+	// leaf node
+	if( numRefs <= 1 ) {
+		if( numRefs <= 0 ) {
+			Logger::logWarning( "[BVH] No faces in node." );
 		}
 
-		containerNode->faces = faces;
+		containerNode->faceOffset = build->leafRefs.size();
+		containerNode->numFaces = numRefs;
+		build->leafRefs.insert( build->leafRefs.end(), refs->begin(), refs->end() );
 
 		return containerNode;
 	}
 
-	containerNode->leftChild = this->buildTree(
-		leftFaces, bbMinLeft, bbMaxLeft, depth + 1, rootSA
-	);
-	containerNode->rightChild = this->buildTree(
-		rightFaces, bbMinRight, bbMaxRight, depth + 1, rootSA
-	);
+
+	// Object split
+
+	const cl_uint numBins = ( mSAHBins > 0 ) ? mSAHBins : 32;
+	cl_uint numRefsLeft = 0;
+	cl_float objectSAH = this->splitByBinnedSAH( &build->refs, &(*refs)[0], numRefs, numBins, &numRefsLeft );
+
+	// leaf node, if testing all faces is cheaper than the object split
+	if( this->isLeafCheaper( containerNode, numRefs, objectSAH ) ) {
+		containerNode->faceOffset = build->leafRefs.size();
+		containerNode->numFaces = numRefs;
+		build->leafRefs.insert( build->leafRefs.end(), refs->begin(), refs->end() );
+
+		return containerNode;
+	}
+
+	// All centroids are in the same place. Just do it 50:50.
+	if( objectSAH == FLT_MAX ) {
+		numRefsLeft = numRefs / 2;
+	}
+
+	vector<cl_uint> leftRefs, rightRefs;
+
+
+	// Spatial split. Only worth a try if the children
+	// of the object split overlap by a significant amount.
+
+	bool useSpatialSplit = false;
+
+	if( build->duplicatesLeft > 0 ) {
+		glm::vec3 bbMinL, bbMaxL, bbMinR, bbMaxR;
+
+		for( cl_uint i = 0; i < numRefs; i++ ) {
+			const Tri* ref = &build->refs[(*refs)[i]];
+
+			if( i < numRefsLeft ) {
+				bbMinL = ( i == 0 ) ? ref->bbMin : glm::min( bbMinL, ref->bbMin );
+				bbMaxL = ( i == 0 ) ? ref->bbMax : glm::max( bbMaxL, ref->bbMax );
+			}
+			else {
+				bbMinR = ( i == numRefsLeft ) ? ref->bbMin : glm::min( bbMinR, ref->bbMin );
+				bbMaxR = ( i == numRefsLeft ) ? ref->bbMax : glm::max( bbMaxR, ref->bbMax );
+			}
+		}
+
+		glm::vec3 overlapMin = glm::max( bbMinL, bbMinR );
+		glm::vec3 overlapMax = glm::min( bbMaxL, bbMaxR );
+		cl_float overlapSA = 0.0f;
+
+		if( overlapMin[0] < overlapMax[0] && overlapMin[1] < overlapMax[1] && overlapMin[2] < overlapMax[2] ) {
+			overlapSA = MathHelp::getSurfaceArea( overlapMin, overlapMax );
+		}
+
+		if( overlapSA / build->rootSA > mSBVHAlpha ) {
+			useSpatialSplit = this->splitSpatial(
+				containerNode, refs, build, objectSAH, &leftRefs, &rightRefs
+			);
+		}
+	}
+
+	if( !useSpatialSplit ) {
+		// See buildTree(): Split at the object median, so no leaf exceeds the maximum number of faces.
+		if( numRefsLeft == 0 || numRefsLeft == numRefs ) {
+			numRefsLeft = numRefs / 2;
+		}
+
+		leftRefs.assign( refs->begin(), refs->begin() + numRefsLeft );
+		rightRefs.assign( refs->begin() + numRefsLeft, refs->end() );
+	}
+
+	vector<cl_uint>().swap( *refs );
+
+	containerNode->leftChild = this->buildTreeSBVH( &leftRefs, depth + 1, build );
+	containerNode->rightChild = this->buildTreeSBVH( &rightRefs, depth + 1, build );
 
 	return containerNode;
 }
@@ -195,6 +474,7 @@ BVHNode* BVH::buildTree(
 
 /**
  * Build sphere trees for all given scene objects.
+ * The objects are distributed over the available threads.
  * @param  {const std::vector<object3D>*} sceneObjects
  * @param  {const std::vector<cl_float>*} vertices
  * @param  {const std::vector<cl_float>*} normals
@@ -205,17 +485,98 @@ vector<BVHNode*> BVH::buildTreesFromObjects(
 	const vector<cl_float>* vertices,
 	const vector<cl_float>* normals
 ) {
-	vector<BVHNode*> subTrees;
-	char msg[256];
+	const cl_uint numObjects = sceneObjects->size();
+	vector<BVHNode*> subTrees( numObjects, NULL );
+	vector<cl_uint> offsets( numObjects ), offsetsN( numObjects );
 	cl_uint offset = 0;
 	cl_uint offsetN = 0;
 
+	for( cl_uint i = 0; i < numObjects; i++ ) {
+		offsets[i] = offset;
+		offsetsN[i] = offsetN;
+		offset += (*sceneObjects)[i].facesV.size() / 3;
+		offsetN += (*sceneObjects)[i].facesVN.size() / 3;
+	}
+
+	// All faces of all objects. Each object builds its
+	// tree by partitioning its range of the indices.
+	mFaces = vector<Tri>( offset );
+	mFaceIndices = vector<cl_uint>( offset );
+
+	if( mBuildMethod == BVH_BUILD_LBVH ) {
+		mMortonCodes = vector<cl_ulong>( offset );
+	}
+	else if( mBuildMethod == BVH_BUILD_SBVH ) {
+		mSBVHBuilds = vector<SBVHBuild>( numObjects );
+	}
+
 	vector<cl_float4> vertices4 = this->packFloatAsFloat4( vertices );
+	vector<cl_float4> normals4 = this->packFloatAsFloat4( normals );
+
+	const cl_uint numWorkers = fmax( fmin( mBuildThreads, numObjects ), 1 );
+	std::atomic<cl_uint> nextObject( 0 );
+	vector<std::thread> workers;
+
+	// Threads not needed for the objects can be used to build subtrees.
+	mThreadsActive = numWorkers;
+
+	for( cl_uint i = 1; i < numWorkers; i++ ) {
+		workers.push_back( std::thread(
+			&BVH::buildTreesWorker, this,
+			sceneObjects, &offsets, &offsetsN, &vertices4, &normals4,
+			&nextObject, &subTrees
+		) );
+	}
+
+	this->buildTreesWorker(
+		sceneObjects, &offsets, &offsetsN, &vertices4, &normals4,
+		&nextObject, &subTrees
+	);
+
+	for( cl_uint i = 0; i < workers.size(); i++ ) {
+		workers[i].join();
+	}
+
+	// Only needed during the build.
+	vector<cl_ulong>().swap( mMortonCodes );
+
+	if( mBuildMethod == BVH_BUILD_SBVH ) {
+		this->collectSBVHReferences( &subTrees );
+	}
+
+	return subTrees;
+}
+
+
+/**
+ * Build sphere trees for scene objects until there are none left.
+ * Each subtree is stored at the index of its object, so the result
+ * does not depend on which thread built which object.
+ * @param {const std::vector<object3D>*}  sceneObjects
+ * @param {const std::vector<cl_uint>*}   offsets      Index of the first face of each object.
+ * @param {const std::vector<cl_uint>*}   offsetsN     Index of the first face normal of each object.
+ * @param {const std::vector<cl_float4>*} vertices4
+ * @param {const std::vector<cl_float4>*} normals4
+ * @param {std::atomic<cl_uint>*}         nextObject   Index of the next object to build a tree for.
+ * @param {std::vector<BVHNode*>*}        subTrees     Output. The built trees.
+ */
+void BVH::buildTreesWorker(
+	const vector<object3D>* sceneObjects,
+	const vector<cl_uint>* offsets, const vector<cl_uint>* offsetsN,
+	const vector<cl_float4>* vertices4, const vector<cl_float4>* normals4,
+	std::atomic<cl_uint>* nextObject, vector<BVHNode*>* subTrees
+) {
+	char msg[256];
+
+	while( true ) {
+		cl_uint i = (*nextObject)++;
+
+		if( i >= sceneObjects->size() ) {
+			break;
+		}
 
-	for( cl_uint i = 0; i < sceneObjects->size(); i++ ) {
 		vector<cl_uint4> facesThisObj;
-		ModelLoader::getFacesOfObject( (*sceneObjects)[i], &facesThisObj, offset );
-		offset += facesThisObj.size();
+		ModelLoader::getFacesOfObject( (*sceneObjects)[i], &facesThisObj, (*offsets)[i] );
 
 		snprintf(
 			msg, 256, "[BVH] Building tree %u/%lu: \"%s\". %lu faces.",
@@ -225,69 +586,124 @@ vector<BVHNode*> BVH::buildTreesFromObjects(
 
 
 		vector<cl_uint4> faceNormalsThisObj;
-		ModelLoader::getFaceNormalsOfObject( (*sceneObjects)[i], &faceNormalsThisObj, offsetN );
-		offsetN += faceNormalsThisObj.size();
+		ModelLoader::getFaceNormalsOfObject( (*sceneObjects)[i], &faceNormalsThisObj, (*offsetsN)[i] );
 
-		vector<Tri> triFaces = this->facesToTriStructs(
-			&facesThisObj, &faceNormalsThisObj, &vertices4, normals
-		);
+		this->facesToTriStructs( &facesThisObj, &faceNormalsThisObj, vertices4, normals4 );
 
+		const cl_uint faceOffset = (*offsets)[i];
+		const cl_uint numFaces = facesThisObj.size();
 
-		BVHNode* rootNode = this->makeNode( triFaces, true );
+		// Only for the AABB. Not part of the tree.
+		BVHNode* rootNode = this->makeNode( faceOffset, numFaces );
 		cl_float rootSA = MathHelp::getSurfaceArea( rootNode->bbMin, rootNode->bbMax );
 
-		glm::vec3 bbMin, bbMax;
-		BVHNode* st = this->buildTree( triFaces, bbMin, bbMax, 1, rootSA );
-		subTrees.push_back( st );
+		if( mBuildMethod == BVH_BUILD_LBVH ) {
+			this->sortByMortonCodes( faceOffset, numFaces );
+			(*subTrees)[i] = this->buildTreeLBVH( faceOffset, numFaces, 1, rootSA );
+		}
+		// The references of each object are kept separately, because
+		// the spatial splits add new ones. Objects are still built in
+		// parallel, but the nodes of one object are built on one thread.
+		else if( mBuildMethod == BVH_BUILD_SBVH ) {
+			SBVHBuild* build = &mSBVHBuilds[i];
+			build->refs.assign( mFaces.begin() + faceOffset, mFaces.begin() + faceOffset + numFaces );
+			build->vertices4 = vertices4;
+			build->rootSA = rootSA;
+			build->duplicatesLeft = numFaces * mSBVHDuplicates;
+
+			vector<cl_uint> refs( numFaces );
+
+			for( cl_uint j = 0; j < numFaces; j++ ) {
+				refs[j] = j;
+			}
+
+			(*subTrees)[i] = this->buildTreeSBVH( &refs, 1, build );
+		}
+		else {
+			(*subTrees)[i] = this->buildTree( faceOffset, numFaces, 1, rootSA );
+		}
 	}
 
-	return subTrees;
+	// No objects left. Free the thread for building subtrees.
+	this->releaseThread();
+}
+
+
+/**
+ * Build the BVH using a binned SAH.
+ * @param  {BVHNode*}      node         Container node for the (sub) tree.
+ * @param  {const cl_uint} faceOffset   Index of the first face of the node in mFaceIndices.
+ * @param  {const cl_uint} numFaces     Number of faces in the node.
+ * @param  {cl_uint*}      numFacesLeft Output. Number of faces left of the split.
+ * @return {cl_float}                   Best found SAH value.
+ */
+cl_float BVH::buildWithBinnedSAH(
+	BVHNode* node, const cl_uint faceOffset, const cl_uint numFaces, cl_uint* numFacesLeft
+) {
+	cl_float bestSAH = this->splitByBinnedSAH(
+		&mFaces, &mFaceIndices[faceOffset], numFaces, mSAHBins, numFacesLeft
+	);
+
+	// No split position found, e.g. because all centroids are in the same place.
+	if( bestSAH == FLT_MAX ) {
+		this->buildWithMeanSplit( node, faceOffset, numFaces, numFacesLeft );
+	}
+
+	return bestSAH;
 }
 
 
 /**
  * Build the BVH using mean splits.
- * @param {BVHNode*}                node        Container node for the (sub) tree.
- * @param {const std::vector<Tri>*} faces       Faces to be arranged into a BVH.
- * @param {std::vector<Tri>*}       leftFaces   Output. Faces left of the split.
- * @param {std::vector<Tri>*}       rightFaces  Output. Faces right of the split.
+ * @param {BVHNode*}      node         Container node for the (sub) tree.
+ * @param {const cl_uint} faceOffset   Index of the first face of the node in mFaceIndices.
+ * @param {const cl_uint} numFaces     Number of faces in the node.
+ * @param {cl_uint*}      numFacesLeft Output. Number of faces left of the split.
  */
 void BVH::buildWithMeanSplit(
-	BVHNode* node, const vector<Tri> faces,
-	vector<Tri>* leftFaces, vector<Tri>* rightFaces
+	BVHNode* node, const cl_uint faceOffset, const cl_uint numFaces, cl_uint* numFacesLeft
 ) {
 	cl_float bestSAH = FLT_MAX;
+	cl_float bestPos = 0.0f;
+	cl_uint bestAxis = 0;
 
 	for( cl_uint axis = 0; axis <= 2; axis++ ) {
-		vector<Tri> leftFacesTmp, rightFacesTmp;
-		cl_float splitPos = this->getMean( faces, axis );
-		cl_float sah = this->splitFaces( faces, splitPos, axis, &leftFacesTmp, &rightFacesTmp );
+		cl_float splitPos = this->getMean( faceOffset, numFaces, axis );
+		cl_float sah = this->splitFaces( faceOffset, numFaces, splitPos, axis );
 
 		if( sah < bestSAH ) {
 			bestSAH = sah;
-			*leftFaces = leftFacesTmp;
-			*rightFaces = rightFacesTmp;
+			bestPos = splitPos;
+			bestAxis = axis;
 		}
 	}
+
+	*numFacesLeft = this->partitionFaces( faceOffset, numFaces, bestPos, bestAxis );
 }
 
 
 /**
  * Build the BVH using SAH.
- * @param  {BVHNode*}          node       Container node for the (sub) tree.
- * @param  {std::vector<Tri>}  faces      Faces to be arranged into a BVH.
- * @param  {std::vector<Tri>*} leftFaces  Output. Faces left of the split.
- * @param  {std::vector<Tri>*} rightFaces Output. Faces right of the split.
- * @return {cl_float}                     Best found SAH value.
+ * @param  {BVHNode*}      node         Container node for the (sub) tree.
+ * @param  {const cl_uint} faceOffset   Index of the first face of the node in mFaceIndices.
+ * @param  {const cl_uint} numFaces     Number of faces in the node.
+ * @param  {cl_uint*}      numFacesLeft Output. Number of faces left of the split.
+ * @return {cl_float}                   Best found SAH value.
  */
 cl_float BVH::buildWithSAH(
-	BVHNode* node, vector<Tri> faces,
-	vector<Tri>* leftFaces, vector<Tri>* rightFaces
+	BVHNode* node, const cl_uint faceOffset, const cl_uint numFaces, cl_uint* numFacesLeft
 ) {
 	cl_float bestSAH = FLT_MAX;
+	int bestAxis = -1;
 
 	for( cl_uint axis = 0; axis <= 2; axis++ ) {
-		this->splitBySAH( &bestSAH, axis, faces, leftFaces, rightFaces );
+		this->splitBySAH( &bestSAH, axis, faceOffset, numFaces, &bestAxis, numFacesLeft );
+	}
+
+	// The faces are still sorted by the last axis.
+	if( bestAxis >= 0 && bestAxis != 2 ) {
+		vector<cl_uint>::iterator begin = mFaceIndices.begin() + faceOffset;
+		std::sort( begin, begin + numFaces, sortFacesCmp( bestAxis, &mFaces ) );
 	}
 
 	return bestSAH;
@@ -295,87 +711,535 @@ cl_float BVH::buildWithSAH(
 
 
 /**
- * Calculate the SAH value.
- * @param  {const cl_float} leftSA        Surface are of the left node.
- * @param  {const cl_float} leftNumFaces  Number of faces in the left node.
- * @param  {const cl_float} rightSA       Surface area of the right node.
- * @param  {const cl_float} rightNumFaces Number of faces in the right node.
- * @return {cl_float}                     Value estimated by the SAH.
+ * Calculate the effective parent overlap (EPO): The surface area of faces
+ * inside nodes they are not part of, weighted by the cost of the nodes and
+ * relative to the total surface area of the faces. Each tree of an instanced
+ * object is evaluated on its own.
+ * Ref: Aila, Karras and Laine, "On Quality Metrics of Bounding Volume Hierarchies", 2013.
+ * @param  {const std::vector<cl_float>*} vertices Vertices of the model.
+ * @return {cl_float}                              EPO of the whole BVH.
  */
-cl_float BVH::calcSAH(
-	const cl_float leftSA, const cl_float leftNumFaces,
-	const cl_float rightSA, const cl_float rightNumFaces
-) {
-	return ( leftSA * leftNumFaces + rightSA * rightNumFaces );
-}
+cl_float BVH::calcEPO( const vector<cl_float>* vertices ) {
+	vector<BVHNode*> roots( 1, mRoot );
+	roots.insert( roots.end(), mInstancedRoots.begin(), mInstancedRoots.end() );
 
+	// Vertex indices of the faces by face index. (The SBVH may have split
+	// faces into several references, all of them sharing the face index.)
+	vector<cl_uint4> faceVertices;
 
-/**
- * Combine the container nodes, leaf nodes and the root node into one list.
- * The root node will be at the very beginning of the list.
- * @param {const cl_uint} numSubTrees The number of generated trees (one for each 3D object).
- */
-void BVH::combineNodes( const cl_uint numSubTrees ) {
-	if( numSubTrees > 1 ) {
-		mNodes.push_back( mRoot );
+	for( cl_uint i = 0; i < mFaces.size(); i++ ) {
+		if( mFaces[i].face.w >= faceVertices.size() ) {
+			faceVertices.resize( mFaces[i].face.w + 1 );
+		}
+		faceVertices[mFaces[i].face.w] = mFaces[i].face;
 	}
 
-	mNodes.insert( mNodes.end(), mContainerNodes.begin(), mContainerNodes.end() );
+	vector<cl_uint> stamps( mNodes.size(), 0 );
+	cl_uint stamp = 0;
+	cl_float epo = 0.0f;
+	cl_float totalArea = 0.0f;
 
-	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
-		// Leaf node
-		if( mNodes[i]->faces.size() > 0 ) {
-			mLeafNodes.push_back( mNodes[i] );
-		}
-		// Not a leaf node
-		else {
-			mNodes[i]->leftChild->parent = mNodes[i];
-			mNodes[i]->rightChild->parent = mNodes[i];
+	for( cl_uint r = 0; r < roots.size(); r++ ) {
+		// Pairs of face index and a leaf referencing it.
+		vector< std::pair<cl_uint, BVHNode*> > refs;
+		vector<BVHNode*> stack( 1, roots[r] );
 
-			// Set the node with the bigger surface area as the left one
-			cl_float leftSA = MathHelp::getSurfaceArea( mNodes[i]->leftChild->bbMin, mNodes[i]->leftChild->bbMax );
-			cl_float rightSA = MathHelp::getSurfaceArea( mNodes[i]->rightChild->bbMin, mNodes[i]->rightChild->bbMax );
+		while( stack.size() > 0 ) {
+			BVHNode* node = stack.back();
+			stack.pop_back();
 
-			if( rightSA > leftSA ) {
-				BVHNode* tmp = mNodes[i]->leftChild;
-				mNodes[i]->leftChild = mNodes[i]->rightChild;
-				mNodes[i]->rightChild = tmp;
+			for( cl_uint j = 0; j < node->numFaces; j++ ) {
+				refs.push_back( std::make_pair( this->getFace( node, j ).face.w, node ) );
+			}
+			if( node->leftChild != NULL ) {
+				stack.push_back( node->leftChild );
+				stack.push_back( node->rightChild );
 			}
 		}
-	}
 
-	this->orderNodesByTraversal();
+		std::sort( refs.begin(), refs.end() );
 
-	if( Cfg::get().value<bool>( Cfg::BVH_SKIPAHEAD ) ) {
-		this->skipAheadOfNodes();
-	}
-}
+		for( cl_uint i = 0; i < refs.size(); ) {
+			const cl_uint faceIndex = refs[i].first;
+			stamp++;
 
+			// Mark the nodes containing the face.
+			for( ; i < refs.size() && refs[i].first == faceIndex; i++ ) {
+				BVHNode* node = refs[i].second;
 
-/**
- *
- * @param  {const std::vector<cl_uint4>*}  facesThisObj
- * @param  {const std::vector<cl_uint4>*}  faceNormalsThisObj
- * @param  {const std::vector<cl_float4>*} vertices4
- * @param  {const std::vector<float>*}     normals
- * @return {std::vector<Tri>}
- */
-vector<Tri> BVH::facesToTriStructs(
-	const vector<cl_uint4>* facesThisObj, const vector<cl_uint4>* faceNormalsThisObj,
-	const vector<cl_float4>* vertices4, const vector<float>* normals
-) {
-	vector<cl_float4> normals4 = this->packFloatAsFloat4( normals );
-	vector<Tri> triFaces;
+				while( node != NULL && stamps[node->id] != stamp ) {
+					stamps[node->id] = stamp;
+					node = ( node == roots[r] ) ? NULL : node->parent;
+				}
+			}
+
+			const cl_uint4 f = faceVertices[faceIndex];
+			const glm::vec3 v0( (*vertices)[f.x * 3], (*vertices)[f.x * 3 + 1], (*vertices)[f.x * 3 + 2] );
+			const glm::vec3 v1( (*vertices)[f.y * 3], (*vertices)[f.y * 3 + 1], (*vertices)[f.y * 3 + 2] );
+			const glm::vec3 v2( (*vertices)[f.z * 3], (*vertices)[f.z * 3 + 1], (*vertices)[f.z * 3 + 2] );
+			const glm::vec3 triMin = glm::min( v0, glm::min( v1, v2 ) );
+			const glm::vec3 triMax = glm::max( v0, glm::max( v1, v2 ) );
+
+			totalArea += 0.5f * glm::length( glm::cross( v1 - v0, v2 - v0 ) );
+
+			// Find the nodes overlapping the face, which do not contain it.
+			stack.assign( 1, roots[r] );
+
+			while( stack.size() > 0 ) {
+				BVHNode* node = stack.back();
+				stack.pop_back();
+
+				if(
+					triMin[0] > node->bbMax[0] || triMin[1] > node->bbMax[1] || triMin[2] > node->bbMax[2] ||
+					triMax[0] < node->bbMin[0] || triMax[1] < node->bbMin[1] || triMax[2] < node->bbMin[2]
+				) {
+					continue;
+				}
+
+				if( stamps[node->id] != stamp ) {
+					cl_float cost = ( node->numFaces > 0 ) ? mSAHFaceCost * node->numFaces : BVH_COST_NODE;
+					epo += cost * MathHelp::getTriangleAreaInAABB( v0, v1, v2, node->bbMin, node->bbMax );
+				}
+				if( node->leftChild != NULL ) {
+					stack.push_back( node->leftChild );
+					stack.push_back( node->rightChild );
+				}
+			}
+		}
+	}
+
+	return ( totalArea > 0.0f ) ? epo / totalArea : 0.0f;
+}
+
+
+/**
+ * Calculate metrics describing the quality of the built BVH.
+ * @param  {const std::vector<cl_float>*} vertices Vertices of the model. Only needed for the EPO.
+ * @return {BVHStats}                              The metrics. Without the build time.
+ */
+BVHStats BVH::calcStats( const vector<cl_float>* vertices ) {
+	BVHStats stats;
+	stats.buildTime = 0.0f;
+	stats.sahCost = 0.0f;
+	stats.avgLeafFaces = 0.0f;
+	stats.overlap = 0.0f;
+	stats.epo = -1.0f;
+
+	stats.sahCost = this->calcSubTreeCost( mRoot );
+
+	// Faces per leaf
+	for( cl_uint i = 0; i < mLeafNodes.size(); i++ ) {
+		stats.avgLeafFaces += mLeafNodes[i]->numFaces;
+	}
+
+	stats.avgLeafFaces /= fmax( mLeafNodes.size(), 1 );
+
+	// Overlap of siblings
+	cl_uint numInnerNodes = 0;
+
+	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+		BVHNode* node = mNodes[i];
+
+		if( node->leftChild == NULL ) {
+			continue;
+		}
+
+		cl_float sa = MathHelp::getSurfaceArea( node->bbMin, node->bbMax );
+		cl_float overlapSA = MathHelp::getOverlapSA(
+			glm::min( node->leftChild->bbMax, node->rightChild->bbMax ),
+			glm::max( node->leftChild->bbMin, node->rightChild->bbMin )
+		);
+
+		stats.overlap += ( sa > 0.0f ) ? overlapSA / sa : 0.0f;
+		numInnerNodes++;
+	}
+
+	stats.overlap /= fmax( numInnerNodes, 1 );
+
+	if( mStatsEPO ) {
+		stats.epo = this->calcEPO( vertices );
+	}
+
+	return stats;
+}
+
+
+/**
+ * Calculate the SAH cost of a (sub) tree, relative to the surface area of its root.
+ * That is the expected cost of a ray, which hit the root node. The trees of
+ * instanced objects are scaled to the surface area of their instance nodes.
+ * @param  {const BVHNode*} root Root node of the tree.
+ * @return {cl_float}            SAH cost.
+ */
+cl_float BVH::calcSubTreeCost( const BVHNode* root ) {
+	const cl_float rootSA = MathHelp::getSurfaceArea( root->bbMin, root->bbMax );
+	vector< std::pair<const BVHNode*, cl_float> > stack( 1, std::make_pair( root, 1.0f ) );
+	cl_float cost = 0.0f;
+
+	while( stack.size() > 0 ) {
+		const BVHNode* node = stack.back().first;
+		cl_float scale = stack.back().second;
+		stack.pop_back();
+
+		cl_float sa = scale * MathHelp::getSurfaceArea( node->bbMin, node->bbMax );
+
+		if( node->numFaces > 0 ) {
+			cost += mSAHFaceCost * node->numFaces * sa;
+		}
+		else {
+			cost += BVH_COST_NODE * sa;
+		}
+
+		if( node->instance >= 0 ) {
+			const BVHNode* objectRoot = mInstances[node->instance].root;
+			cl_float objectSA = MathHelp::getSurfaceArea( objectRoot->bbMin, objectRoot->bbMax );
+			stack.push_back( std::make_pair( objectRoot, ( objectSA > 0.0f ) ? sa / objectSA : 0.0f ) );
+		}
+		else if( node->leftChild != NULL ) {
+			stack.push_back( std::make_pair( node->leftChild, scale ) );
+			stack.push_back( std::make_pair( node->rightChild, scale ) );
+		}
+	}
+
+	return ( rootSA > 0.0f ) ? cost / rootSA : 0.0f;
+}
+
+
+/**
+ * Calculate the SAH value.
+ * @param  {const cl_float} leftSA        Surface are of the left node.
+ * @param  {const cl_float} leftNumFaces  Number of faces in the left node.
+ * @param  {const cl_float} rightSA       Surface area of the right node.
+ * @param  {const cl_float} rightNumFaces Number of faces in the right node.
+ * @return {cl_float}                     Value estimated by the SAH.
+ */
+cl_float BVH::calcSAH(
+	const cl_float leftSA, const cl_float leftNumFaces,
+	const cl_float rightSA, const cl_float rightNumFaces
+) {
+	return ( leftSA * leftNumFaces + rightSA * rightNumFaces );
+}
+
+
+/**
+ * Get the children of a node in a wide (4- or 8-ary) BVH by collapsing the
+ * binary tree below it. The inner node with the biggest surface area is
+ * replaced by its children, until there are <width> nodes or only leaves
+ * and instance nodes are left. A leaf or instance node is its own child.
+ * @param  {BVHNode*}              node  The node.
+ * @param  {const cl_uint}         width Maximum number of children.
+ * @return {std::vector<BVHNode*>}       The children, in the order of the binary tree.
+ */
+vector<BVHNode*> BVH::collapseNode( BVHNode* node, const cl_uint width ) {
+	vector<BVHNode*> children;
+
+	if( node->leftChild == NULL ) {
+		children.push_back( node );
+
+		return children;
+	}
+
+	children.push_back( node->leftChild );
+	children.push_back( node->rightChild );
+
+	while( children.size() < width ) {
+		cl_int bestIndex = -1;
+		cl_float bestSA = -1.0f;
+
+		for( cl_uint i = 0; i < children.size(); i++ ) {
+			if( children[i]->leftChild == NULL ) {
+				continue;
+			}
+
+			cl_float sa = MathHelp::getSurfaceArea( children[i]->bbMin, children[i]->bbMax );
+
+			if( sa > bestSA ) {
+				bestSA = sa;
+				bestIndex = i;
+			}
+		}
+
+		if( bestIndex < 0 ) {
+			break;
+		}
+
+		BVHNode* inner = children[bestIndex];
+		children[bestIndex] = inner->leftChild;
+		children.insert( children.begin() + bestIndex + 1, inner->rightChild );
+	}
+
+	return children;
+}
+
+
+/**
+ * Combine the references of all objects built with spatial splits into
+ * mFaces and mFaceIndices. Only references used by a leaf are kept, in
+ * the order of the leaves. The face ranges of the leaves are updated.
+ * @param {std::vector<BVHNode*>*} subTrees The built trees, one for each object.
+ */
+void BVH::collectSBVHReferences( vector<BVHNode*>* subTrees ) {
+	const cl_uint numFacesBefore = mFaces.size();
+	vector<Tri> faces;
+	vector<cl_uint> faceIndices;
+
+	for( cl_uint i = 0; i < subTrees->size(); i++ ) {
+		SBVHBuild* build = &mSBVHBuilds[i];
+		const cl_uint indexOffset = faces.size();
+
+		for( cl_uint j = 0; j < build->leafRefs.size(); j++ ) {
+			faceIndices.push_back( faces.size() );
+			faces.push_back( build->refs[build->leafRefs[j]] );
+		}
+
+		vector<BVHNode*> stack;
+		stack.push_back( (*subTrees)[i] );
+
+		while( stack.size() > 0 ) {
+			BVHNode* node = stack.back();
+			stack.pop_back();
+
+			if( node->numFaces > 0 ) {
+				node->faceOffset += indexOffset;
+			}
+			if( node->leftChild != NULL ) {
+				stack.push_back( node->leftChild );
+			}
+			if( node->rightChild != NULL ) {
+				stack.push_back( node->rightChild );
+			}
+		}
+	}
+
+	mFaces.swap( faces );
+	mFaceIndices.swap( faceIndices );
+	vector<SBVHBuild>().swap( mSBVHBuilds );
+
+	char msg[256];
+	snprintf(
+		msg, 256, "[BVH] Spatial splits: %lu references for %u faces (+%.1f%%).",
+		mFaces.size(), numFacesBefore,
+		( numFacesBefore > 0 ) ? ( (cl_float) mFaces.size() / numFacesBefore - 1.0f ) * 100.0f : 0.0f
+	);
+	Logger::logInfo( msg );
+}
+
+
+/**
+ * Combine the container nodes, leaf nodes and the root node into one list.
+ * The root node will be at the very beginning of the list, followed by the
+ * rest of the tree and then the trees of the instanced objects.
+ * @param {const cl_uint} numSubTrees The number of generated trees (one for each 3D object).
+ */
+void BVH::combineNodes( const cl_uint numSubTrees ) {
+	// The subtrees may have been built on several threads, so the order
+	// of mContainerNodes is not fixed. Collect the nodes from the tree.
+	vector<BVHNode*> stack( mInstancedRoots.rbegin(), mInstancedRoots.rend() );
+	stack.push_back( mRoot );
+
+	while( stack.size() > 0 ) {
+		BVHNode* node = stack.back();
+		stack.pop_back();
+		mNodes.push_back( node );
+
+		if( node->rightChild != NULL ) {
+			stack.push_back( node->rightChild );
+		}
+		if( node->leftChild != NULL ) {
+			stack.push_back( node->leftChild );
+		}
+	}
+
+	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+		// Not a leaf or instance node
+		if( mNodes[i]->leftChild != NULL ) {
+			mNodes[i]->leftChild->parent = mNodes[i];
+			mNodes[i]->rightChild->parent = mNodes[i];
+
+			// Set the node with the bigger surface area as the left one
+			cl_float leftSA = MathHelp::getSurfaceArea( mNodes[i]->leftChild->bbMin, mNodes[i]->leftChild->bbMax );
+			cl_float rightSA = MathHelp::getSurfaceArea( mNodes[i]->rightChild->bbMin, mNodes[i]->rightChild->bbMax );
+
+			if( rightSA > leftSA ) {
+				BVHNode* tmp = mNodes[i]->leftChild;
+				mNodes[i]->leftChild = mNodes[i]->rightChild;
+				mNodes[i]->rightChild = tmp;
+			}
+		}
+	}
+
+	if( mOptimizeTime > 0.0f ) {
+		this->optimizeTreelets();
+	}
+
+	this->orderNodesByTraversal();
+
+	mContainerNodes.clear();
+
+	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+		if( mNodes[i]->numFaces > 0 ) {
+			mLeafNodes.push_back( mNodes[i] );
+		}
+		if( i > 0 || numSubTrees == 1 ) {
+			mContainerNodes.push_back( mNodes[i] );
+		}
+	}
+
+	if( Cfg::get().value<bool>( Cfg::BVH_SKIPAHEAD ) ) {
+		this->skipAheadOfNodes( NULL );
+	}
+}
+
+
+/**
+ * Create a node for each instance, referencing the tree of the instanced object.
+ * The trees of instanced objects are only reachable through their instances.
+ * @param  {const std::vector<object3D>*}   sceneObjects
+ * @param  {const std::vector<instance_t>*} instances
+ * @param  {const std::vector<BVHNode*>*}   subTrees     The built trees, one for each object.
+ * @return {std::vector<BVHNode*>}                       Trees of the not instanced objects and the instance nodes.
+ */
+vector<BVHNode*> BVH::createInstanceNodes(
+	const vector<object3D>* sceneObjects, const vector<instance_t>* instances,
+	const vector<BVHNode*>* subTrees
+) {
+	vector<bool> isInstanced( subTrees->size(), false );
+	char msg[256];
+
+	for( cl_uint i = 0; i < instances->size(); i++ ) {
+		const instance_t* instance = &(*instances)[i];
+		cl_int objectIndex = -1;
 
+		for( cl_uint j = 0; j < sceneObjects->size(); j++ ) {
+			if( (*sceneObjects)[j].oName == instance->objectName ) {
+				objectIndex = j;
+				break;
+			}
+		}
+
+		if( objectIndex < 0 ) {
+			snprintf(
+				msg, 256, "[BVH] No object \"%s\" for instance \"%s\". Ignoring instance.",
+				instance->objectName.c_str(), instance->instanceName.c_str()
+			);
+			Logger::logWarning( msg );
+			continue;
+		}
+
+		glm::vec3 axis( instance->rotation.x, instance->rotation.y, instance->rotation.z );
+		glm::mat4 transform = glm::translate(
+			glm::mat4( 1.0f ),
+			glm::vec3( instance->pos.x, instance->pos.y, instance->pos.z )
+		);
+
+		if( instance->rotation.w != 0.0f && glm::length( axis ) > 0.0f ) {
+			transform = glm::rotate( transform, MathHelp::degToRad( instance->rotation.w ), axis );
+		}
+
+		transform = glm::scale( transform, glm::vec3( instance->scale ) );
+
+		BVHInstance bvhInstance;
+		bvhInstance.root = (*subTrees)[objectIndex];
+		bvhInstance.objectIndex = objectIndex;
+		bvhInstance.numNodes = 0;
+		bvhInstance.transform = transform;
+		mInstances.push_back( bvhInstance );
+
+		mInstances.back().node = this->makeInstanceNode( mInstances.size() - 1 );
+		isInstanced[objectIndex] = true;
+	}
+
+	vector<BVHNode*> topNodes;
+
+	for( cl_uint i = 0; i < subTrees->size(); i++ ) {
+		if( isInstanced[i] ) {
+			mInstancedRoots.push_back( (*subTrees)[i] );
+		}
+		else {
+			topNodes.push_back( (*subTrees)[i] );
+		}
+	}
+
+	for( cl_uint i = 0; i < mInstances.size(); i++ ) {
+		topNodes.push_back( mInstances[i].node );
+	}
+
+	if( mInstances.size() > 0 ) {
+		snprintf(
+			msg, 256, "[BVH] %lu instances of %lu objects.",
+			mInstances.size(), mInstancedRoots.size()
+		);
+		Logger::logInfo( msg );
+	}
+
+	return topNodes;
+}
+
+
+/**
+ * Create the Tri structs for the faces of an object and store them in mFaces.
+ * @param {const std::vector<cl_uint4>*}  facesThisObj
+ * @param {const std::vector<cl_uint4>*}  faceNormalsThisObj
+ * @param {const std::vector<cl_float4>*} vertices4
+ * @param {const std::vector<cl_float4>*} normals4
+ */
+void BVH::facesToTriStructs(
+	const vector<cl_uint4>* facesThisObj, const vector<cl_uint4>* faceNormalsThisObj,
+	const vector<cl_float4>* vertices4, const vector<cl_float4>* normals4
+) {
 	for( uint j = 0; j < facesThisObj->size(); j++ ) {
 		Tri tri;
 		tri.face = (*facesThisObj)[j];
 		tri.normals = (*faceNormalsThisObj)[j];
-		MathHelp::triCalcAABB( &tri, vertices4, &normals4 );
-		triFaces.push_back( tri );
+		MathHelp::triCalcAABB( &tri, vertices4, normals4 );
+
+		// The 4th component is the index of the face over all objects.
+		mFaces[tri.face.w] = tri;
+		mFaceIndices[tri.face.w] = tri.face.w;
+	}
+}
+
+
+/**
+ * Find the position to split faces sorted by Morton code at. This is
+ * where the highest bit, in which the first and last code differ, changes.
+ * @param  {const cl_uint} faceOffset Index of the first face in mFaceIndices.
+ * @param  {const cl_uint} numFaces   Number of faces.
+ * @return {cl_uint}                  Number of faces left of the split.
+ */
+cl_uint BVH::findMortonSplit( const cl_uint faceOffset, const cl_uint numFaces ) {
+	const cl_ulong first = mMortonCodes[faceOffset];
+	const cl_ulong last = mMortonCodes[faceOffset + numFaces - 1];
+
+	// Identical codes. Just do it 50:50.
+	if( first == last ) {
+		return numFaces / 2;
+	}
+
+	cl_ulong diff = first ^ last;
+	cl_ulong highestBit = 1;
+
+	while( diff >>= 1 ) {
+		highestBit <<= 1;
+	}
+
+	// All codes share the bits above the highest differing one. Because
+	// they are sorted, the codes without the bit set come first.
+	cl_uint left = 0;
+	cl_uint right = numFaces - 1;
+
+	while( left < right ) {
+		cl_uint mid = ( left + right ) / 2;
+
+		if( mMortonCodes[faceOffset + mid] & highestBit ) {
+			right = mid;
+		}
+		else {
+			left = mid + 1;
+		}
 	}
 
-	return triFaces;
+	return left;
 }
 
 
@@ -398,48 +1262,50 @@ cl_uint BVH::getDepth() {
 
 
 /**
- * Get all leaf nodes.
- * @return {std::vector<BVHNode*>} List of all leaf nodes.
+ * Get a face of a leaf node.
+ * @param  {const BVHNode*} node  The leaf node.
+ * @param  {const cl_uint}  index Index of the face in the node, [0, node->numFaces).
+ * @return {Tri}                  The face.
  */
-vector<BVHNode*> BVH::getLeafNodes() {
-	return mLeafNodes;
+Tri BVH::getFace( const BVHNode* node, const cl_uint index ) {
+	return mFaces[mFaceIndices[node->faceOffset + index]];
 }
 
 
 /**
- * Find the mean of the triangles regarding the given axis.
- * @param  {const std::vector<Tri>} faces
- * @param  {const cl_uint}          axis
- * @return {cl_float}
+ * Get the instances of objects.
+ * @return {std::vector<BVHInstance>} List of all instances.
  */
-cl_float BVH::getMean( const vector<Tri> faces, const cl_uint axis ) {
-	cl_float sum = 0.0f;
+vector<BVHInstance> BVH::getInstances() {
+	return mInstances;
+}
 
-	for( cl_uint i = 0; i < faces.size(); i++ ) {
-		Tri tri = faces[i];
-		glm::vec3 center = 0.5f * ( tri.bbMin + tri.bbMax );
-		sum += center[axis];
-	}
 
-	return sum / faces.size();
+/**
+ * Get all leaf nodes.
+ * @return {std::vector<BVHNode*>} List of all leaf nodes.
+ */
+vector<BVHNode*> BVH::getLeafNodes() {
+	return mLeafNodes;
 }
 
 
 /**
- * Find the mean of the centers of the given nodes.
- * @param  {const std::vector<BVHNode*>} nodes
- * @param  {const cl_uint}               axis
+ * Find the mean of the triangles regarding the given axis.
+ * @param  {const cl_uint} faceOffset Index of the first face in mFaceIndices.
+ * @param  {const cl_uint} numFaces   Number of faces.
+ * @param  {const cl_uint} axis
  * @return {cl_float}
  */
-cl_float BVH::getMeanOfNodes( const vector<BVHNode*> nodes, const cl_uint axis ) {
+cl_float BVH::getMean( const cl_uint faceOffset, const cl_uint numFaces, const cl_uint axis ) {
 	cl_float sum = 0.0f;
 
-	for( cl_uint i = 0; i < nodes.size(); i++ ) {
-		glm::vec3 center = ( nodes[i]->bbMax - nodes[i]->bbMin ) * 0.5f;
-		sum += center[axis];
+	for( cl_uint i = faceOffset; i < faceOffset + numFaces; i++ ) {
+		const Tri* tri = &mFaces[mFaceIndices[i]];
+		sum += ( tri->bbMin[axis] + tri->bbMax[axis] ) * 0.5f;
 	}
 
-	return sum / nodes.size();
+	return sum / numFaces;
 }
 
 
@@ -453,6 +1319,25 @@ vector<BVHNode*> BVH::getNodes() {
 }
 
 
+/**
+ * Get the root node of the tree of an object.
+ * @param  {const cl_uint} objectIndex Index of the object.
+ * @return {BVHNode*}                  The root node or NULL, if there is no such object.
+ */
+BVHNode* BVH::getObjectRoot( const cl_uint objectIndex ) {
+	return ( objectIndex < mObjectRoots.size() ) ? mObjectRoots[objectIndex] : NULL;
+}
+
+
+/**
+ * Get the build time and quality metrics of the BVH.
+ * @return {BVHStats} The stats.
+ */
+BVHStats BVH::getStats() {
+	return mStats;
+}
+
+
 /**
  * Get the root node.
  * @return {BVHNode*} The root node.
@@ -463,69 +1348,89 @@ BVHNode* BVH::getRoot() {
 
 
 /**
- * Group the sphere nodes into two groups and assign them to the given parent node.
- * @param {std::vector<BVHNode*>} nodes
- * @param {BVHNode*}              parent
- * @param {cl_uint}               depth
+ * Get the node to continue with after the subtree of the given node in
+ * a pre-order traversal: the right sibling of the node or, if it is a
+ * right node itself, of the closest parent that is a left node.
+ * @param  {const BVHNode*} node The node.
+ * @return {BVHNode*}            The next node or NULL if the subtree was the last one.
+ */
+BVHNode* BVH::getSkipNode( const BVHNode* node ) {
+	// As long as we are on the right side of a (sub)tree,
+	// skip parents until we either are at the root or
+	// our parent has a true sibling again.
+	while( node->parent != NULL && node->parent->rightChild == node ) {
+		node = node->parent;
+	}
+
+	// Reached the root, this was the last node.
+	if( node->parent == NULL ) {
+		return NULL;
+	}
+
+	return node->parent->rightChild;
+}
+
+
+/**
+ * Group the object trees into two groups by SAH and assign them to the given parent node.
+ * @param {std::vector<BVHNode*>}                     nodes        Roots of the object trees and instance nodes.
+ * @param {const std::map<const BVHNode*, cl_float>*} subTreeCosts SAH cost of each node's tree.
+ * @param {BVHNode*}                                  parent
+ * @param {cl_uint}                                   depth
  */
-void BVH::groupTreesToNodes( vector<BVHNode*> nodes, BVHNode* parent, cl_uint depth ) {
+void BVH::groupTreesToNodes(
+	vector<BVHNode*> nodes, const std::map<const BVHNode*, cl_float>* subTreeCosts,
+	BVHNode* parent, cl_uint depth
+) {
 	if( nodes.size() == 1 ) {
 		return;
 	}
 
 	parent->depth = depth;
-	mDepthReached = ( depth > mDepthReached ) ? depth : mDepthReached;
+	this->updateDepthReached( depth );
 
-	cl_uint axis = this->longestAxis( parent );
 	vector<BVHNode*> leftGroup, rightGroup;
-	cl_float mean = this->getMeanOfNodes( nodes, axis );
-	this->splitNodes( nodes, mean, axis, &leftGroup, &rightGroup );
+	this->splitNodesBySAH( nodes, subTreeCosts, &leftGroup, &rightGroup );
 
 	BVHNode* leftNode = this->makeContainerNode( leftGroup, false );
 	parent->leftChild = leftNode;
-	this->groupTreesToNodes( leftGroup, parent->leftChild, depth + 1 );
+	this->groupTreesToNodes( leftGroup, subTreeCosts, parent->leftChild, depth + 1 );
 
 	BVHNode* rightNode = this->makeContainerNode( rightGroup, false );
 	parent->rightChild = rightNode;
-	this->groupTreesToNodes( rightGroup, parent->rightChild, depth + 1 );
+	this->groupTreesToNodes( rightGroup, subTreeCosts, parent->rightChild, depth + 1 );
 }
 
 
 /**
  * Grow AABBs according to the contained faces and calculate their surface areas.
- * @param {const std::vector<Tri>*}              faces
- * @param {std::vector<std::vector<glm::vec3>>*} leftBB
- * @param {std::vector<std::vector<glm::vec3>>*} rightBB
- * @param {std::vector<cl_float>*}               leftSA
- * @param {std::vector<cl_float>*}               rightSA
+ * @param {const cl_uint}          faceOffset Index of the first face in mFaceIndices.
+ * @param {const cl_uint}          numFaces   Number of faces.
+ * @param {std::vector<cl_float>*} leftSA
+ * @param {std::vector<cl_float>*} rightSA
  */
 void BVH::growAABBsForSAH(
-	const vector<Tri>* faces,
-	vector< vector<glm::vec3> >* leftBB, vector< vector<glm::vec3> >* rightBB,
+	const cl_uint faceOffset, const cl_uint numFaces,
 	vector<cl_float>* leftSA, vector<cl_float>* rightSA
 ) {
 	glm::vec3 bbMin, bbMax;
-	const cl_uint numFaces = faces->size();
 
 
 	// Grow a bounding box face by face starting from the left.
 	// Save the growing surface area for each step.
 
 	for( int i = 0; i < numFaces - 1; i++ ) {
-		Tri f = (*faces)[i];
+		const Tri* f = &mFaces[mFaceIndices[faceOffset + i]];
 
 		if( i == 0 ) {
-			bbMin = glm::vec3( f.bbMin );
-			bbMax = glm::vec3( f.bbMax );
+			bbMin = glm::vec3( f->bbMin );
+			bbMax = glm::vec3( f->bbMax );
 		}
 		else {
-			bbMin = glm::min( bbMin, f.bbMin );
-			bbMax = glm::max( bbMax, f.bbMax );
+			bbMin = glm::min( bbMin, f->bbMin );
+			bbMax = glm::max( bbMax, f->bbMax );
 		}
 
-		(*leftBB)[i] = vector<glm::vec3>( 2 );
-		(*leftBB)[i][0] = bbMin;
-		(*leftBB)[i][1] = bbMax;
 		(*leftSA)[i] = MathHelp::getSurfaceArea( bbMin, bbMax );
 	}
 
@@ -534,61 +1439,156 @@ void BVH::growAABBsForSAH(
 	// Save the growing surface area for each step.
 
 	for( int i = numFaces - 2; i >= 0; i-- ) {
-		Tri f = (*faces)[i + 1];
+		const Tri* f = &mFaces[mFaceIndices[faceOffset + i + 1]];
 
 		if( i == numFaces - 2 ) {
-			bbMin = glm::vec3( f.bbMin );
-			bbMax = glm::vec3( f.bbMax );
+			bbMin = glm::vec3( f->bbMin );
+			bbMax = glm::vec3( f->bbMax );
 		}
 		else {
-			bbMin = glm::min( bbMin, f.bbMin );
-			bbMax = glm::max( bbMax, f.bbMax );
+			bbMin = glm::min( bbMin, f->bbMin );
+			bbMax = glm::max( bbMax, f->bbMax );
 		}
 
-		(*rightBB)[i] = vector<glm::vec3>( 2 );
-		(*rightBB)[i][0] = bbMin;
-		(*rightBB)[i][1] = bbMax;
 		(*rightSA)[i] = MathHelp::getSurfaceArea( bbMin, bbMax );
 	}
 }
 
 
 /**
- * Log some stats.
- * @param {boost::posix_time::ptime} timerStart
+ * Check if a node is cheaper to traverse as leaf than after the found split.
+ * The split costs a node test plus the face tests of both children.
+ * @param  {const BVHNode*} node     The node.
+ * @param  {const cl_uint}  numFaces Number of faces in the node.
+ * @param  {const cl_float} splitSAH SAH value of the split. FLT_MAX if none has been found.
+ * @return {bool}                    True, if the node should be a leaf.
  */
-void BVH::logStats( boost::posix_time::ptime timerStart ) {
-	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
-	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
-	string timeUnits = "ms";
+bool BVH::isLeafCheaper( const BVHNode* node, const cl_uint numFaces, const cl_float splitSAH ) {
+	if( numFaces > mMaxFaces ) {
+		return false;
+	}
 
-	if( timeDiff > 1000.0f ) {
-		timeDiff /= 1000.0f;
-		timeUnits = "s";
+	if( splitSAH == FLT_MAX ) {
+		return true;
 	}
 
-	char msg[512];
+	const cl_float sa = MathHelp::getSurfaceArea( node->bbMin, node->bbMax );
+
+	return ( mSAHFaceCost * numFaces * sa <= BVH_COST_NODE * sa + mSAHFaceCost * splitSAH );
+}
+
+
+/**
+ * Check if the AABB of a reference still contains something.
+ * Clipping a face can leave nothing on one side of the plane.
+ * @param  {const Tri*} ref The reference.
+ * @return {bool}           True, if the AABB is valid.
+ */
+bool BVH::isValidReference( const Tri* ref ) {
+	return (
+		ref->bbMin[0] <= ref->bbMax[0] &&
+		ref->bbMin[1] <= ref->bbMax[1] &&
+		ref->bbMin[2] <= ref->bbMax[2]
+	);
+}
+
+
+/**
+ * Lay out the nodes again with statistics gathered during rendering.
+ * The left child of a node is only tested if its parent has been hit,
+ * so its hit rate is the chance to be hit together with the parent.
+ * @param {const std::vector<cl_uint>*} profile      Box tests and hits for each node, by node ID.
+ * @param {const bool}                  swapChildren Put a child node first, if it can be skipped there.
+ */
+void BVH::layoutByProfile( const vector<cl_uint>* profile, const bool swapChildren ) {
+	// The IDs change with the new order.
+	std::map<const BVHNode*, cl_float> hitRates;
+	cl_uint numSwapped = 0;
+
+	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+		const cl_uint numTests = (*profile)[i * 2];
+		const cl_uint numHits = (*profile)[i * 2 + 1];
+
+		if( numTests >= BVH_PROFILE_MIN_TESTS ) {
+			hitRates[mNodes[i]] = (cl_float) numHits / (cl_float) numTests;
+		}
+	}
+
+	if( swapChildren ) {
+		const cl_float cmp = Cfg::get().value<cl_float>( Cfg::BVH_SKIPAHEAD_CMP );
+
+		for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+			BVHNode* node = mNodes[i];
+
+			if( node->leftChild == NULL || hitRates.count( node->rightChild ) == 0 ) {
+				continue;
+			}
+
+			// Only a left child can be skipped and only if it is an inner node.
+			// Swap, if that way a child is skipped that is not skipped now.
+			const BVHNode* left = node->leftChild;
+			const BVHNode* right = node->rightChild;
+			const bool isLeftSkippable = ( left->leftChild != NULL && hitRates.count( left ) > 0 && hitRates[left] >= cmp );
+			const bool isRightSkippable = ( right->leftChild != NULL && hitRates[right] >= cmp );
+
+			if( isRightSkippable && !isLeftSkippable ) {
+				BVHNode* tmp = node->leftChild;
+				node->leftChild = node->rightChild;
+				node->rightChild = tmp;
+				numSwapped++;
+			}
+		}
+	}
+
+	this->orderNodesByTraversal();
+
+	if( Cfg::get().value<bool>( Cfg::BVH_SKIPAHEAD ) ) {
+		this->skipAheadOfNodes( &hitRates );
+	}
+
+	char msg[128];
 	snprintf(
-		msg, 512, "[BVH] Generated in %.2f %s. Contains %lu nodes (%lu leaves). Max faces of %u. Max depth of %u.",
-		timeDiff, timeUnits.c_str(), mNodes.size(), mLeafNodes.size(), mMaxFaces, mDepthReached
+		msg, 128, "[BVH] Profiled %lu of %lu nodes. Swapped the children of %u nodes.",
+		hitRates.size(), mNodes.size(), numSwapped
 	);
 	Logger::logInfo( msg );
 }
 
 
 /**
- * Get the index of the longest axis.
- * @param  {const BVHNode*} node The node to find the longest side of.
- * @return {cl_uint}             Index of the longest axis (X: 0, Y: 1, Z: 2).
+ * Log some stats.
+ * @param {boost::posix_time::ptime}     timerStart
+ * @param {const std::vector<cl_float>*} vertices   Vertices of the model.
  */
-cl_uint BVH::longestAxis( const BVHNode* node ) {
-	glm::vec3 sides = node->bbMax - node->bbMin;
+void BVH::logStats( boost::posix_time::ptime timerStart, const vector<cl_float>* vertices ) {
+	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
+	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+	string timeUnits = "ms";
+
+	mStats = this->calcStats( vertices );
+	mStats.buildTime = timeDiff;
 
-	if( sides[0] > sides[1] ) {
-		return ( sides[0] > sides[2] ) ? 0 : 2;
+	if( timeDiff > 1000.0f ) {
+		timeDiff /= 1000.0f;
+		timeUnits = "s";
 	}
-	else { // sides[1] > sides[0]
-		return ( sides[1] > sides[2] ) ? 1 : 2;
+
+	char msg[512];
+	snprintf(
+		msg, 512, "[BVH] Generated in %.2f %s. Contains %lu nodes (%lu leaves). Max faces of %u. Max depth of %u.",
+		timeDiff, timeUnits.c_str(), mNodes.size(), mLeafNodes.size(), mMaxFaces, mDepthReached.load()
+	);
+	Logger::logInfo( msg );
+
+	snprintf(
+		msg, 512, "[BVH] SAH cost of %.2f. Avg. faces per leaf of %.2f. Sibling overlap of %.2f %%.",
+		mStats.sahCost, mStats.avgLeafFaces, mStats.overlap * 100.0f
+	);
+	Logger::logInfo( msg );
+
+	if( mStats.epo >= 0.0f ) {
+		snprintf( msg, 512, "[BVH] EPO of %.2f.", mStats.epo );
+		Logger::logInfo( msg );
 	}
 }
 
@@ -604,11 +1604,14 @@ BVHNode* BVH::makeContainerNode( const vector<BVHNode*> subTrees, const bool isR
 		return subTrees[0];
 	}
 
-	BVHNode* node = new BVHNode();
+	BVHNode* node = mNodeArena.allocate();
 
 	node->leftChild = NULL;
 	node->rightChild = NULL;
 	node->parent = NULL;
+	node->faceOffset = 0;
+	node->numFaces = 0;
+	node->instance = -1;
 	node->depth = 0;
 	node->skipNextLeft = false;
 	node->numSkipsToHere = 0;
@@ -628,126 +1631,644 @@ BVHNode* BVH::makeContainerNode( const vector<BVHNode*> subTrees, const bool isR
 }
 
 
+/**
+ * Create a node for an instance. It has neither faces nor children,
+ * its AABB is the one of the transformed tree of the object.
+ * @param  {const cl_uint} instanceIndex Index of the instance in mInstances.
+ * @return {BVHNode*}
+ */
+BVHNode* BVH::makeInstanceNode( const cl_uint instanceIndex ) {
+	BVHNode* node = mNodeArena.allocate();
+	node->leftChild = NULL;
+	node->rightChild = NULL;
+	node->parent = NULL;
+	node->faceOffset = 0;
+	node->numFaces = 0;
+	node->instance = instanceIndex;
+	node->depth = 0;
+	node->skipNextLeft = false;
+	node->numSkipsToHere = 0;
+
+	this->setInstanceAABB( node );
+
+	return node;
+}
+
+
 /**
  * Create a new node.
- * @param  {const std::vector<Tri>} tris
- * @param  {const bool}             ignore
+ * @param  {const cl_uint} faceOffset Index of the first face of the node in mFaceIndices.
+ * @param  {const cl_uint} numFaces   Number of faces in the node.
  * @return {BVHNode*}
  */
-BVHNode* BVH::makeNode( const vector<Tri> tris, const bool ignore ) {
-	BVHNode* node = new BVHNode();
+BVHNode* BVH::makeNode( const cl_uint faceOffset, const cl_uint numFaces ) {
+	BVHNode* node = mNodeArena.allocate();
 	node->leftChild = NULL;
 	node->rightChild = NULL;
 	node->parent = NULL;
+	node->faceOffset = faceOffset;
+	node->numFaces = 0;
+	node->instance = -1;
 	node->depth = 0;
 	node->skipNextLeft = false;
 	node->numSkipsToHere = 0;
 
-	vector<glm::vec3> bbMins, bbMaxs;
+	for( cl_uint i = faceOffset; i < faceOffset + numFaces; i++ ) {
+		const Tri* tri = &mFaces[mFaceIndices[i]];
+
+		if( i == faceOffset ) {
+			node->bbMin = tri->bbMin;
+			node->bbMax = tri->bbMax;
+		}
+		else {
+			node->bbMin = glm::min( node->bbMin, tri->bbMin );
+			node->bbMax = glm::max( node->bbMax, tri->bbMax );
+		}
+	}
+
+	// Not added to mContainerNodes here. The build threads would have to lock
+	// it for every node, and combineNodes() collects the nodes from the tree.
+
+	return node;
+}
+
+
+/**
+ * Calculate the Morton code of a position by interleaving the bits of its coordinates.
+ * @param  {const glm::vec3} pos         Position, each coordinate in [0, 2^bitsPerAxis).
+ * @param  {const cl_uint}   bitsPerAxis Bits to use of each coordinate. At most 21.
+ * @return {cl_ulong}                    The Morton code.
+ */
+cl_ulong BVH::mortonCode( const glm::vec3 pos, const cl_uint bitsPerAxis ) {
+	const cl_ulong mask = ( 1UL << bitsPerAxis ) - 1;
+	cl_ulong code = 0;
+
+	for( cl_uint axis = 0; axis <= 2; axis++ ) {
+		cl_ulong x = (cl_ulong) pos[axis] & mask;
+
+		// Insert two zero bits after each bit.
+		x = ( x | x << 32 ) & 0x001F00000000FFFFUL;
+		x = ( x | x << 16 ) & 0x001F0000FF0000FFUL;
+		x = ( x | x << 8 ) & 0x100F00F00F00F00FUL;
+		x = ( x | x << 4 ) & 0x10C30C30C30C30C3UL;
+		x = ( x | x << 2 ) & 0x1249249249249249UL;
+
+		code |= x << ( 2 - axis );
+	}
+
+	return code;
+}
+
+
+/**
+ * Lower the SAH cost of the finished tree by restructuring small treelets.
+ * Works bottom-up in passes until no treelet improves or the time budget
+ * ("bvh.optimize_time") is used up. The trees of the objects are kept
+ * apart, so their roots stay valid for refitting and instancing.
+ * Ref: Karras and Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies", 2013.
+ */
+void BVH::optimizeTreelets() {
+	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
+
+	vector<BVHNode*> roots( 1, mRoot );
+	roots.insert( roots.end(), mInstancedRoots.begin(), mInstancedRoots.end() );
+
+	// Temporary IDs to store the SAH cost of each subtree.
+	// The final IDs are assigned by orderNodesByTraversal().
+	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+		mNodes[i]->id = i;
+	}
+
+	// Roots of the object trees may only be the leaf of a treelet above them.
+	vector<bool> isFixed( mNodes.size(), false );
+
+	for( cl_uint i = 0; i < mObjectRoots.size(); i++ ) {
+		if( mObjectRoots[i] != NULL ) {
+			isFixed[mObjectRoots[i]->id] = true;
+		}
+	}
+
+	// mNodes is still in pre-order, so in reverse the children come before their parents.
+	vector<cl_float> costs( mNodes.size(), 0.0f );
+
+	for( int i = mNodes.size() - 1; i >= 0; i-- ) {
+		BVHNode* node = mNodes[i];
+		cl_float sa = MathHelp::getSurfaceArea( node->bbMin, node->bbMax );
+
+		if( node->leftChild == NULL ) {
+			costs[i] = ( node->numFaces > 0 ) ? mSAHFaceCost * node->numFaces * sa : BVH_COST_NODE * sa;
+		}
+		else {
+			costs[i] = BVH_COST_NODE * sa + costs[node->leftChild->id] + costs[node->rightChild->id];
+		}
+	}
+
+	const cl_float costBefore = costs[mRoot->id];
+	cl_uint numRestructured = 0;
+	cl_uint numPasses = 0;
+	bool isImproved = true;
+	bool isTimeLeft = true;
+
+	while( isImproved && isTimeLeft ) {
+		isImproved = false;
+
+		// Restructuring changes the order, so collect the nodes again.
+		vector<BVHNode*> nodes;
+		vector<BVHNode*> stack( roots );
+
+		while( stack.size() > 0 ) {
+			BVHNode* node = stack.back();
+			stack.pop_back();
+			nodes.push_back( node );
+
+			if( node->leftChild != NULL ) {
+				stack.push_back( node->rightChild );
+				stack.push_back( node->leftChild );
+			}
+		}
+
+		for( int i = nodes.size() - 1; i >= 0; i-- ) {
+			BVHNode* node = nodes[i];
+
+			if( node->leftChild == NULL ) {
+				continue;
+			}
+
+			if( this->restructureTreelet( node, &isFixed, &costs ) ) {
+				isImproved = true;
+				numRestructured++;
+			}
+
+			cl_float sa = MathHelp::getSurfaceArea( node->bbMin, node->bbMax );
+			costs[node->id] = BVH_COST_NODE * sa + costs[node->leftChild->id] + costs[node->rightChild->id];
+
+			// Checking the time for each node would be too expensive.
+			if( i % 256 == 0 ) {
+				boost::posix_time::ptime timerNow = boost::posix_time::microsec_clock::local_time();
+
+				if( ( timerNow - timerStart ).total_milliseconds() >= mOptimizeTime ) {
+					isTimeLeft = false;
+					break;
+				}
+			}
+		}
+
+		numPasses++;
+	}
+
+	// The depth of the nodes has changed.
+	mDepthReached = 0;
+
+	for( cl_uint i = 0; i < roots.size(); i++ ) {
+		vector<BVHNode*> stack( 1, roots[i] );
+		roots[i]->depth = 1;
+
+		while( stack.size() > 0 ) {
+			BVHNode* node = stack.back();
+			stack.pop_back();
+			this->updateDepthReached( node->depth );
+
+			if( node->leftChild != NULL ) {
+				node->leftChild->depth = node->depth + 1;
+				node->rightChild->depth = node->depth + 1;
+				stack.push_back( node->leftChild );
+				stack.push_back( node->rightChild );
+			}
+		}
+	}
+
+	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
+	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+	cl_float rootSA = MathHelp::getSurfaceArea( mRoot->bbMin, mRoot->bbMax );
+
+	char msg[256];
+	snprintf(
+		msg, 256, "[BVH] Restructured %u treelets in %u pass(es) and %g ms. SAH cost of the main tree %.2f -> %.2f.",
+		numRestructured, numPasses, timeDiff, costBefore / rootSA, costs[mRoot->id] / rootSA
+	);
+	Logger::logInfo( msg );
+}
+
+
+/**
+ * Order all BVH nodes for worst-case, left-first, stackless BVH
+ * traversal as done in the OpenCL kernel. The trees of instanced
+ * objects are ordered separately and follow the main tree.
+ */
+void BVH::orderNodesByTraversal() {
+	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
+
+	vector<BVHNode*> nodesOrdered;
+	vector<BVHNode*> roots( 1, mRoot );
+	roots.insert( roots.end(), mInstancedRoots.begin(), mInstancedRoots.end() );
+
+	for( cl_uint i = 0; i < roots.size(); i++ ) {
+		BVHNode* node = roots[i];
+		const cl_uint numNodesBefore = nodesOrdered.size();
+		bool isTreeDone = false;
+
+		// Order the nodes.
+		while( !isTreeDone ) {
+			nodesOrdered.push_back( node );
+
+			if( node->leftChild != NULL ) {
+				node = node->leftChild;
+			}
+			// Visit the right sibling of the node or of the closest
+			// parent that is a left node. None left at the end of the tree.
+			else {
+				node = this->getSkipNode( node );
+				isTreeDone = ( node == NULL );
+			}
+		}
+
+		// Remember the size of the shared trees for their instances.
+		for( cl_uint j = 0; j < mInstances.size(); j++ ) {
+			if( mInstances[j].root == roots[i] ) {
+				mInstances[j].numNodes = nodesOrdered.size() - numNodesBefore;
+			}
+		}
+	}
+
+	// Assign IDs.
+	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
+		BVHNode* node = nodesOrdered[i];
+		node->id = i;
+		mNodes[i] = node;
+	}
+
+	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
+	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
+	char msg[128];
+	snprintf( msg, 128, "[BVH] Ordered nodes for traversal in %g ms.", timeDiff );
+	Logger::logInfo( msg );
+}
+
+
+/**
+ * Convert an array of floats to an array of float4s.
+ * @param  {const std::vector<cl_float>*} vertices Input array of floats.
+ * @return {std::vector<cl_float4>}                Array of float4s.
+ */
+vector<cl_float4> BVH::packFloatAsFloat4( const vector<cl_float>* vertices ) {
+	vector<cl_float4> vertices4;
+
+	for( cl_uint i = 0; i < vertices->size(); i += 3 ) {
+		cl_float4 v = {
+			(*vertices)[i + 0],
+			(*vertices)[i + 1],
+			(*vertices)[i + 2],
+			0.0f
+		};
+		vertices4.push_back( v );
+	}
+
+	return vertices4;
+}
+
+
+/**
+ * Partition the face indices in place using the given pos and axis as criterium.
+ * @param  {const cl_uint}  faceOffset Index of the first face in mFaceIndices.
+ * @param  {const cl_uint}  numFaces   Number of faces.
+ * @param  {const cl_float} pos
+ * @param  {const cl_uint}  axis
+ * @return {cl_uint}                   Number of faces left of the split.
+ */
+cl_uint BVH::partitionFaces(
+	const cl_uint faceOffset, const cl_uint numFaces, const cl_float pos, const cl_uint axis
+) {
+	vector<cl_uint>::iterator begin = mFaceIndices.begin() + faceOffset;
+	vector<cl_uint>::iterator mid = std::partition(
+		begin, begin + numFaces, splitFacesPred( axis, pos, &mFaces )
+	);
+	cl_uint numFacesLeft = mid - begin;
+
+	// Same as in splitFaces(): One side is empty, so just do it 50:50.
+	// std::partition() did not move anything in that case.
+	if( numFacesLeft == 0 || numFacesLeft == numFaces ) {
+		numFacesLeft = numFaces / 2;
+	}
+
+	return numFacesLeft;
+}
+
+
+/**
+ * Refit the AABBs of an object after its vertices have been moved.
+ * The tree structure stays the same. Only the subtree of the object
+ * and the ancestors of it are updated, bottom-up.
+ * @param  {const cl_uint}                 objectIndex Index of the object.
+ * @param  {const std::vector<cl_float4>*} vertices4   All vertices, including the moved ones.
+ * @param  {const std::vector<cl_float4>*} normals4    All normals, including the moved ones.
+ * @return {std::vector<BVHNode*>}                     The changed nodes, ordered by ID.
+ */
+vector<BVHNode*> BVH::refitObject(
+	const cl_uint objectIndex,
+	const vector<cl_float4>* vertices4, const vector<cl_float4>* normals4
+) {
+	vector<BVHNode*> changed;
+
+	if( objectIndex >= mObjectRoots.size() ) {
+		char msg[128];
+		snprintf( msg, 128, "[BVH] Cannot refit object %u, there are only %lu.", objectIndex, mObjectRoots.size() );
+		Logger::logWarning( msg );
+
+		return changed;
+	}
+
+	BVHNode* objectRoot = mObjectRoots[objectIndex];
+
+	// The nodes are ordered by traversal, so the subtree
+	// of the object is a continuous range of the IDs.
+	cl_uint numSubTreeNodes = 0;
+	vector<BVHNode*> stack;
+	stack.push_back( objectRoot );
+
+	while( stack.size() > 0 ) {
+		BVHNode* node = stack.back();
+		stack.pop_back();
+		numSubTreeNodes++;
+
+		if( node->leftChild != NULL ) {
+			stack.push_back( node->leftChild );
+		}
+		if( node->rightChild != NULL ) {
+			stack.push_back( node->rightChild );
+		}
+	}
+
+	// Ancestors first. They have smaller IDs than the subtree.
+	// An instanced object has no ancestors, but its instances do.
+	std::set<cl_uint> ancestorIDs;
+	vector<BVHNode*> bases( 1, objectRoot );
+
+	for( cl_uint i = 0; i < mInstances.size(); i++ ) {
+		if( mInstances[i].objectIndex == objectIndex ) {
+			bases.push_back( mInstances[i].node );
+			ancestorIDs.insert( mInstances[i].node->id );
+		}
+	}
+
+	for( cl_uint i = 0; i < bases.size(); i++ ) {
+		BVHNode* ancestor = bases[i]->parent;
+
+		while( ancestor != NULL ) {
+			ancestorIDs.insert( ancestor->id );
+			ancestor = ancestor->parent;
+		}
+	}
+
+	std::set<cl_uint>::iterator it;
+
+	for( it = ancestorIDs.begin(); it != ancestorIDs.end(); it++ ) {
+		changed.push_back( mNodes[*it] );
+	}
+
+	const cl_uint numAncestors = changed.size();
+
+	for( cl_uint i = objectRoot->id; i < objectRoot->id + numSubTreeNodes; i++ ) {
+		changed.push_back( mNodes[i] );
+	}
+
+	// Children have greater IDs than their parent, so going
+	// backwards visits the children first. The tree of an
+	// instanced object comes after its instance nodes.
+	for( cl_uint i = changed.size(); i > 0; i-- ) {
+		BVHNode* node = changed[i - 1];
+
+		if( node->instance >= 0 ) {
+			this->setInstanceAABB( node );
+		}
+		else if( node->numFaces > 0 ) {
+			for( cl_uint j = node->faceOffset; j < node->faceOffset + node->numFaces; j++ ) {
+				Tri* tri = &mFaces[mFaceIndices[j]];
+				MathHelp::triCalcAABB( tri, vertices4, normals4 );
+
+				if( j == node->faceOffset ) {
+					node->bbMin = tri->bbMin;
+					node->bbMax = tri->bbMax;
+				}
+				else {
+					node->bbMin = glm::min( node->bbMin, tri->bbMin );
+					node->bbMax = glm::max( node->bbMax, tri->bbMax );
+				}
+			}
+		}
+		else {
+			node->bbMin = glm::min( node->leftChild->bbMin, node->rightChild->bbMin );
+			node->bbMax = glm::max( node->leftChild->bbMax, node->rightChild->bbMax );
+		}
+	}
+
+	char msg[128];
+	snprintf(
+		msg, 128, "[BVH] Refitted %u nodes of object %u and %u ancestors.",
+		numSubTreeNodes, objectIndex, numAncestors
+	);
+	Logger::logDebug( msg );
+
+	return changed;
+}
+
+
+/**
+ * Give back a thread reserved with reserveThread().
+ */
+void BVH::releaseThread() {
+	mThreadsActive--;
+}
+
+
+/**
+ * Reserve one of the threads for the build, if one is still available.
+ * @return {bool} True, if a thread has been reserved, false otherwise.
+ */
+bool BVH::reserveThread() {
+	cl_uint active = mThreadsActive.load();
+
+	while( active < mBuildThreads ) {
+		if( mThreadsActive.compare_exchange_weak( active, active + 1 ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Find the optimal structure of the treelet below a node and apply it, if it lowers the SAH cost.
+ * The treelet is grown by turning its leaf with the largest surface area into two leaves.
+ * The optimum over all possible binary trees of these leaves is found by dynamic
+ * programming over the subsets of the leaves. The inner nodes of the treelet are reused.
+ * @param  {BVHNode*}                     root    Root of the treelet. Its children are up to date.
+ * @param  {const std::vector<bool>*}     isFixed Nodes by ID, that may not be split up.
+ * @param  {std::vector<cl_float>*}       costs   SAH costs of the subtrees by ID.
+ * @return {bool}                                 True, if the treelet has been changed.
+ */
+bool BVH::restructureTreelet(
+	BVHNode* root, const vector<bool>* isFixed, vector<cl_float>* costs
+) {
+	vector<BVHNode*> inner( 1, root );
+	vector<BVHNode*> leaves;
+	leaves.push_back( root->leftChild );
+	leaves.push_back( root->rightChild );
+
+	while( leaves.size() < BVH_TREELET_LEAVES ) {
+		int largest = -1;
+		cl_float largestSA = -1.0f;
+
+		for( cl_uint i = 0; i < leaves.size(); i++ ) {
+			if( leaves[i]->leftChild == NULL || (*isFixed)[leaves[i]->id] ) {
+				continue;
+			}
+
+			cl_float sa = MathHelp::getSurfaceArea( leaves[i]->bbMin, leaves[i]->bbMax );
+
+			if( sa > largestSA ) {
+				largestSA = sa;
+				largest = i;
+			}
+		}
+
+		if( largest < 0 ) {
+			break;
+		}
+
+		BVHNode* node = leaves[largest];
+		inner.push_back( node );
+		leaves[largest] = node->leftChild;
+		leaves.push_back( node->rightChild );
+	}
+
+	// With two leaves there is only one possible tree.
+	if( leaves.size() < 3 ) {
+		return false;
+	}
+
+	const cl_uint numSubsets = 1 << leaves.size();
+	const cl_uint all = numSubsets - 1;
+	vector<glm::vec3> bbMins( numSubsets ), bbMaxs( numSubsets );
+	vector<cl_float> bestCosts( numSubsets, FLT_MAX );
+	vector<cl_uint> bestSplits( numSubsets, 0 );
+
+	// A proper subset always has a lower value than its superset,
+	// so the subsets can be handled in ascending order.
+	for( cl_uint s = 1; s < numSubsets; s++ ) {
+		cl_uint lowest = 0;
+
+		while( ( s & ( 1 << lowest ) ) == 0 ) {
+			lowest++;
+		}
+
+		const cl_uint rest = s & ( s - 1 );
+		const BVHNode* leaf = leaves[lowest];
+
+		if( rest == 0 ) {
+			bbMins[s] = leaf->bbMin;
+			bbMaxs[s] = leaf->bbMax;
+			bestCosts[s] = (*costs)[leaf->id];
+			continue;
+		}
+
+		bbMins[s] = glm::min( bbMins[rest], leaf->bbMin );
+		bbMaxs[s] = glm::max( bbMaxs[rest], leaf->bbMax );
+
+		// Each split once: The left part always holds the lowest leaf.
+		for( cl_uint p = ( s - 1 ) & s; p > 0; p = ( p - 1 ) & s ) {
+			if( ( p & ( 1 << lowest ) ) == 0 ) {
+				continue;
+			}
+
+			cl_float cost = bestCosts[p] + bestCosts[s ^ p];
+
+			if( cost < bestCosts[s] ) {
+				bestCosts[s] = cost;
+				bestSplits[s] = p;
+			}
+		}
 
-	for( cl_uint i = 0; i < tris.size(); i++ ) {
-		bbMins.push_back( tris[i].bbMin );
-		bbMaxs.push_back( tris[i].bbMax );
+		bestCosts[s] += BVH_COST_NODE * MathHelp::getSurfaceArea( bbMins[s], bbMaxs[s] );
 	}
 
-	glm::vec3 bbMin;
-	glm::vec3 bbMax;
-	MathHelp::getAABB( bbMins, bbMaxs, &bbMin, &bbMax );
-	node->bbMin = bbMin;
-	node->bbMax = bbMax;
+	cl_float rootSA = MathHelp::getSurfaceArea( root->bbMin, root->bbMax );
+	cl_float costNow = BVH_COST_NODE * rootSA + (*costs)[root->leftChild->id] + (*costs)[root->rightChild->id];
 
-	if( !ignore ) {
-		mContainerNodes.push_back( node );
+	// Ignore improvements within the precision of floats.
+	if( bestCosts[all] >= costNow * 0.9999f ) {
+		return false;
 	}
 
-	return node;
-}
+	// Rebuild the treelet from the subsets, top-down.
+	vector< std::pair<BVHNode*, cl_uint> > stack( 1, std::make_pair( root, all ) );
+	cl_uint nextInner = 1;
 
+	while( stack.size() > 0 ) {
+		BVHNode* node = stack.back().first;
+		cl_uint s = stack.back().second;
+		stack.pop_back();
 
-/**
- * Order all BVH nodes for worst-case, left-first, stackless BVH
- * traversal as done in the OpenCL kernel.
- */
-void BVH::orderNodesByTraversal() {
-	boost::posix_time::ptime timerStart = boost::posix_time::microsec_clock::local_time();
+		node->bbMin = bbMins[s];
+		node->bbMax = bbMaxs[s];
+		(*costs)[node->id] = bestCosts[s];
 
-	vector<BVHNode*> nodesOrdered;
-	BVHNode* node = mNodes[0];
+		cl_uint parts[2] = { bestSplits[s], s ^ bestSplits[s] };
+		BVHNode* children[2];
 
-	// Order the nodes.
-	while( true ) {
-		nodesOrdered.push_back( node );
+		for( cl_uint i = 0; i < 2; i++ ) {
+			// Single leaf
+			if( ( parts[i] & ( parts[i] - 1 ) ) == 0 ) {
+				cl_uint index = 0;
 
-		if( node->leftChild != NULL ) {
-			node = node->leftChild;
-		}
-		else {
-			// is left node, visit right sibling next
-			if( node->parent->leftChild == node ) {
-				node = node->parent->rightChild;
-			}
-			// is right node, go up tree
-			else if( node->parent->parent != NULL ) {
-				BVHNode* dummy = new BVHNode();
-				dummy->parent = node->parent;
-
-				// As long as we are on the right side of a (sub)tree,
-				// skip parents until we either are at the root or
-				// our parent has a true sibling again.
-				while( dummy->parent->parent->rightChild == dummy->parent ) {
-					dummy->parent = dummy->parent->parent;
-
-					if( dummy->parent->parent == NULL ) {
-						break;
-					}
+				while( parts[i] != (cl_uint) ( 1 << index ) ) {
+					index++;
 				}
 
-				// Reached a parent with a true sibling.
-				if( dummy->parent->parent != NULL ) {
-					node = dummy->parent->parent->rightChild;
-				}
+				children[i] = leaves[index];
+			}
+			else {
+				children[i] = inner[nextInner++];
+				stack.push_back( std::make_pair( children[i], parts[i] ) );
 			}
-		}
 
-		if( nodesOrdered.size() >= mNodes.size() ) {
-			break;
+			children[i]->parent = node;
 		}
-	}
 
-	// Assign IDs.
-	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
-		BVHNode* node = nodesOrdered[i];
-		node->id = i;
-		mNodes[i] = node;
+		// Set the node with the bigger surface area as the left one
+		cl_float leftSA = MathHelp::getSurfaceArea( bbMins[parts[0]], bbMaxs[parts[0]] );
+		cl_float rightSA = MathHelp::getSurfaceArea( bbMins[parts[1]], bbMaxs[parts[1]] );
+		bool isSwapped = ( rightSA > leftSA );
+
+		node->leftChild = children[isSwapped ? 1 : 0];
+		node->rightChild = children[isSwapped ? 0 : 1];
 	}
 
-	boost::posix_time::ptime timerEnd = boost::posix_time::microsec_clock::local_time();
-	cl_float timeDiff = ( timerEnd - timerStart ).total_milliseconds();
-	char msg[128];
-	snprintf( msg, 128, "[BVH] Ordered nodes for traversal in %g ms.", timeDiff );
-	Logger::logInfo( msg );
+	return true;
 }
 
 
 /**
- * Convert an array of floats to an array of float4s.
- * @param  {const std::vector<cl_float>*} vertices Input array of floats.
- * @return {std::vector<cl_float4>}                Array of float4s.
+ * Set the AABB of an instance node to the one of the transformed tree of its object.
+ * @param {BVHNode*} node The instance node.
  */
-vector<cl_float4> BVH::packFloatAsFloat4( const vector<cl_float>* vertices ) {
-	vector<cl_float4> vertices4;
+void BVH::setInstanceAABB( BVHNode* node ) {
+	const BVHInstance* instance = &mInstances[node->instance];
+	const BVHNode* root = instance->root;
+
+	for( cl_uint i = 0; i < 8; i++ ) {
+		glm::vec4 corner(
+			( i & 1 ) ? root->bbMax[0] : root->bbMin[0],
+			( i & 2 ) ? root->bbMax[1] : root->bbMin[1],
+			( i & 4 ) ? root->bbMax[2] : root->bbMin[2],
+			1.0f
+		);
+		corner = instance->transform * corner;
+		glm::vec3 p( corner[0], corner[1], corner[2] );
 
-	for( cl_uint i = 0; i < vertices->size(); i += 3 ) {
-		cl_float4 v = {
-			(*vertices)[i + 0],
-			(*vertices)[i + 1],
-			(*vertices)[i + 2],
-			0.0f
-		};
-		vertices4.push_back( v );
+		node->bbMin = ( i == 0 ) ? p : glm::min( node->bbMin, p );
+		node->bbMax = ( i == 0 ) ? p : glm::max( node->bbMax, p );
 	}
-
-	return vertices4;
 }
 
 
@@ -757,7 +2278,7 @@ vector<cl_float4> BVH::packFloatAsFloat4( const vector<cl_float>* vertices ) {
  * @return {cl_uint}             The now set number of max faces per (leaf) node.
  */
 cl_uint BVH::setMaxFaces( const int value ) {
-	mMaxFaces = fmax( value, 1 );
+	mMaxFaces = fmin( fmax( value, 1 ), BVH_MAX_LEAF_FACES );
 
 	return mMaxFaces;
 }
@@ -766,14 +2287,17 @@ cl_uint BVH::setMaxFaces( const int value ) {
 /**
  * Set flags for nodes that can be skipped because they
  * have more or less the same surface area.
+ * @param {const std::map<const BVHNode*, cl_float>*} hitRates Measured hit rates of nodes, used instead
+ *                                                             of the surface area ratio. Can be NULL.
  */
-void BVH::skipAheadOfNodes() {
+void BVH::skipAheadOfNodes( const std::map<const BVHNode*, cl_float>* hitRates ) {
 	cl_float cmp = Cfg::get().value<cl_float>( Cfg::BVH_SKIPAHEAD_CMP );
 	cl_uint skippedLeft = 0;
 
 	for( cl_uint i = 0; i < mNodes.size(); i++ ) {
 		BVHNode* node = mNodes[i];
 		node->numSkipsToHere = skippedLeft;
+		node->skipNextLeft = false;
 
 		// Left child exists and is not a leaf node.
 		if( node->leftChild != NULL && node->leftChild->leftChild != NULL ) {
@@ -782,7 +2306,15 @@ void BVH::skipAheadOfNodes() {
 			cl_float saNode = MathHelp::getSurfaceArea( node->bbMin, node->bbMax );
 			cl_float saLeft = MathHelp::getSurfaceArea( left->bbMin, left->bbMax );
 
-			if( saLeft / saNode >= cmp ) {
+			// The surface area ratio estimates how often the left child
+			// is hit if its parent is. Use the real rate if it is known.
+			cl_float ratio = saLeft / saNode;
+
+			if( hitRates != NULL && hitRates->count( left ) > 0 ) {
+				ratio = hitRates->at( left );
+			}
+
+			if( ratio >= cmp ) {
 				node->skipNextLeft = true;
 				skippedLeft++;
 			}
@@ -796,194 +2328,680 @@ void BVH::skipAheadOfNodes() {
 
 
 /**
- * Split the faces into two groups.
+ * Compute the Morton codes of the face centroids and sort the
+ * face indices by them. Uses a LSD radix sort with 8 bit digits.
+ * @param {const cl_uint} faceOffset Index of the first face in mFaceIndices.
+ * @param {const cl_uint} numFaces   Number of faces.
+ */
+void BVH::sortByMortonCodes( const cl_uint faceOffset, const cl_uint numFaces ) {
+	if( numFaces == 0 ) {
+		return;
+	}
+
+	const cl_uint bitsPerAxis = mMortonBits / 3;
+	const cl_float gridSize = ( 1 << bitsPerAxis ) - 1;
+	glm::vec3 cenMin, cenMax;
+
+	for( cl_uint i = faceOffset; i < faceOffset + numFaces; i++ ) {
+		const Tri* tri = &mFaces[mFaceIndices[i]];
+		glm::vec3 cen = ( tri->bbMin + tri->bbMax ) * 0.5f;
+		cenMin = ( i == faceOffset ) ? cen : glm::min( cenMin, cen );
+		cenMax = ( i == faceOffset ) ? cen : glm::max( cenMax, cen );
+	}
+
+	glm::vec3 scale;
+
+	for( cl_uint axis = 0; axis <= 2; axis++ ) {
+		cl_float extent = cenMax[axis] - cenMin[axis];
+		scale[axis] = ( extent > 0.0f ) ? gridSize / extent : 0.0f;
+	}
+
+	cl_ulong* codes = &mMortonCodes[faceOffset];
+	cl_uint* indices = &mFaceIndices[faceOffset];
+
+	for( cl_uint i = 0; i < numFaces; i++ ) {
+		const Tri* tri = &mFaces[indices[i]];
+		glm::vec3 cen = ( tri->bbMin + tri->bbMax ) * 0.5f;
+		codes[i] = this->mortonCode( ( cen - cenMin ) * scale, bitsPerAxis );
+	}
+
+
+	// Radix sort
+
+	vector<cl_ulong> codesTmp( numFaces );
+	vector<cl_uint> indicesTmp( numFaces );
+	cl_ulong* codesSrc = codes;
+	cl_ulong* codesDst = &codesTmp[0];
+	cl_uint* indicesSrc = indices;
+	cl_uint* indicesDst = &indicesTmp[0];
+
+	for( cl_uint shift = 0; shift < bitsPerAxis * 3; shift += 8 ) {
+		cl_uint digitOffsets[256] = { 0 };
+
+		for( cl_uint i = 0; i < numFaces; i++ ) {
+			digitOffsets[( codesSrc[i] >> shift ) & 0xFF]++;
+		}
+
+		cl_uint sum = 0;
+
+		for( cl_uint d = 0; d < 256; d++ ) {
+			cl_uint count = digitOffsets[d];
+			digitOffsets[d] = sum;
+			sum += count;
+		}
+
+		for( cl_uint i = 0; i < numFaces; i++ ) {
+			cl_uint pos = digitOffsets[( codesSrc[i] >> shift ) & 0xFF]++;
+			codesDst[pos] = codesSrc[i];
+			indicesDst[pos] = indicesSrc[i];
+		}
+
+		std::swap( codesSrc, codesDst );
+		std::swap( indicesSrc, indicesDst );
+	}
+
+	// Odd number of passes: The result is in the temporary arrays.
+	if( codesSrc != codes ) {
+		std::copy( codesSrc, codesSrc + numFaces, codes );
+		std::copy( indicesSrc, indicesSrc + numFaces, indices );
+	}
+}
+
+
+/**
+ * Find the best split of the faces using a binned SAH and partition the
+ * face indices in place accordingly. The centroids of the faces are
+ * sorted into equally sized bins along each axis and only the
+ * borders between those bins are considered as split positions.
+ * @param  {const std::vector<Tri>*} faces        The faces the indices refer to.
+ * @param  {cl_uint*}                indices      Indices of the faces in the node.
+ * @param  {const cl_uint}           numFaces     Number of faces in the node.
+ * @param  {const cl_uint}           numBins      Number of bins per axis.
+ * @param  {cl_uint*}                numFacesLeft Output. Number of faces left of the split.
+ * @return {cl_float}                             Best found SAH value. FLT_MAX if no split has been found.
+ */
+cl_float BVH::splitByBinnedSAH(
+	const vector<Tri>* faces, cl_uint* indices, const cl_uint numFaces,
+	const cl_uint numBins, cl_uint* numFacesLeft
+) {
+	glm::vec3 cenMin, cenMax;
+
+	for( cl_uint i = 0; i < numFaces; i++ ) {
+		const Tri* tri = &(*faces)[indices[i]];
+		glm::vec3 cen = ( tri->bbMin + tri->bbMax ) * 0.5f;
+		cenMin = ( i == 0 ) ? cen : glm::min( cenMin, cen );
+		cenMax = ( i == 0 ) ? cen : glm::max( cenMax, cen );
+	}
+
+	vector<BVHBin> bins( numBins );
+	vector<cl_float> leftSA( numBins - 1 );
+	vector<cl_uint> leftNumFaces( numBins - 1 );
+
+	cl_float bestSAH = FLT_MAX;
+	int bestAxis = -1;
+	cl_uint bestSplit = 0;
+
+	for( cl_uint axis = 0; axis <= 2; axis++ ) {
+		const cl_float extent = cenMax[axis] - cenMin[axis];
+
+		// All centroids are in the same place. No use splitting them on this axis.
+		if( extent <= 0.0f ) {
+			continue;
+		}
+
+		const cl_float binFactor = numBins / extent;
+
+		for( cl_uint i = 0; i < numBins; i++ ) {
+			bins[i].numFaces = 0;
+		}
+
+		for( cl_uint i = 0; i < numFaces; i++ ) {
+			const Tri* tri = &(*faces)[indices[i]];
+			cl_float cen = ( tri->bbMin[axis] + tri->bbMax[axis] ) * 0.5f;
+			cl_uint b = fmin( ( cen - cenMin[axis] ) * binFactor, numBins - 1 );
+
+			if( bins[b].numFaces == 0 ) {
+				bins[b].bbMin = tri->bbMin;
+				bins[b].bbMax = tri->bbMax;
+			}
+			else {
+				bins[b].bbMin = glm::min( bins[b].bbMin, tri->bbMin );
+				bins[b].bbMax = glm::max( bins[b].bbMax, tri->bbMax );
+			}
+
+			bins[b].numFaces++;
+		}
+
+
+		// Grow a bounding box bin by bin starting from the left.
+		// Save the surface area and number of faces for each step.
+
+		glm::vec3 bbMin, bbMax;
+		cl_uint count = 0;
+
+		for( cl_uint i = 0; i < numBins - 1; i++ ) {
+			if( bins[i].numFaces > 0 ) {
+				bbMin = ( count == 0 ) ? bins[i].bbMin : glm::min( bbMin, bins[i].bbMin );
+				bbMax = ( count == 0 ) ? bins[i].bbMax : glm::max( bbMax, bins[i].bbMax );
+				count += bins[i].numFaces;
+			}
+
+			leftNumFaces[i] = count;
+			leftSA[i] = ( count > 0 ) ? MathHelp::getSurfaceArea( bbMin, bbMax ) : 0.0f;
+		}
+
+
+		// Grow a bounding box bin by bin starting from the right
+		// and compute the SAH for the split left of the bin.
+
+		count = 0;
+
+		for( cl_uint i = numBins - 1; i > 0; i-- ) {
+			if( bins[i].numFaces > 0 ) {
+				bbMin = ( count == 0 ) ? bins[i].bbMin : glm::min( bbMin, bins[i].bbMin );
+				bbMax = ( count == 0 ) ? bins[i].bbMax : glm::max( bbMax, bins[i].bbMax );
+				count += bins[i].numFaces;
+			}
+
+			if( count == 0 || leftNumFaces[i - 1] == 0 ) {
+				continue;
+			}
+
+			cl_float rightSA = MathHelp::getSurfaceArea( bbMin, bbMax );
+			cl_float sah = this->calcSAH( leftSA[i - 1], leftNumFaces[i - 1], rightSA, count );
+
+			if( sah < bestSAH ) {
+				bestSAH = sah;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	// No split position found, e.g. because all centroids are in the same place.
+	if( bestAxis < 0 ) {
+		return FLT_MAX;
+	}
+
+	const cl_float binFactor = numBins / ( cenMax[bestAxis] - cenMin[bestAxis] );
+
+	cl_uint* mid = std::partition(
+		indices, indices + numFaces,
+		binFacesPred( bestAxis, cenMin[bestAxis], binFactor, numBins, bestSplit, faces )
+	);
+	*numFacesLeft = mid - indices;
+
+	return bestSAH;
+}
+
+
+/**
+ * Find the best split of the faces on the given axis.
  * Determine this splitting point by using a Surface Area Heuristic (SAH).
- * @param {cl_float*}         bestSAH    Best SAH value that has been found so far (for the faces in this node).
- * @param {const cl_uint}     axis       The axis to sort the faces by.
- * @param {std::vector<Tri>}  faces      Faces in this node.
- * @param {std::vector<Tri>*} leftFaces  Output. Group for the faces left of the split.
- * @param {std::vector<Tri>*} rightFaces Output. Group for the faces right of the split.
+ * The face indices will be left sorted by the given axis.
+ * @param {cl_float*}     bestSAH      Best SAH value that has been found so far (for the faces in this node).
+ * @param {const cl_uint} axis         The axis to sort the faces by.
+ * @param {const cl_uint} faceOffset   Index of the first face of the node in mFaceIndices.
+ * @param {const cl_uint} numFaces     Number of faces in the node.
+ * @param {int*}          bestAxis     Output. Axis of the best split found so far.
+ * @param {cl_uint*}      numFacesLeft Output. Number of faces left of the best split found so far.
  */
 void BVH::splitBySAH(
-	cl_float* bestSAH, const cl_uint axis, vector<Tri> faces,
-	vector<Tri>* leftFaces, vector<Tri>* rightFaces
+	cl_float* bestSAH, const cl_uint axis, const cl_uint faceOffset, const cl_uint numFaces,
+	int* bestAxis, cl_uint* numFacesLeft
 ) {
-	std::sort( faces.begin(), faces.end(), sortFacesCmp( axis ) );
-	const cl_uint numFaces = faces.size();
+	vector<cl_uint>::iterator begin = mFaceIndices.begin() + faceOffset;
+	std::sort( begin, begin + numFaces, sortFacesCmp( axis, &mFaces ) );
 
 	vector<cl_float> leftSA( numFaces - 1 );
 	vector<cl_float> rightSA( numFaces - 1 );
-	vector< vector<glm::vec3> > leftBB( numFaces - 1 ), rightBB( numFaces - 1 );
 
-	this->growAABBsForSAH( &faces, &leftBB, &rightBB, &leftSA, &rightSA );
+	this->growAABBsForSAH( faceOffset, numFaces, &leftSA, &rightSA );
 
 
 	// Compute the SAH for each split position and choose the one with the lowest cost.
 	// SAH = SA of node * ( SA left of split * faces left of split + SA right of split * faces right of split )
 
-	int splitAfter = -1;
 	cl_float newSAH;
 
 	for( cl_uint i = 0; i < numFaces - 1; i++ ) {
-		cl_float numFacesLeft = i + 1;
-		cl_float numFacesRight = numFaces - i - 1;
+		cl_float numFacesLeftTmp = i + 1;
+		cl_float numFacesRightTmp = numFaces - i - 1;
 
-		newSAH = leftSA[i] * numFacesLeft + rightSA[i] * numFacesRight;
+		newSAH = leftSA[i] * numFacesLeftTmp + rightSA[i] * numFacesRightTmp;
 
 		// Better split position found
 		if( newSAH < *bestSAH ) {
 			*bestSAH = newSAH;
+			*bestAxis = axis;
 			// Up to (including) this face it is preferable to split.
-			splitAfter = i + 1;
+			*numFacesLeft = i + 1;
 		}
 	}
-
-
-	// If a splitting index has been found, split the faces into two groups.
-
-	if( splitAfter >= 0 ) {
-		leftFaces->clear();
-		rightFaces->clear();
-
-		leftFaces->insert( leftFaces->begin(), faces.begin(), faces.begin() + splitAfter );
-		rightFaces->insert( rightFaces->begin(), faces.begin() + splitAfter, faces.end() );
-	}
 }
 
 
 /**
- * Split the faces into two groups using the given pos and axis as criterium.
- * @param {const std::vector<Tri>} faces
- * @param {const cl_float}         pos
- * @param {const cl_uint}          axis
- * @param {std::vector<Tri>*}      leftFaces
- * @param {std::vector<Tri>*}      rightFaces
+ * Evaluate the split of the faces into two groups using the given pos and axis as criterium.
+ * The faces are not moved, use partitionFaces() for that.
+ * @param  {const cl_uint}  faceOffset Index of the first face in mFaceIndices.
+ * @param  {const cl_uint}  numFaces   Number of faces.
+ * @param  {const cl_float} pos
+ * @param  {const cl_uint}  axis
+ * @return {cl_float}                  SAH value of the split.
  */
 cl_float BVH::splitFaces(
-	const vector<Tri> faces, const cl_float pos, const cl_uint axis,
-	vector<Tri>* leftFaces, vector<Tri>* rightFaces
+	const cl_uint faceOffset, const cl_uint numFaces, const cl_float pos, const cl_uint axis
 ) {
-	cl_float sah = FLT_MAX;
-	vector<glm::vec3> bbMinsL, bbMinsR, bbMaxsL, bbMaxsR;
-
-	leftFaces->clear();
-	rightFaces->clear();
+	glm::vec3 bbMinL, bbMinR, bbMaxL, bbMaxR;
+	cl_uint numFacesLeft = 0;
+	cl_uint numFacesRight = 0;
 
-	for( cl_uint i = 0; i < faces.size(); i++ ) {
-		Tri tri = faces[i];
-		glm::vec3 cen = ( tri.bbMin + tri.bbMax ) * 0.5f;
+	for( cl_uint i = faceOffset; i < faceOffset + numFaces; i++ ) {
+		const Tri* tri = &mFaces[mFaceIndices[i]];
+		cl_float cen = ( tri->bbMin[axis] + tri->bbMax[axis] ) * 0.5f;
 
-		if( cen[axis] <= pos ) {
-			leftFaces->push_back( tri );
-			bbMinsL.push_back( tri.bbMin );
-			bbMaxsL.push_back( tri.bbMax );
+		if( cen <= pos ) {
+			bbMinL = ( numFacesLeft == 0 ) ? tri->bbMin : glm::min( bbMinL, tri->bbMin );
+			bbMaxL = ( numFacesLeft == 0 ) ? tri->bbMax : glm::max( bbMaxL, tri->bbMax );
+			numFacesLeft++;
 		}
 		else {
-			rightFaces->push_back( tri );
-			bbMinsR.push_back( tri.bbMin );
-			bbMaxsR.push_back( tri.bbMax );
+			bbMinR = ( numFacesRight == 0 ) ? tri->bbMin : glm::min( bbMinR, tri->bbMin );
+			bbMaxR = ( numFacesRight == 0 ) ? tri->bbMax : glm::max( bbMaxR, tri->bbMax );
+			numFacesRight++;
 		}
 	}
 
 	// Just do it 50:50.
-	if( leftFaces->size() == 0 || rightFaces->size() == 0 ) {
+	if( numFacesLeft == 0 || numFacesRight == 0 ) {
 		Logger::logDebugVerbose( "[BVH] Dividing faces by center left one side empty. Just doing it 50:50 now." );
 
-		bbMinsL.clear();
-		bbMaxsL.clear();
-		bbMinsR.clear();
-		bbMaxsR.clear();
-		leftFaces->clear();
-		rightFaces->clear();
+		numFacesLeft = 0;
+		numFacesRight = 0;
 
-		for( cl_uint i = 0; i < faces.size(); i++ ) {
-			Tri tri = faces[i];
+		for( cl_uint i = 0; i < numFaces; i++ ) {
+			const Tri* tri = &mFaces[mFaceIndices[faceOffset + i]];
 
-			if( i < faces.size() / 2 ) {
-				leftFaces->push_back( tri );
-				bbMinsL.push_back( tri.bbMin );
-				bbMaxsL.push_back( tri.bbMax );
+			if( i < numFaces / 2 ) {
+				bbMinL = ( numFacesLeft == 0 ) ? tri->bbMin : glm::min( bbMinL, tri->bbMin );
+				bbMaxL = ( numFacesLeft == 0 ) ? tri->bbMax : glm::max( bbMaxL, tri->bbMax );
+				numFacesLeft++;
 			}
 			else {
-				rightFaces->push_back( tri );
-				bbMinsR.push_back( tri.bbMin );
-				bbMaxsR.push_back( tri.bbMax );
+				bbMinR = ( numFacesRight == 0 ) ? tri->bbMin : glm::min( bbMinR, tri->bbMin );
+				bbMaxR = ( numFacesRight == 0 ) ? tri->bbMax : glm::max( bbMaxR, tri->bbMax );
+				numFacesRight++;
 			}
 		}
 	}
 
-	glm::vec3 bbMinL, bbMinR, bbMaxL, bbMaxR;
-	MathHelp::getAABB( bbMinsL, bbMaxsL, &bbMinL, &bbMaxL );
-	cl_float leftSA = MathHelp::getSurfaceArea( bbMinL, bbMaxL );
-	cl_float rightSA = MathHelp::getSurfaceArea( bbMinR, bbMaxR );
-
-	sah = leftSA * leftFaces->size() + rightSA * rightFaces->size();
-
 	// There has to be somewhere else something wrong.
-	if( leftFaces->size() == 0 || rightFaces->size() == 0 ) {
+	if( numFacesLeft == 0 || numFacesRight == 0 ) {
 		char msg[256];
 		snprintf(
-			msg, 256, "[BVH] Dividing faces 50:50 left one side empty. Faces: %lu.",
-			faces.size()
+			msg, 256, "[BVH] Dividing faces 50:50 left one side empty. Faces: %u.", numFaces
 		);
 		Logger::logError( msg );
 
-		sah = FLT_MAX;
+		return FLT_MAX;
 	}
 
-	return sah;
+	cl_float leftSA = MathHelp::getSurfaceArea( bbMinL, bbMaxL );
+	cl_float rightSA = MathHelp::getSurfaceArea( bbMinR, bbMaxR );
+
+	return this->calcSAH( leftSA, numFacesLeft, rightSA, numFacesRight );
 }
 
 
 /**
- * Split the nodes into two groups using the given pos and axis as criterium.
- * @param {const std::vector<BVHNode*>}  nodes
- * @param {const cl_float}               pos
- * @param {const cl_uint}                axis
- * @param {std::vector<BVHNode*>*}       leftGroup
- * @param {std::vector<BVHNode*>*}       rightGroup
+ * Split the object trees into two groups by SAH. The nodes are sorted by the
+ * centers of their AABBs on each axis and every position in between is tested.
+ * A node does not weigh by its number of faces, but by the cost of its own tree,
+ * so a big but simple object (e.g. a ground plane) ends up apart from the rest.
+ * @param {const std::vector<BVHNode*>}               nodes        Roots of the object trees and instance nodes.
+ * @param {const std::map<const BVHNode*, cl_float>*} subTreeCosts SAH cost of each node's tree.
+ * @param {std::vector<BVHNode*>*}                    leftGroup
+ * @param {std::vector<BVHNode*>*}                    rightGroup
  */
-void BVH::splitNodes(
-	const vector<BVHNode*> nodes, const cl_float pos, const cl_uint axis,
+void BVH::splitNodesBySAH(
+	const vector<BVHNode*> nodes, const std::map<const BVHNode*, cl_float>* subTreeCosts,
 	vector<BVHNode*>* leftGroup, vector<BVHNode*>* rightGroup
 ) {
-	for( cl_uint i = 0; i < nodes.size(); i++ ) {
-		BVHNode* node = nodes[i];
-		glm::vec3 center = ( node->bbMax - node->bbMin ) / 2.0f;
+	const cl_uint numNodes = nodes.size();
+	vector<BVHNode*> sorted( nodes );
+	vector<cl_float> leftSA( numNodes ), leftCost( numNodes );
+	cl_float bestSAH = FLT_MAX;
+
+	for( cl_uint axis = 0; axis < 3; axis++ ) {
+		std::sort( sorted.begin(), sorted.end(), sortNodesCmp( axis ) );
+
+		glm::vec3 bbMin = sorted[0]->bbMin;
+		glm::vec3 bbMax = sorted[0]->bbMax;
+		cl_float cost = 0.0f;
 
-		if( center[axis] < pos ) {
-			leftGroup->push_back( node );
+		for( cl_uint i = 0; i < numNodes; i++ ) {
+			bbMin = glm::min( bbMin, sorted[i]->bbMin );
+			bbMax = glm::max( bbMax, sorted[i]->bbMax );
+			cost += subTreeCosts->at( sorted[i] );
+			leftSA[i] = MathHelp::getSurfaceArea( bbMin, bbMax );
+			leftCost[i] = cost;
 		}
-		else {
-			rightGroup->push_back( node );
+
+		bbMin = sorted[numNodes - 1]->bbMin;
+		bbMax = sorted[numNodes - 1]->bbMax;
+		cost = 0.0f;
+		cl_int bestIndex = -1;
+
+		// Left side: [0, i], right side: [i + 1, numNodes - 1]
+		for( cl_int i = numNodes - 2; i >= 0; i-- ) {
+			bbMin = glm::min( bbMin, sorted[i + 1]->bbMin );
+			bbMax = glm::max( bbMax, sorted[i + 1]->bbMax );
+			cost += subTreeCosts->at( sorted[i + 1] );
+
+			cl_float sah = this->calcSAH(
+				leftSA[i], leftCost[i], MathHelp::getSurfaceArea( bbMin, bbMax ), cost
+			);
+
+			if( sah < bestSAH ) {
+				bestSAH = sah;
+				bestIndex = i;
+			}
+		}
+
+		if( bestIndex >= 0 ) {
+			leftGroup->assign( sorted.begin(), sorted.begin() + bestIndex + 1 );
+			rightGroup->assign( sorted.begin() + bestIndex + 1, sorted.end() );
 		}
 	}
+}
+
+
+/**
+ * Split a reference in two at the given plane. If Phong Tessellation is
+ * disabled, the face itself is clipped, otherwise (the face is curved
+ * then) the AABB of the reference is clipped.
+ * @param {const Tri*}                    ref       The reference to split.
+ * @param {const cl_uint}                 axis      Axis of the splitting plane.
+ * @param {const cl_float}                pos       Position of the splitting plane on the axis.
+ * @param {const std::vector<cl_float4>*} vertices4
+ * @param {Tri*}                          leftRef   Output. Part of the reference left of the plane.
+ * @param {Tri*}                          rightRef  Output. Part of the reference right of the plane.
+ */
+void BVH::splitReference(
+	const Tri* ref, const cl_uint axis, const cl_float pos,
+	const vector<cl_float4>* vertices4, Tri* leftRef, Tri* rightRef
+) {
+	*leftRef = *ref;
+	*rightRef = *ref;
+
+	if( !mPhongTess ) {
+		glm::vec3 v[3];
+		cl_float4 fv[3] = {
+			(*vertices4)[ref->face.x],
+			(*vertices4)[ref->face.y],
+			(*vertices4)[ref->face.z]
+		};
+
+		for( cl_uint i = 0; i < 3; i++ ) {
+			v[i] = glm::vec3( fv[i].x, fv[i].y, fv[i].z );
+		}
 
-	// Just do it 50:50 then.
-	if( leftGroup->size() == 0 || rightGroup->size() == 0 ) {
-		Logger::logDebugVerbose( "[BVH] Dividing nodes by the given position left one side empty. Just doing it 50:50 now." );
+		leftRef->bbMin = glm::vec3( FLT_MAX );
+		leftRef->bbMax = glm::vec3( -FLT_MAX );
+		rightRef->bbMin = glm::vec3( FLT_MAX );
+		rightRef->bbMax = glm::vec3( -FLT_MAX );
 
-		leftGroup->clear();
-		rightGroup->clear();
+		// Assign the vertices to the sides and add
+		// the points where the edges cross the plane.
+		for( cl_uint i = 0; i < 3; i++ ) {
+			const glm::vec3 v0 = v[i];
+			const glm::vec3 v1 = v[( i + 1 ) % 3];
 
-		for( cl_uint i = 0; i < nodes.size(); i++ ) {
-			if( i < nodes.size() / 2 ) {
-				leftGroup->push_back( nodes[i] );
+			if( v0[axis] <= pos ) {
+				leftRef->bbMin = glm::min( leftRef->bbMin, v0 );
+				leftRef->bbMax = glm::max( leftRef->bbMax, v0 );
 			}
-			else {
-				rightGroup->push_back( nodes[i] );
+			if( v0[axis] >= pos ) {
+				rightRef->bbMin = glm::min( rightRef->bbMin, v0 );
+				rightRef->bbMax = glm::max( rightRef->bbMax, v0 );
+			}
+
+			if(
+				( v0[axis] < pos && v1[axis] > pos ) ||
+				( v0[axis] > pos && v1[axis] < pos )
+			) {
+				cl_float t = ( pos - v0[axis] ) / ( v1[axis] - v0[axis] );
+				glm::vec3 p = v0 + ( v1 - v0 ) * fmin( fmax( t, 0.0f ), 1.0f );
+				p[axis] = pos;
+
+				leftRef->bbMin = glm::min( leftRef->bbMin, p );
+				leftRef->bbMax = glm::max( leftRef->bbMax, p );
+				rightRef->bbMin = glm::min( rightRef->bbMin, p );
+				rightRef->bbMax = glm::max( rightRef->bbMax, p );
 			}
 		}
 	}
 
-	// There has to be somewhere else something wrong.
-	if( leftGroup->size() == 0 || rightGroup->size() == 0 ) {
-		char msg[256];
-		snprintf(
-			msg, 256, "[BVH] Dividing nodes 50:50 left one side empty. Nodes: %lu.", nodes.size()
-		);
-		Logger::logError( msg );
+	leftRef->bbMax[axis] = pos;
+	rightRef->bbMin[axis] = pos;
+
+	// The reference may have been clipped before.
+	leftRef->bbMin = glm::max( leftRef->bbMin, ref->bbMin );
+	leftRef->bbMax = glm::min( leftRef->bbMax, ref->bbMax );
+	rightRef->bbMin = glm::max( rightRef->bbMin, ref->bbMin );
+	rightRef->bbMax = glm::min( rightRef->bbMax, ref->bbMax );
+}
+
+
+/**
+ * Find the best spatial split of the references in a node. If it is better
+ * than the given SAH value, distribute the references to the child nodes.
+ * Faces cut by the split are referenced in both child nodes.
+ * @param  {const BVHNode*}              node      The node to split.
+ * @param  {const std::vector<cl_uint>*} refs      Indices of the references in the node.
+ * @param  {SBVHBuild*}                  build     References and settings of the object that is being built.
+ * @param  {const cl_float}              maxSAH    SAH value to beat, usually the one of the object split.
+ * @param  {std::vector<cl_uint>*}       leftRefs  Output. References left of the split.
+ * @param  {std::vector<cl_uint>*}       rightRefs Output. References right of the split.
+ * @return {bool}                                  True, if the references have been split.
+ */
+bool BVH::splitSpatial(
+	const BVHNode* node, const vector<cl_uint>* refs, SBVHBuild* build,
+	const cl_float maxSAH, vector<cl_uint>* leftRefs, vector<cl_uint>* rightRefs
+) {
+	const cl_uint numBins = ( mSAHBins > 0 ) ? mSAHBins : 32;
+	const cl_uint numRefs = refs->size();
+
+	vector<BVHBin> bins( numBins );
+	vector<cl_uint> entries( numBins ), exits( numBins );
+	vector<cl_float> leftSA( numBins - 1 );
+	vector<cl_uint> leftNumRefs( numBins - 1 );
+
+	cl_float bestSAH = maxSAH;
+	int bestAxis = -1;
+	cl_uint bestSplit = 0;
+
+	for( cl_uint axis = 0; axis <= 2; axis++ ) {
+		const cl_float binStart = node->bbMin[axis];
+		const cl_float binSize = ( node->bbMax[axis] - binStart ) / numBins;
+
+		if( binSize <= 0.0f ) {
+			continue;
+		}
+
+		for( cl_uint i = 0; i < numBins; i++ ) {
+			bins[i].numFaces = 0;
+			entries[i] = 0;
+			exits[i] = 0;
+		}
+
+		// Chop each reference into the bins it overlaps.
+		for( cl_uint i = 0; i < numRefs; i++ ) {
+			const Tri* ref = &build->refs[(*refs)[i]];
+			cl_uint firstBin = fmin( fmax( ( ref->bbMin[axis] - binStart ) / binSize, 0.0f ), numBins - 1 );
+			cl_uint lastBin = fmin( fmax( ( ref->bbMax[axis] - binStart ) / binSize, 0.0f ), numBins - 1 );
+			Tri piece = *ref;
+
+			for( cl_uint b = firstBin; b <= lastBin; b++ ) {
+				Tri leftPiece, rightPiece;
+
+				if( b < lastBin ) {
+					cl_float pos = binStart + ( b + 1 ) * binSize;
+					this->splitReference( &piece, axis, pos, build->vertices4, &leftPiece, &rightPiece );
+					piece = rightPiece;
+				}
+				else {
+					leftPiece = piece;
+				}
+
+				if( !this->isValidReference( &leftPiece ) ) {
+					continue;
+				}
+
+				if( bins[b].numFaces == 0 ) {
+					bins[b].bbMin = leftPiece.bbMin;
+					bins[b].bbMax = leftPiece.bbMax;
+				}
+				else {
+					bins[b].bbMin = glm::min( bins[b].bbMin, leftPiece.bbMin );
+					bins[b].bbMax = glm::max( bins[b].bbMax, leftPiece.bbMax );
+				}
+
+				bins[b].numFaces++;
+			}
+
+			entries[firstBin]++;
+			exits[lastBin]++;
+		}
+
+
+		// Grow a bounding box bin by bin starting from the left.
+		// References are counted on the left side from the bin they enter.
+
+		glm::vec3 bbMin, bbMax;
+		bool isEmpty = true;
+		cl_uint count = 0;
+
+		for( cl_uint i = 0; i < numBins - 1; i++ ) {
+			if( bins[i].numFaces > 0 ) {
+				bbMin = isEmpty ? bins[i].bbMin : glm::min( bbMin, bins[i].bbMin );
+				bbMax = isEmpty ? bins[i].bbMax : glm::max( bbMax, bins[i].bbMax );
+				isEmpty = false;
+			}
+
+			count += entries[i];
+			leftNumRefs[i] = count;
+			leftSA[i] = isEmpty ? 0.0f : MathHelp::getSurfaceArea( bbMin, bbMax );
+		}
+
+
+		// Grow a bounding box bin by bin starting from the right.
+		// References are counted on the right side from the bin they exit.
+
+		isEmpty = true;
+		count = 0;
+
+		for( cl_uint i = numBins - 1; i > 0; i-- ) {
+			if( bins[i].numFaces > 0 ) {
+				bbMin = isEmpty ? bins[i].bbMin : glm::min( bbMin, bins[i].bbMin );
+				bbMax = isEmpty ? bins[i].bbMax : glm::max( bbMax, bins[i].bbMax );
+				isEmpty = false;
+			}
+
+			count += exits[i];
+			const cl_uint numLeft = leftNumRefs[i - 1];
+
+			// Each child node has to get less references than the
+			// parent and the duplicates have to fit into the budget.
+			if(
+				count == 0 || numLeft == 0 ||
+				count >= numRefs || numLeft >= numRefs ||
+				(cl_int) ( numLeft + count - numRefs ) > build->duplicatesLeft
+			) {
+				continue;
+			}
+
+			cl_float rightSA = MathHelp::getSurfaceArea( bbMin, bbMax );
+			cl_float sah = this->calcSAH( leftSA[i - 1], numLeft, rightSA, count );
+
+			if( sah < bestSAH ) {
+				bestSAH = sah;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	if( bestAxis < 0 ) {
+		return false;
+	}
+
+
+	// Distribute the references. The ones overlapping the
+	// plane are split in two and added as new references.
+
+	const cl_float binStart = node->bbMin[bestAxis];
+	const cl_float binSize = ( node->bbMax[bestAxis] - binStart ) / numBins;
+	const cl_float pos = binStart + bestSplit * binSize;
+
+	leftRefs->clear();
+	rightRefs->clear();
+
+	for( cl_uint i = 0; i < numRefs; i++ ) {
+		const cl_uint refIndex = (*refs)[i];
+		const Tri* ref = &build->refs[refIndex];
+		cl_uint firstBin = fmin( fmax( ( ref->bbMin[bestAxis] - binStart ) / binSize, 0.0f ), numBins - 1 );
+		cl_uint lastBin = fmin( fmax( ( ref->bbMax[bestAxis] - binStart ) / binSize, 0.0f ), numBins - 1 );
+
+		if( lastBin < bestSplit ) {
+			leftRefs->push_back( refIndex );
+		}
+		else if( firstBin >= bestSplit ) {
+			rightRefs->push_back( refIndex );
+		}
+		else {
+			Tri leftRef, rightRef;
+			this->splitReference( ref, bestAxis, pos, build->vertices4, &leftRef, &rightRef );
+
+			bool isValidLeft = this->isValidReference( &leftRef );
+			bool isValidRight = this->isValidReference( &rightRef );
+
+			if( isValidLeft && isValidRight ) {
+				build->duplicatesLeft--;
+			}
+			if( isValidLeft ) {
+				leftRefs->push_back( build->refs.size() );
+				build->refs.push_back( leftRef );
+			}
+			if( isValidRight ) {
+				rightRefs->push_back( build->refs.size() );
+				build->refs.push_back( rightRef );
+			}
+		}
+	}
+
+	// Clipping left one side empty after all. Use the object split.
+	if( leftRefs->size() == 0 || rightRefs->size() == 0 ) {
+		leftRefs->clear();
+		rightRefs->clear();
+
+		return false;
 	}
+
+	return true;
+}
+
+
+/**
+ * Raise the reached depth to the depth of a node. Called by all build
+ * threads, so it is a compare-and-swap loop instead of a lock per node.
+ * @param {const cl_uint} depth Depth of the node.
+ */
+void BVH::updateDepthReached( const cl_uint depth ) {
+	cl_uint reached = mDepthReached.load();
+
+	while( depth > reached && !mDepthReached.compare_exchange_weak( reached, depth ) ) {}
 }
 
 
@@ -1010,8 +3028,8 @@ void BVH::visualizeNextNode(
 		return;
 	}
 
-	// Only visualize leaf nodes
-	if( node->faces.size() > 0 ) {
+	// Only visualize leaf and instance nodes
+	if( node->numFaces > 0 || node->instance >= 0 ) {
 		cl_uint i = vertices->size() / 3;
 
 		// bottom
@@ -1,15 +1,42 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <algorithm>
+#include <atomic>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <future>
+#include <glm/gtc/matrix_transform.hpp>
+#include <map>
 #include <set>
+#include <thread>
 
 #include "AccelStructure.h"
+#include "BVHNodeArena.h"
 #include "../Cfg.h"
 #include "../Logger.h"
 #include "../MathHelp.h"
 #include "../ModelLoader.h"
 
+#define BVH_BUILD_SAH 0
+#define BVH_BUILD_LBVH 1
+#define BVH_BUILD_SBVH 2
+
+// Cost of a node test. The cost of a face test is
+// relative to it, see "bvh.sah_face_cost" in the config.
+#define BVH_COST_NODE 1.2f
+
+// Upper limit for "bvh.max_faces". Quantized
+// wide nodes store the face count in a char.
+#define BVH_MAX_LEAF_FACES 127
+
+// Box tests of a node the profile needs, before its hit
+// rate is trusted more than its surface area ratio.
+#define BVH_PROFILE_MIN_TESTS 64
+
+// Leaves of a treelet for the optimization. The number of
+// possible subtrees grows exponentially with it.
+#define BVH_TREELET_LEAVES 7
+
 using std::vector;
 
 
@@ -17,7 +44,9 @@ struct BVHNode {
 	BVHNode* leftChild;
 	BVHNode* rightChild;
 	BVHNode* parent;
-	vector<Tri> faces;
+	cl_uint faceOffset;
+	cl_uint numFaces;
+	cl_int instance;
 	glm::vec3 bbMin;
 	glm::vec3 bbMax;
 	uint id;
@@ -27,6 +56,40 @@ struct BVHNode {
 };
 
 
+struct BVHBin {
+	glm::vec3 bbMin;
+	glm::vec3 bbMax;
+	cl_uint numFaces;
+};
+
+
+struct BVHInstance {
+	BVHNode* node;
+	BVHNode* root;
+	cl_uint objectIndex;
+	cl_uint numNodes;
+	glm::mat4 transform;
+};
+
+
+struct BVHStats {
+	cl_float buildTime; // [ms]
+	cl_float sahCost;
+	cl_float avgLeafFaces;
+	cl_float overlap; // Mean overlap of siblings relative to their parent.
+	cl_float epo; // Effective parent overlap. -1 if not calculated.
+};
+
+
+struct SBVHBuild {
+	vector<Tri> refs;
+	vector<cl_uint> leafRefs;
+	const vector<cl_float4>* vertices4;
+	cl_float rootSA;
+	cl_int duplicatesLeft;
+};
+
+
 class BVH : public AccelStructure {
 
 	public:
@@ -34,77 +97,131 @@ class BVH : public AccelStructure {
 		BVH(
 			const vector<object3D> sceneObjects,
 			const vector<cl_float> vertices,
-			const vector<cl_float> normals
+			const vector<cl_float> normals,
+			const vector<instance_t> instances
 		);
 		~BVH();
+		vector<BVHNode*> collapseNode( BVHNode* node, const cl_uint width );
 		vector<BVHNode*> getContainerNodes();
 		cl_uint getDepth();
+		Tri getFace( const BVHNode* node, const cl_uint index );
+		vector<BVHInstance> getInstances();
 		vector<BVHNode*> getLeafNodes();
 		vector<BVHNode*> getNodes();
+		BVHNode* getObjectRoot( const cl_uint objectIndex );
+		BVHNode* getSkipNode( const BVHNode* node );
+		BVHStats getStats();
 		BVHNode* getRoot();
+		void layoutByProfile( const vector<cl_uint>* profile, const bool swapChildren );
+		vector<BVHNode*> refitObject(
+			const cl_uint objectIndex,
+			const vector<cl_float4>* vertices4, const vector<cl_float4>* normals4
+		);
 		virtual void visualize( vector<cl_float>* vertices, vector<cl_uint>* indices );
 
 	protected:
-		void assignFacesToBins(
-			const cl_uint axis, const cl_uint splits, const vector<Tri>* faces,
-			const vector< vector<glm::vec3> >* leftBin,
-			const vector< vector<glm::vec3> >* rightBin,
-			vector< vector<Tri> >* leftBinFaces, vector< vector<Tri> >* rightBinFaces
-		);
 		BVHNode* buildTree(
-			const vector<Tri> faces, const glm::vec3 bbMin, const glm::vec3 bbMax,
+			const cl_uint faceOffset, const cl_uint numFaces,
+			cl_uint depth, const cl_float rootSA
+		);
+		BVHNode* buildTreeLBVH(
+			const cl_uint faceOffset, const cl_uint numFaces,
 			cl_uint depth, const cl_float rootSA
 		);
+		BVHNode* buildTreeSBVH( vector<cl_uint>* refs, cl_uint depth, SBVHBuild* build );
 		vector<BVHNode*> buildTreesFromObjects(
 			const vector<object3D>* sceneObjects,
 			const vector<cl_float>* vertices,
 			const vector<cl_float>* normals
 		);
+		void buildTreesWorker(
+			const vector<object3D>* sceneObjects,
+			const vector<cl_uint>* offsets, const vector<cl_uint>* offsetsN,
+			const vector<cl_float4>* vertices4, const vector<cl_float4>* normals4,
+			std::atomic<cl_uint>* nextObject, vector<BVHNode*>* subTrees
+		);
+		cl_float buildWithBinnedSAH(
+			BVHNode* node, const cl_uint faceOffset, const cl_uint numFaces, cl_uint* numFacesLeft
+		);
 		void buildWithMeanSplit(
-			BVHNode* node, const vector<Tri> faces,
-			vector<Tri>* leftFaces, vector<Tri>* rightFaces
+			BVHNode* node, const cl_uint faceOffset, const cl_uint numFaces, cl_uint* numFacesLeft
 		);
 		cl_float buildWithSAH(
-			BVHNode* node, vector<Tri> faces,
-			vector<Tri>* leftFaces, vector<Tri>* rightFaces
+			BVHNode* node, const cl_uint faceOffset, const cl_uint numFaces, cl_uint* numFacesLeft
 		);
+		cl_float calcEPO( const vector<cl_float>* vertices );
+		BVHStats calcStats( const vector<cl_float>* vertices );
 		cl_float calcSAH(
 			const cl_float leftSA, const cl_float leftNumFaces,
 			const cl_float rightSA, const cl_float rightNumFaces
 		);
+		cl_float calcSubTreeCost( const BVHNode* root );
+		void collectSBVHReferences( vector<BVHNode*>* subTrees );
 		void combineNodes( const cl_uint numSubTrees );
-		vector<Tri> facesToTriStructs(
+		vector<BVHNode*> createInstanceNodes(
+			const vector<object3D>* sceneObjects, const vector<instance_t>* instances,
+			const vector<BVHNode*>* subTrees
+		);
+		void facesToTriStructs(
 			const vector<cl_uint4>* facesThisObj, const vector<cl_uint4>* faceNormalsThisObj,
-			const vector<cl_float4>* vertices4, const vector<float>* normals
+			const vector<cl_float4>* vertices4, const vector<cl_float4>* normals4
+		);
+		cl_uint findMortonSplit( const cl_uint faceOffset, const cl_uint numFaces );
+		cl_float getMean( const cl_uint faceOffset, const cl_uint numFaces, const cl_uint axis );
+		void groupTreesToNodes(
+			vector<BVHNode*> nodes, const std::map<const BVHNode*, cl_float>* subTreeCosts,
+			BVHNode* parent, cl_uint depth
 		);
-		cl_float getMean( const vector<Tri> faces, const cl_uint axis );
-		cl_float getMeanOfNodes( const vector<BVHNode*> nodes, const cl_uint axis );
-		void groupTreesToNodes( vector<BVHNode*> nodes, BVHNode* parent, cl_uint depth );
 		void growAABBsForSAH(
-			const vector<Tri>* faces,
-			vector< vector<glm::vec3> >* leftBB, vector< vector<glm::vec3> >* rightBB,
+			const cl_uint faceOffset, const cl_uint numFaces,
 			vector<cl_float>* leftSA, vector<cl_float>* rightSA
 		);
-		void logStats( boost::posix_time::ptime timerStart );
-		cl_uint longestAxis( const BVHNode* node );
-		BVHNode* makeNode( const vector<Tri> faces, bool ignore );
+		bool isLeafCheaper( const BVHNode* node, const cl_uint numFaces, const cl_float splitSAH );
+		bool isValidReference( const Tri* ref );
+		void logStats( boost::posix_time::ptime timerStart, const vector<cl_float>* vertices );
+		BVHNode* makeNode( const cl_uint faceOffset, const cl_uint numFaces );
+		cl_ulong mortonCode( const glm::vec3 pos, const cl_uint bitsPerAxis );
 		BVHNode* makeContainerNode( const vector<BVHNode*> subTrees, const bool isRoot );
+		BVHNode* makeInstanceNode( const cl_uint instanceIndex );
+		void optimizeTreelets();
 		void orderNodesByTraversal();
 		vector<cl_float4> packFloatAsFloat4( const vector<cl_float>* vertices );
+		cl_uint partitionFaces(
+			const cl_uint faceOffset, const cl_uint numFaces, const cl_float pos, const cl_uint axis
+		);
+		void releaseThread();
+		bool reserveThread();
+		bool restructureTreelet(
+			BVHNode* root, const vector<bool>* isFixed, vector<cl_float>* costs
+		);
+		void setInstanceAABB( BVHNode* node );
 		cl_uint setMaxFaces( const int value );
-		void skipAheadOfNodes();
+		void skipAheadOfNodes( const std::map<const BVHNode*, cl_float>* hitRates );
+		void sortByMortonCodes( const cl_uint faceOffset, const cl_uint numFaces );
+		cl_float splitByBinnedSAH(
+			const vector<Tri>* faces, cl_uint* indices, const cl_uint numFaces,
+			const cl_uint numBins, cl_uint* numFacesLeft
+		);
 		void splitBySAH(
-			cl_float* bestSAH, const cl_uint axis, vector<Tri> faces,
-			vector<Tri>* leftFaces, vector<Tri>* rightFaces
+			cl_float* bestSAH, const cl_uint axis, const cl_uint faceOffset, const cl_uint numFaces,
+			int* bestAxis, cl_uint* numFacesLeft
 		);
 		cl_float splitFaces(
-			const vector<Tri> faces, const cl_float midpoint, const cl_uint axis,
-			vector<Tri>* leftFaces, vector<Tri>* rightFaces
+			const cl_uint faceOffset, const cl_uint numFaces, const cl_float pos, const cl_uint axis
 		);
-		void splitNodes(
-			const vector<BVHNode*> nodes, const cl_float midpoint, const cl_uint axis,
+		void splitNodesBySAH(
+			const vector<BVHNode*> nodes, const std::map<const BVHNode*, cl_float>* subTreeCosts,
 			vector<BVHNode*>* leftGroup, vector<BVHNode*>* rightGroup
 		);
+		void splitReference(
+			const Tri* ref, const cl_uint axis, const cl_float pos,
+			const vector<cl_float4>* vertices4, Tri* leftRef, Tri* rightRef
+		);
+		bool splitSpatial(
+			const BVHNode* node, const vector<cl_uint>* refs, SBVHBuild* build,
+			const cl_float maxSAH, vector<cl_uint>* leftRefs, vector<cl_uint>* rightRefs
+		);
+		void updateDepthReached( const cl_uint depth );
 		void visualizeNextNode(
 			const BVHNode* node, vector<cl_float>* vertices, vector<cl_uint>* indices
 		);
@@ -112,10 +229,36 @@ class BVH : public AccelStructure {
 		vector<BVHNode*> mContainerNodes;
 		vector<BVHNode*> mLeafNodes;
 		vector<BVHNode*> mNodes;
+		BVHNodeArena mNodeArena; // Owns all nodes, also those not in mNodes
+		vector<BVHNode*> mObjectRoots;
+		vector<BVHNode*> mInstancedRoots;
+		vector<BVHInstance> mInstances;
 		BVHNode* mRoot;
 
+		vector<Tri> mFaces;
+		vector<cl_uint> mFaceIndices;
+		vector<cl_ulong> mMortonCodes;
+		vector<SBVHBuild> mSBVHBuilds;
+		BVHStats mStats;
+
 		cl_uint mMaxFaces;
-		cl_uint mDepthReached;
+		std::atomic<cl_uint> mDepthReached;
+		cl_uint mSAHBins;
+		cl_float mSAHFaceCost;
+		cl_uint mSAHFacesLimit;
+
+		cl_uint mBuildMethod;
+		cl_float mOptimizeTime;
+		cl_uint mMortonBits;
+		cl_uint mLBVHSAHFaces;
+		cl_float mSBVHAlpha;
+		cl_float mSBVHDuplicates;
+		bool mPhongTess;
+		bool mStatsEPO;
+
+		cl_uint mBuildThreads;
+		cl_uint mParallelFaces;
+		std::atomic<cl_uint> mThreadsActive;
 
 };
 
@@ -0,0 +1,108 @@
+#include "BVHNodeArena.h"
+#include "BVH.h"
+
+using std::vector;
+
+
+std::atomic<cl_ulong> BVHNodeArena::mNextId( 1 );
+
+
+/**
+ * Chunk of nodes reserved by a thread.
+ */
+struct BVHNodeArenaChunk {
+	cl_ulong arenaId;
+	BVHNode* next;
+	cl_uint numLeft;
+};
+
+
+/**
+ * Constructor.
+ */
+BVHNodeArena::BVHNodeArena() {
+	mNumUsed = BVH_ARENA_BLOCK_SIZE;
+	mId = mNextId++;
+}
+
+
+/**
+ * Destructor.
+ */
+BVHNodeArena::~BVHNodeArena() {
+	this->clear();
+}
+
+
+/**
+ * Get a new node. It stays valid until the arena is cleared.
+ * @return {BVHNode*} The node, with all values set to 0.
+ */
+BVHNode* BVHNodeArena::allocate() {
+	// Chunks of the arenas this thread allocated from last.
+	static thread_local BVHNodeArenaChunk chunks[BVH_ARENA_THREAD_CHUNKS];
+	static thread_local cl_uint nextChunk = 0;
+
+	const cl_ulong id = mId.load();
+	BVHNodeArenaChunk* chunk = NULL;
+
+	for( cl_uint i = 0; i < BVH_ARENA_THREAD_CHUNKS; i++ ) {
+		if( chunks[i].arenaId == id ) {
+			chunk = &chunks[i];
+			break;
+		}
+	}
+
+	// First node of this arena on this thread. Replace the least recently added chunk.
+	if( chunk == NULL ) {
+		chunk = &chunks[nextChunk];
+		chunk->arenaId = id;
+		chunk->numLeft = 0;
+		nextChunk = ( nextChunk + 1 ) % BVH_ARENA_THREAD_CHUNKS;
+	}
+
+	if( chunk->numLeft == 0 ) {
+		chunk->next = this->reserveChunk();
+		chunk->numLeft = BVH_ARENA_CHUNK_SIZE;
+	}
+
+	chunk->numLeft--;
+
+	return chunk->next++;
+}
+
+
+/**
+ * Release all nodes.
+ */
+void BVHNodeArena::clear() {
+	std::lock_guard<std::mutex> lock( mMutex );
+
+	for( cl_uint i = 0; i < mBlocks.size(); i++ ) {
+		delete [] mBlocks[i];
+	}
+
+	mBlocks.clear();
+	mNumUsed = BVH_ARENA_BLOCK_SIZE;
+	mId = mNextId++;
+}
+
+
+/**
+ * Reserve a chunk of nodes for the calling thread.
+ * @return {BVHNode*} The first node of the chunk.
+ */
+BVHNode* BVHNodeArena::reserveChunk() {
+	std::lock_guard<std::mutex> lock( mMutex );
+
+	if( mNumUsed + BVH_ARENA_CHUNK_SIZE > BVH_ARENA_BLOCK_SIZE ) {
+		mBlocks.push_back( new BVHNode[BVH_ARENA_BLOCK_SIZE]() );
+		mNumUsed = 0;
+	}
+
+	BVHNode* first = &mBlocks.back()[mNumUsed];
+	mNumUsed += BVH_ARENA_CHUNK_SIZE;
+
+	return first;
+}
+
@@ -0,0 +1,53 @@
+#ifndef BVHNODEARENA_H
+#define BVHNODEARENA_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../cl.hpp"
+
+// Nodes per block. A block of nodes is allocated at once.
+#define BVH_ARENA_BLOCK_SIZE 4096
+// Nodes per chunk. A thread reserves a chunk of a block at once.
+#define BVH_ARENA_CHUNK_SIZE 64
+// Arenas per thread whose chunks are kept at the same time.
+#define BVH_ARENA_THREAD_CHUNKS 4
+
+using std::vector;
+
+
+struct BVHNode;
+
+
+/**
+ * Storage for the nodes of a BVH. Nodes are taken one after
+ * another from blocks and are only released all at once.
+ * Can be used by several build threads at the same time:
+ * Each thread reserves a chunk of nodes and takes its nodes
+ * from there, so the lock is only needed once per chunk.
+ * A thread keeps chunks of up to BVH_ARENA_THREAD_CHUNKS
+ * arenas, so switching between them wastes no nodes.
+ */
+class BVHNodeArena {
+
+	public:
+		BVHNodeArena();
+		~BVHNodeArena();
+		BVHNode* allocate();
+		void clear();
+
+	protected:
+		BVHNode* reserveChunk();
+
+	private:
+		vector<BVHNode*> mBlocks;
+		cl_uint mNumUsed; // Nodes used of the last block
+		std::atomic<cl_ulong> mId; // Changes with each clear(), invalidates the chunks of the threads
+		std::mutex mMutex;
+
+		static std::atomic<cl_ulong> mNextId;
+
+};
+
+#endif
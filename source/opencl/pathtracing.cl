@@ -17,16 +17,15 @@
  * Generate the initial ray into the scene.
  * @param  {const float}  pxDim   Pixel width and height.
  * @param  {const camera} cam     The camera model.
+ * @param  {const int2}   pos     Position of the pixel.
  * @param  {float*}       seed    Seed for the random number generator.
  * @param  {float}        tFocus  Focus distance for the image.
  * @param  {float}        tObject Distance to the object for this ray.
  * @return {ray4}                 The ray including adjustments for anti-aliasing and depth-of-field.
  */
 ray4 initRay(
-	const float pxDim, const camera cam, float* seed, float tFocus, float tObject
+	const float pxDim, const camera cam, const int2 pos, float* seed, float tFocus, float tObject
 ) {
-	const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
-
 	const float3 initialRay = cam.w + pxDim * 0.5f * (
 		cam.u - IMG_WIDTH * cam.u + 2.0f * pos.x * cam.u +
 		cam.v - IMG_HEIGHT * cam.v + 2.0f * pos.y * cam.v
@@ -52,11 +51,11 @@ ray4 initRay(
  * Get the t factor for the hit object of this ray and
  * the center ray of the previous frame.
  * @param  {const camera cam}    cam
+ * @param  {const int2}          pos     Position of the pixel.
  * @param  {read_only image2d_t} imageIn
  * @return {float2}
  */
-float2 getPreviousFocus( const camera cam, read_only image2d_t imageIn ) {
-	const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
+float2 getPreviousFocus( const camera cam, const int2 pos, read_only image2d_t imageIn ) {
 	const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
 	const float4 thisRayPixel = read_imagef( imageIn, sampler, pos );
 	const float4 centerRayPixel = read_imagef( imageIn, sampler, cam.focusPoint );
@@ -66,18 +65,98 @@ float2 getPreviousFocus( const camera cam, read_only image2d_t imageIn ) {
 
 
 /**
- * Write color to the debug image.
- * @param {write_only image2d_t} imageDebug
- * @param {const float4}         color
+ * Get the color a shadow ray adds to the pixel, if it reaches the light.
+ * @param  {const ray4*}     ray
+ * @param  {const material*} mtl
+ * @param  {const ray4*}     lightRay
+ * @param  {const float4}    lightRaySource Color of the light.
+ * @param  {const float4*}   color          Color of the path so far.
+ * @param  {float4*}         shadowColor    Output. The color to add.
+ * @return {bool}                           False, if the light does not contribute.
  */
-void writeDebugImage( write_only image2d_t imageDebug, float4 color ) {
-	const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
-	color.x /= 1082.0f; // number of faces in the test model
-	color.y /= 1265.0f; // number of BVH nodes in the test model
-	write_imagef( imageDebug, pos, color );
+bool getShadowRayColor(
+	const ray4* ray, const material* mtl, const ray4* lightRay,
+	const float4 lightRaySource, const float4* color, float4* shadowColor
+) {
+	// BRDF: Schlick
+	#if BRDF == 0
+
+		float brdf, pdf, u;
+		brdf = brdfSchlick( mtl, ray, lightRay, &( ray->normal ), &u, &pdf );
+
+		if( fabs( pdf ) <= 0.00001f ) {
+			return false;
+		}
+
+		brdf *= lambert( ray->normal, lightRay->dir );
+		brdf = native_divide( brdf, pdf );
+
+		*shadowColor = *color * lightRaySource * mtl->rgbDiff *
+			( fresnel4( u, mtl->rgbSpec ) * brdf * mtl->data.s0 + ( 1.0f - mtl->data.s0 ) );
+
+	// BRDF: Shirley/Ashikhmin
+	#elif BRDF == 1
+
+		float brdfDiff, brdfSpec, pdf;
+		float dotHK1;
+
+		brdfShirleyAshikhmin(
+			mtl->data.s2, mtl->data.s3, mtl->data.s4, mtl->data.s5,
+			ray, lightRay, &( ray->normal ), &brdfSpec, &brdfDiff, &dotHK1, &pdf
+		);
+
+		if( fabs( pdf ) <= 0.00001f ) {
+			return false;
+		}
+
+		brdfSpec = native_divide( brdfSpec, pdf );
+		brdfDiff = native_divide( brdfDiff, pdf );
+
+		float4 brdf_s = brdfSpec * mtl->rgbSpec * fresnel( dotHK1, mtl->data.s4 );
+		float4 brdf_d = brdfDiff * mtl->rgbDiff * ( 1.0f - mtl->data.s4 );
+
+		float4 brdfColor = ( brdf_s + brdf_d ) * mtl->data.s0 + ( 1.0f - mtl->data.s0 );
+		float maxRGB = max( 1.0f, max( brdfColor.x, max( brdfColor.y, brdfColor.z ) ) );
+		brdfColor /= maxRGB;
+
+		*shadowColor = clamp( brdfColor, 0.0f, 1.0f ) * lightRaySource * mtl->data.s0 + ( 1.0f - mtl->data.s0 );
+
+	#endif
+
+	return true;
 }
 
 
+/**
+ * Aim a shadow ray from the hit point of the ray at the light.
+ * @param {global const light_t*} light
+ * @param {const ray4*}           ray
+ * @param {ray4*}                 lightRay Output. <t> is the distance to the light.
+ */
+void initShadowRay( global const light_t* light, const ray4* ray, ray4* lightRay ) {
+	lightRay->origin = fma( ray->t, ray->dir, ray->origin );
+	lightRay->dir = fast_normalize( light->pos.xyz - lightRay->origin );
+	lightRay->t = length( light->pos.xyz - lightRay->origin );
+}
+
+
+#if DEBUG_IMAGE == 1
+
+	/**
+	 * Write color to the debug image.
+	 * @param {write_only image2d_t} imageDebug
+	 * @param {const float4}         color
+	 */
+	void writeDebugImage( write_only image2d_t imageDebug, float4 color ) {
+		const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
+		color.x /= (float) DEBUG_NUM_FACES;
+		color.y /= (float) DEBUG_NUM_NODES;
+		write_imagef( imageDebug, pos, color );
+	}
+
+#endif
+
+
 /**
  * Update the accumulated RGB color according to the hit material and BRDF.
  * @param {const ray4*}     ray
@@ -94,28 +173,24 @@ void updateColor(
 	const ray4* lightRay, const float4 lightRaySource, uint* secondaryPaths,
 	float4* color, float4* finalColor
 ) {
-	// BRDF: Schlick
-	#if BRDF == 0
-
-		float brdf, pdf, u;
+	#if SHADOW_RAYS == 1
 
-		#if SHADOW_RAYS == 1
+		float4 shadowColor;
 
-			if( lightRaySource.x >= 0 ) {
-				brdf = brdfSchlick( mtl, ray, lightRay, &( ray->normal ), &u, &pdf );
-
-				if( fabs( pdf ) > 0.00001f ) {
-					brdf *= lambert( ray->normal, lightRay->dir );
-					brdf = native_divide( brdf, pdf );
+		if(
+			lightRaySource.x >= 0 &&
+			getShadowRayColor( ray, mtl, lightRay, lightRaySource, color, &shadowColor )
+		) {
+			*finalColor += shadowColor;
+			*secondaryPaths += 1;
+		}
 
-					*finalColor += *color * lightRaySource * mtl->rgbDiff *
-						( fresnel4( u, mtl->rgbSpec ) * brdf * mtl->data.s0 + ( 1.0f - mtl->data.s0 ) );
+	#endif
 
-					*secondaryPaths += 1;
-				}
-			}
+	// BRDF: Schlick
+	#if BRDF == 0
 
-		#endif
+		float brdf, pdf, u;
 
 		brdf = brdfSchlick( mtl, ray, newRay, &( ray->normal ), &u, &pdf );
 		brdf *= lambert( ray->normal, newRay->dir );
@@ -130,33 +205,6 @@ void updateColor(
 		float4 brdf_d, brdf_s;
 		float dotHK1;
 
-		#if SHADOW_RAYS == 1
-
-			if( lightRaySource.x >= 0 ) {
-				brdfShirleyAshikhmin(
-					mtl->data.s2, mtl->data.s3, mtl->data.s4, mtl->data.s5,
-					ray, lightRay, &( ray->normal ), &brdfSpec, &brdfDiff, &dotHK1, &pdf
-				);
-
-				if( fabs( pdf ) > 0.00001f ) {
-					brdfSpec = native_divide( brdfSpec, pdf );
-					brdfDiff = native_divide( brdfDiff, pdf );
-
-					brdf_s = brdfSpec * mtl->rgbSpec * fresnel( dotHK1, mtl->data.s4 );
-					brdf_d = brdfDiff * mtl->rgbDiff * ( 1.0f - mtl->data.s4 );
-
-					float4 brdfColor = ( brdf_s + brdf_d ) * mtl->data.s0 + ( 1.0f - mtl->data.s0 );
-					float maxRGB = max( 1.0f, max( brdfColor.x, max( brdfColor.y, brdfColor.z ) ) );
-					brdfColor /= maxRGB;
-
-					*finalColor += clamp( brdfColor, 0.0f, 1.0f ) * lightRaySource * mtl->data.s0 + ( 1.0f - mtl->data.s0 );
-
-					*secondaryPaths += 1;
-				}
-			}
-
-		#endif
-
 		brdfShirleyAshikhmin(
 			mtl->data.s2, mtl->data.s3, mtl->data.s4, mtl->data.s5,
 			ray, newRay, &( ray->normal ), &brdfSpec, &brdfDiff, &dotHK1, &pdf
@@ -186,10 +234,8 @@ void updateColor(
  * @param {float4*} lightRaySource
  */
 void shadowRayTest( Scene* scene, ray4* ray, ray4* lightRay, float4* lightRaySource ) {
-	lightRay->origin = fma( ray->t, ray->dir, ray->origin );
-	lightRay->dir = fast_normalize( scene->lights[0].pos.xyz - lightRay->origin );
-	float tLight = length( scene->lights[0].pos.xyz - lightRay->origin );
-	lightRay->t = tLight;
+	initShadowRay( &scene->lights[0], ray, lightRay );
+	float tLight = lightRay->t;
 
 	traverseShadows( scene, lightRay );
 
@@ -216,11 +262,16 @@ kernel void pathTracing(
 	// acceleration structure
 	#if ACCEL_STRUCT == 0
 		global const bvhNode* bvh,
+		global const bvhInstance* instances,
+		#if BVH_PROFILE == 1
+			global uint* bvhProfile,
+		#endif
 	#endif
 
 	// geometry and color related
 	global const uint4* facesV,
 	global const uint4* facesN,
+	global const tri_t* tris,
 	global const float4* vertices,
 	global const float4* normals,
 	global const material* materials,
@@ -228,100 +279,207 @@ kernel void pathTracing(
 
 	// old and new frame
 	read_only image2d_t imageIn,
-	write_only image2d_t imageOut,
+	write_only image2d_t imageOut
 
-	write_only image2d_t imageDebug
+	#if DEBUG_IMAGE == 1
+		, write_only image2d_t imageDebug
+	#endif
 ) {
+	const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
 	float4 finalColor = (float4)( 0.0f );
 
 	#if ACCEL_STRUCT == 0
-		Scene scene = { bvh, lights, facesV, facesN, vertices, normals, (float4)( 0.0f ) };
+		Scene scene = { bvh, instances, lights, facesV, facesN, tris, vertices, normals };
+
+		#if BVH_PROFILE == 1
+			scene.bvhProfile = bvhProfile;
+		#endif
+
+		#if DEBUG_IMAGE == 1
+			scene.debugColor = (float4)( 0.0f );
+		#endif
 	#endif
 
 	float focus = 0.0f;
 	float2 prevFocus = (float2)( -1.0f, -1.0f );
 
 	if( cam.focusPoint.x >= 0 && cam.focusPoint.y >= 0 ) {
-		prevFocus = getPreviousFocus( cam, imageIn );
+		prevFocus = getPreviousFocus( cam, pos, imageIn );
 	}
 
 	bool addDepth;
 	uint secondaryPaths = 1; // Start at 1 instead of 0, because we are going to divide through it.
 
-	for( uint sample = 0; sample < SAMPLES; sample++ ) {
+	#if PATH_REGENERATION == 1
+
+		// One loop over the bounces of all samples. A path that ends early
+		// starts the next sample right away, instead of idling until the
+		// longest path of the work-group has finished.
 		float4 color = (float4)( 1.0f );
 		float4 light = (float4)( -1.0f );
-
-		ray4 ray = initRay( pxDim, cam, &seed, prevFocus.y, prevFocus.x );
+		ray4 ray = initRay( pxDim, cam, pos, &seed, prevFocus.y, prevFocus.x );
+		uint sample = 0;
+		uint depth = 0;
 		int depthAdded = 0;
 
-		for( uint depth = 0; depth < MAX_DEPTH + depthAdded; depth++ ) {
+		while( sample < SAMPLES ) {
+			bool pathEnds = true;
+
 			traverse( &scene, &ray );
 
 			focus = ( sample + depth == 0 ) ? ray.t : focus;
 
 			if( ray.t == INFINITY ) {
 				light = ( ray.hitFace < 0 ) ? (float4)( scene.lights[-( ray.hitFace + 1 )].rgb ) : SKY_LIGHT;
-				break;
 			}
+			else {
+				material mtl = materials[scene.facesV[ray.hitFace].w];
+
+				// Last round, no need to calculate a new ray.
+				// Unless we hit a material that extends the path.
+				addDepth = extendDepth( &mtl, &seed );
+
+				if( !( mtl.data.s0 == 1.0f && !addDepth && depth == MAX_DEPTH + depthAdded - 1 ) ) {
+					seed += ray.t;
+
+					float4 lightRaySource = (float4)( -1.0f );
+					ray4 lightRay;
+					lightRay.t = INFINITY;
+
+					#if SHADOW_RAYS == 1
+						#if NUM_LIGHTS > 0
+							if( mtl.data.s0 > 0.0f ) {
+								shadowRayTest( &scene, &ray, &lightRay, &lightRaySource );
+							}
+						#endif
+					#endif
+
+					// New direction of the ray (bouncing of the hit surface)
+					ray4 newRay = getNewRay( &ray, &mtl, &seed, &addDepth );
+
+					// Flip the normal if it points in the wrong direction.
+					// Do it only now, becuause we still need the original face normal
+					// for the refraction calculation.
+					if( dot( ray.normal, -ray.dir ) <= 0.0f ) {
+						ray.normal = -ray.normal;
+					}
 
-			material mtl = materials[scene.facesV[ray.hitFace].w];
+					updateColor(
+						&ray, &newRay, &mtl, &lightRay, lightRaySource, &secondaryPaths,
+						&color, &finalColor
+					);
 
-			// Last round, no need to calculate a new ray.
-			// Unless we hit a material that extends the path.
-			addDepth = extendDepth( &mtl, &seed );
+					// Extend max path depth
+					depthAdded += ( addDepth && depthAdded < MAX_ADDED_DEPTH );
 
-			if( mtl.data.s0 == 1.0f && !addDepth && depth == MAX_DEPTH + depthAdded - 1 ) {
-				break;
+					// Russian roulette termination
+					float maxValColor = fmax( color.x, fmax( color.y, color.z ) );
+
+					if( !russianRoulette( depth, depthAdded, maxValColor, &seed ) ) {
+						ray = newRay;
+						depth++;
+						pathEnds = ( depth >= MAX_DEPTH + depthAdded );
+					}
+				}
 			}
 
-			seed += ray.t;
+			if( pathEnds ) {
+				if( light.x > -1.0f ) {
+					color *= light;
+					finalColor += color;
+				}
 
-			float4 lightRaySource = (float4)( -1.0f );
-			ray4 lightRay;
-			lightRay.t = INFINITY;
+				sample++;
 
-			#if SHADOW_RAYS == 1
-				#if NUM_LIGHTS > 0
-					if( mtl.data.s0 > 0.0f ) {
-						shadowRayTest( &scene, &ray, &lightRay, &lightRaySource );
-					}
+				// Next path of this pixel
+				if( sample < SAMPLES ) {
+					color = (float4)( 1.0f );
+					light = (float4)( -1.0f );
+					ray = initRay( pxDim, cam, pos, &seed, prevFocus.y, prevFocus.x );
+					depth = 0;
+					depthAdded = 0;
+				}
+			}
+		} // end paths
+
+	#else
+
+		for( uint sample = 0; sample < SAMPLES; sample++ ) {
+			float4 color = (float4)( 1.0f );
+			float4 light = (float4)( -1.0f );
+
+			ray4 ray = initRay( pxDim, cam, pos, &seed, prevFocus.y, prevFocus.x );
+			int depthAdded = 0;
+
+			for( uint depth = 0; depth < MAX_DEPTH + depthAdded; depth++ ) {
+				traverse( &scene, &ray );
+
+				focus = ( sample + depth == 0 ) ? ray.t : focus;
+
+				if( ray.t == INFINITY ) {
+					light = ( ray.hitFace < 0 ) ? (float4)( scene.lights[-( ray.hitFace + 1 )].rgb ) : SKY_LIGHT;
+					break;
+				}
+
+				material mtl = materials[scene.facesV[ray.hitFace].w];
+
+				// Last round, no need to calculate a new ray.
+				// Unless we hit a material that extends the path.
+				addDepth = extendDepth( &mtl, &seed );
+
+				if( mtl.data.s0 == 1.0f && !addDepth && depth == MAX_DEPTH + depthAdded - 1 ) {
+					break;
+				}
+
+				seed += ray.t;
+
+				float4 lightRaySource = (float4)( -1.0f );
+				ray4 lightRay;
+				lightRay.t = INFINITY;
+
+				#if SHADOW_RAYS == 1
+					#if NUM_LIGHTS > 0
+						if( mtl.data.s0 > 0.0f ) {
+							shadowRayTest( &scene, &ray, &lightRay, &lightRaySource );
+						}
+					#endif
 				#endif
-			#endif
 
-			// New direction of the ray (bouncing of the hit surface)
-			ray4 newRay = getNewRay( &ray, &mtl, &seed, &addDepth );
+				// New direction of the ray (bouncing of the hit surface)
+				ray4 newRay = getNewRay( &ray, &mtl, &seed, &addDepth );
 
-			// Flip the normal if it points in the wrong direction.
-			// Do it only now, becuause we still need the original face normal
-			// for the refraction calculation.
-			if( dot( ray.normal, -ray.dir ) <= 0.0f ) {
-				ray.normal = -ray.normal;
-			}
+				// Flip the normal if it points in the wrong direction.
+				// Do it only now, becuause we still need the original face normal
+				// for the refraction calculation.
+				if( dot( ray.normal, -ray.dir ) <= 0.0f ) {
+					ray.normal = -ray.normal;
+				}
 
-			updateColor(
-				&ray, &newRay, &mtl, &lightRay, lightRaySource, &secondaryPaths,
-				&color, &finalColor
-			);
+				updateColor(
+					&ray, &newRay, &mtl, &lightRay, lightRaySource, &secondaryPaths,
+					&color, &finalColor
+				);
 
-			// Extend max path depth
-			depthAdded += ( addDepth && depthAdded < MAX_ADDED_DEPTH );
+				// Extend max path depth
+				depthAdded += ( addDepth && depthAdded < MAX_ADDED_DEPTH );
 
-			// Russian roulette termination
-			float maxValColor = fmax( color.x, fmax( color.y, color.z ) );
+				// Russian roulette termination
+				float maxValColor = fmax( color.x, fmax( color.y, color.z ) );
 
-			if( russianRoulette( depth, depthAdded, maxValColor, &seed ) ) {
-				break;
-			}
+				if( russianRoulette( depth, depthAdded, maxValColor, &seed ) ) {
+					break;
+				}
 
-			ray = newRay;
-		} // end bounces
+				ray = newRay;
+			} // end bounces
 
-		if( light.x > -1.0f ) {
-			color *= light;
-			finalColor += color;
-		}
-	} // end samples
+			if( light.x > -1.0f ) {
+				color *= light;
+				finalColor += color;
+			}
+		} // end samples
+
+	#endif
 
 	finalColor /= (float) secondaryPaths;
 
@@ -330,5 +488,13 @@ kernel void pathTracing(
 	#endif
 
 	setColors( imageIn, imageOut, pixelWeight, finalColor, focus );
-	writeDebugImage( imageDebug, scene.debugColor );
+
+	#if DEBUG_IMAGE == 1
+		writeDebugImage( imageDebug, scene.debugColor );
+	#endif
 }
+
+
+#if WAVEFRONT == 1
+	#FILE:pt_wavefront.cl:FILE#
+#endif
@@ -20,30 +20,398 @@ void intersectFace(
 		ray->t = *t;
 	}
 
-	scene->debugColor.x += 1.0f;
+	#if DEBUG_IMAGE == 1
+		scene->debugColor.x += 1.0f;
+	#endif
 }
 
 
+#if BVH_WIDTH == 2
+
+	/**
+	 * Test faces of the given node for intersections with the given ray.
+	 * @param {const Scene*}      scene
+	 * @param {ray4*}             ray
+	 * @param {const bvhNode*}    node
+	 * @param {const float tNear} tNear
+	 * @param {float tFar}        tFar
+	 */
+	void intersectFaces( const Scene* scene, ray4* ray, const bvhNode* node, const float tNear, float tFar ) {
+		float t = INFINITY;
+		const int faceIndex = as_int( node->bbMin.w );
+		const int numFaces = as_int( node->bbMax.w );
+
+		for( int i = 0; i < numFaces; i++ ) {
+			intersectFace( scene, ray, faceIndex + i, &t, tNear, tFar );
+		}
+	}
+
+	#if BVH_PROFILE == 1
+
+		/**
+		 * Count the box test of a node and if it has been hit.
+		 * @param {const Scene*} scene
+		 * @param {const int}    index     Index of the node.
+		 * @param {const bool}   isNodeHit
+		 */
+		void profileNode( const Scene* scene, const int index, const bool isNodeHit ) {
+			atomic_inc( &scene->bvhProfile[index * 2] );
+
+			if( isNodeHit ) {
+				atomic_inc( &scene->bvhProfile[index * 2 + 1] );
+			}
+		}
+
+	#endif
+
+#else
+
+	/**
+	 * Test the boxes of all children of a wide node at once.
+	 * @param  {const ray4*}    ray
+	 * @param  {const float3*}  invDir
+	 * @param  {const bvhNode*} node
+	 * @param  {floatW*}        tNear
+	 * @param  {floatW*}        tFar
+	 * @return {intW}                  -1 for each hit child, 0 otherwise.
+	 */
+	intW intersectChildBoxes(
+		const ray4* ray, const float3* invDir, const bvhNode* node,
+		floatW* tNear, floatW* tFar
+	) {
+		#if BVH_QUANTIZE == 0
+			const floatW bbMinX = node->bbMinX;
+			const floatW bbMinY = node->bbMinY;
+			const floatW bbMinZ = node->bbMinZ;
+			const floatW bbMaxX = node->bbMaxX;
+			const floatW bbMaxY = node->bbMaxY;
+			const floatW bbMaxZ = node->bbMaxZ;
+		#else
+			// The product is exact, the scale is a power of 2.
+			// Only the sum is rounded, the same way as on the host.
+			const floatW bbMinX = convert_floatW( node->bbMinX ) * node->scale.x + node->origin.x;
+			const floatW bbMinY = convert_floatW( node->bbMinY ) * node->scale.y + node->origin.y;
+			const floatW bbMinZ = convert_floatW( node->bbMinZ ) * node->scale.z + node->origin.z;
+			const floatW bbMaxX = convert_floatW( node->bbMaxX ) * node->scale.x + node->origin.x;
+			const floatW bbMaxY = convert_floatW( node->bbMaxY ) * node->scale.y + node->origin.y;
+			const floatW bbMaxZ = convert_floatW( node->bbMaxZ ) * node->scale.z + node->origin.z;
+		#endif
+
+		const floatW t1x = ( bbMinX - ray->origin.x ) * invDir->x;
+		const floatW t2x = ( bbMaxX - ray->origin.x ) * invDir->x;
+		const floatW t1y = ( bbMinY - ray->origin.y ) * invDir->y;
+		const floatW t2y = ( bbMaxY - ray->origin.y ) * invDir->y;
+		const floatW t1z = ( bbMinZ - ray->origin.z ) * invDir->z;
+		const floatW t2z = ( bbMaxZ - ray->origin.z ) * invDir->z;
+
+		*tNear = fmax( fmax( fmin( t1x, t2x ), fmin( t1y, t2y ) ), fmin( t1z, t2z ) );
+		*tFar = fmin( fmin( fmax( t1x, t2x ), fmax( t1y, t2y ) ), fmax( t1z, t2z ) );
+
+		return (
+			( *tNear <= *tFar ) & ( *tFar > EPSILON5 ) &
+			( *tNear < ray->t ) & ( node->children >= 0 )
+		);
+	}
+
+
+	/**
+	 * Test the children of a node of the wide BVH. The faces of hit leaves are
+	 * tested right away. Hit inner nodes are pushed on the stack, hit instance
+	 * nodes as (-1 - instance index).
+	 * @param {const Scene*}  scene
+	 * @param {ray4*}         ray
+	 * @param {const float3*} invDir
+	 * @param {const int}     index     Index of the node.
+	 * @param {int*}          stack
+	 * @param {int*}          stackSize
+	 */
+	void visitWideNode(
+		const Scene* scene, ray4* ray, const float3* invDir, const int index,
+		int* stack, int* stackSize
+	) {
+		const bvhNode node = scene->bvh[index];
+		floatW tNearW;
+		floatW tFarW;
+		const intW isHitW = intersectChildBoxes( ray, invDir, &node, &tNearW, &tFarW );
+
+		if( !any( isHitW ) ) {
+			return;
+		}
+
+		int isHit[BVH_WIDTH];
+		int children[BVH_WIDTH];
+		int numFaces[BVH_WIDTH];
+		float tNear[BVH_WIDTH];
+		float tFar[BVH_WIDTH];
+
+		vstoreW( isHitW, 0, isHit );
+		vstoreW( node.children, 0, children );
+		vstoreW( convert_intW( node.numFaces ), 0, numFaces );
+		vstoreW( tNearW, 0, tNear );
+		vstoreW( tFarW, 0, tFar );
+
+		// Backwards, so the first child is the next one taken from the stack.
+		for( int i = BVH_WIDTH - 1; i >= 0; i-- ) {
+			if( !isHit[i] ) {
+				continue;
+			}
+
+			// Leaf node. Test faces.
+			if( numFaces[i] > 0 ) {
+				float t = INFINITY;
+
+				for( int j = 0; j < numFaces[i]; j++ ) {
+					intersectFace( scene, ray, children[i] + j, &t, tNear[i], tFar[i] );
+				}
+			}
+			// Inner node.
+			else if( numFaces[i] == 0 ) {
+				stack[(*stackSize)++] = children[i];
+			}
+			// Instance node.
+			else {
+				stack[(*stackSize)++] = -1 - children[i];
+			}
+		}
+	}
+
+#endif
+
+
 /**
- * Test faces of the given node for intersections with the given ray.
- * @param {const Scene*}      scene
- * @param {ray4*}             ray
- * @param {const bvhNode*}    node
- * @param {const float tNear} tNear
- * @param {float tFar}        tFar
+ * Transform a ray into the space of an instanced object. Its direction
+ * is not normalized afterwards, so the distance <t> of a hit is the
+ * same in both spaces.
+ * @param  {const bvhInstance*} instance
+ * @param  {const ray4*}        ray
+ * @return {ray4}                        The ray in object space.
+ */
+ray4 toObjectSpace( const bvhInstance* instance, const ray4* ray ) {
+	ray4 objRay;
+	objRay.origin = (float3)(
+		dot( instance->invRow0.xyz, ray->origin ) + instance->invRow0.w,
+		dot( instance->invRow1.xyz, ray->origin ) + instance->invRow1.w,
+		dot( instance->invRow2.xyz, ray->origin ) + instance->invRow2.w
+	);
+	objRay.dir = (float3)(
+		dot( instance->invRow0.xyz, ray->dir ),
+		dot( instance->invRow1.xyz, ray->dir ),
+		dot( instance->invRow2.xyz, ray->dir )
+	);
+	objRay.normal = ray->normal;
+	objRay.t = ray->t;
+	objRay.hitFace = ray->hitFace;
+
+	return objRay;
+}
+
+
+/**
+ * Take over a closer hit found in the space of an instanced object.
+ * @param {const bvhInstance*} instance
+ * @param {const ray4*}        objRay   The ray in object space.
+ * @param {ray4*}              ray      The ray in world space.
  */
-void intersectFaces( const Scene* scene, ray4* ray, const bvhNode* node, const float tNear, float tFar ) {
-	float t = INFINITY;
+void takeObjectSpaceHit( const bvhInstance* instance, const ray4* objRay, ray4* ray ) {
+	if( objRay->t < ray->t ) {
+		// Normals are transformed with the transposed inverse.
+		ray->normal = fast_normalize(
+			instance->invRow0.xyz * objRay->normal.x +
+			instance->invRow1.xyz * objRay->normal.y +
+			instance->invRow2.xyz * objRay->normal.z
+		);
+		ray->hitFace = objRay->hitFace;
+		ray->t = objRay->t;
+	}
+}
+
+
+#if BVH_WIDTH == 2 && BVH_NEAR_FIRST == 0
+
+	/**
+	 * Traverse the tree of an instanced object in the space of the object.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 * @param {const int}    instanceIndex
+	 * @param {const bool}   isShadowRay   Stop at the first hit.
+	 */
+	void traverseInstance( const Scene* scene, ray4* ray, const int instanceIndex, const bool isShadowRay ) {
+		const bvhInstance instance = scene->instances[instanceIndex];
+		ray4 objRay = toObjectSpace( &instance, ray );
+
+		const float3 invDir = native_recip( objRay.dir );
+		int index = instance.nodes.x;
 
-	intersectFace( scene, ray, node->bbMin.w, &t, tNear, tFar );
+		do {
+			#if DEBUG_IMAGE == 1
+				scene->debugColor.y += 1.0f;
+			#endif
 
-	// Second face, if existing.
-	if( node->bbMax.w == -1 ) {
-		return;
+			const bvhNode node = scene->bvh[index];
+			const int faceIndex = as_int( node.bbMin.w );
+			int currentIndex = index;
+
+			// @see traverse() for an explanation.
+			index = ( faceIndex < 0 ) ? as_int( node.bbMax.w ) : currentIndex + 1;
+
+			float tNear = 0.0f;
+			float tFar = INFINITY;
+
+			bool isNodeHit = (
+				intersectBox( &objRay, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
+				tFar > EPSILON5 && objRay.t > tNear
+			);
+
+			#if BVH_PROFILE == 1
+				profileNode( scene, currentIndex, isNodeHit );
+			#endif
+
+			if( !isNodeHit ) {
+				continue;
+			}
+
+			index = currentIndex + 1;
+
+			// Node is leaf node. Test faces.
+			if( faceIndex >= 0 ) {
+				intersectFaces( scene, &objRay, &node, tNear, tFar );
+
+				if( isShadowRay && objRay.t < ray->t ) {
+					break;
+				}
+			}
+		} while( index > 0 && index < instance.nodes.y );
+
+		takeObjectSpaceHit( &instance, &objRay, ray );
 	}
 
-	intersectFace( scene, ray, node->bbMax.w, &t, tNear, tFar );
-}
+#elif BVH_WIDTH == 2
+
+	/**
+	 * Get the signs of the direction of the ray, one bit per axis.
+	 * @param  {const float3} dir Direction of the ray.
+	 * @return {int}              Bit <axis> is set, if the ray goes in negative direction.
+	 */
+	int getDirSigns( const float3 dir ) {
+		return ( dir.x < 0.0f ) | ( ( dir.y < 0.0f ) << 1 ) | ( ( dir.z < 0.0f ) << 2 );
+	}
+
+
+	/**
+	 * Get the child of an inner node, that is nearer to the ray origin
+	 * along the split axis, and push the other one on the stack.
+	 * @param  {const bvhNode*} node      Inner node.
+	 * @param  {const int}      index     Index of the node.
+	 * @param  {const int}      dirSigns  @see getDirSigns()
+	 * @param  {int*}           stack
+	 * @param  {int*}           stackSize
+	 * @return {int}                      Index of the nearer child node.
+	 */
+	int visitNearChild( const bvhNode* node, const int index, const int dirSigns, int* stack, int* stackSize ) {
+		// <node.bbMax.w>: right child << 3 | left child is upper << 2 | split axis
+		// The left child is always next in memory.
+		const int split = as_int( node->bbMax.w );
+		const int left = index + 1;
+		const int right = split >> 3;
+
+		// The lower child is nearer for rays going up the axis and vice versa.
+		const bool isLeftNear = ( ( dirSigns >> ( split & 3 ) ) & 1 ) == ( ( split >> 2 ) & 1 );
+
+		stack[(*stackSize)++] = isLeftNear ? right : left;
+
+		return isLeftNear ? left : right;
+	}
+
+
+	/**
+	 * Traverse the tree of an instanced object in the space of the object.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 * @param {const int}    instanceIndex
+	 * @param {const bool}   isShadowRay   Stop at the first hit.
+	 */
+	void traverseInstance( const Scene* scene, ray4* ray, const int instanceIndex, const bool isShadowRay ) {
+		const bvhInstance instance = scene->instances[instanceIndex];
+		ray4 objRay = toObjectSpace( &instance, ray );
+
+		const float3 invDir = native_recip( objRay.dir );
+		const int dirSigns = getDirSigns( objRay.dir );
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		int index = instance.nodes.x;
+
+		while( index >= 0 ) {
+			#if DEBUG_IMAGE == 1
+				scene->debugColor.y += 1.0f;
+			#endif
+
+			const bvhNode node = scene->bvh[index];
+			const int faceIndex = as_int( node.bbMin.w );
+
+			float tNear = 0.0f;
+			float tFar = INFINITY;
+
+			bool isNodeHit = (
+				intersectBox( &objRay, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
+				tFar > EPSILON5 && objRay.t > tNear
+			);
+
+			// Inner node. Continue with the nearer child.
+			if( isNodeHit && faceIndex == -1 ) {
+				index = visitNearChild( &node, index, dirSigns, stack, &stackSize );
+				continue;
+			}
+
+			// Leaf node. Test faces.
+			if( isNodeHit ) {
+				intersectFaces( scene, &objRay, &node, tNear, tFar );
+
+				if( isShadowRay && objRay.t < ray->t ) {
+					break;
+				}
+			}
+
+			index = ( stackSize > 0 ) ? stack[--stackSize] : -1;
+		}
+
+		takeObjectSpaceHit( &instance, &objRay, ray );
+	}
+
+#else
+
+	/**
+	 * Traverse the tree of an instanced object in the space of the object.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 * @param {const int}    instanceIndex
+	 * @param {const bool}   isShadowRay   Stop at the first hit.
+	 */
+	void traverseInstance( const Scene* scene, ray4* ray, const int instanceIndex, const bool isShadowRay ) {
+		const bvhInstance instance = scene->instances[instanceIndex];
+		ray4 objRay = toObjectSpace( &instance, ray );
+
+		const float3 invDir = native_recip( objRay.dir );
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 1;
+		stack[0] = instance.nodes.x;
+
+		do {
+			#if DEBUG_IMAGE == 1
+				scene->debugColor.y += 1.0f;
+			#endif
+
+			const int index = stack[--stackSize];
+			visitWideNode( scene, &objRay, &invDir, index, stack, &stackSize );
+
+			if( isShadowRay && objRay.t < ray->t ) {
+				break;
+			}
+		} while( stackSize > 0 );
+
+		takeObjectSpaceHit( &instance, &objRay, ray );
+	}
+
+#endif
 
 
 /**
@@ -74,104 +442,303 @@ void traverseLights( const Scene* scene, ray4* ray ) {
 }
 
 
-/**
- * Traverse the BVH without using a stack and test the faces against the given ray.
- * @param {const Scene*} scene
- * @param {ray4*}        ray
- */
-void traverse( const Scene* scene, ray4* ray ) {
-	const float3 invDir = native_recip( ray->dir );
-	int index = 1; // Skip the root node (0) and start with the left child node.
+#if BVH_WIDTH == 2 && BVH_NEAR_FIRST == 0
 
-	traverseLights( scene, ray );
+	/**
+	 * Traverse the BVH without using a stack and test the faces against the given ray.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 */
+	void traverse( const Scene* scene, ray4* ray ) {
+		const float3 invDir = native_recip( ray->dir );
+		int index = 1; // Skip the root node (0) and start with the left child node.
 
-	do {
-		scene->debugColor.y += 1.0f;
-		const bvhNode node = scene->bvh[index];
-		int currentIndex = index;
+		traverseLights( scene, ray );
 
-		// To save memory, we interpret <node.bbMax.w> depending on the situation:
-		// - For a leaf node <node.bbMax.w> is a face index.
-		// - Otherwise it is the index of the next node to visit.
-		// <node.bbMin.w> is used as face index, too. If it is -1.0f the node is NOT a leaf node.
-		//
-		// If a node has a left child, it will always be next in memory (index + 1).
-		// Also, if a node is a leaf node, the next node to visit (a right sibling or
-		// right child of a distinct parent) will also be next in memory (index + 1).
+		do {
+			#if DEBUG_IMAGE == 1
+				scene->debugColor.y += 1.0f;
+			#endif
 
-		index = ( node.bbMin.w <= -1.0f ) ? (int) node.bbMax.w : currentIndex + 1;
+			const bvhNode node = scene->bvh[index];
+			const int faceIndex = as_int( node.bbMin.w );
+			int currentIndex = index;
 
-		float tNear = 0.0f;
-		float tFar = INFINITY;
+			// To save memory, we interpret <node.bbMax.w> depending on the situation:
+			// - For a leaf node <node.bbMax.w> is the number of faces.
+			// - Otherwise it is the index of the next node to visit.
+			// <node.bbMin.w> is the index of the first face. If it is -1 the node is NOT a leaf node.
+			// Both are stored as the bits of an int, so indices above 2^24 stay exact.
+			//
+			// If a node has a left child, it will always be next in memory (index + 1).
+			// Also, if a node is a leaf node, the next node to visit (a right sibling or
+			// right child of a distinct parent) will also be next in memory (index + 1).
 
-		bool isNodeHit = (
-			intersectBox( ray, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
-			tFar > EPSILON5 && ray->t > tNear
-		);
+			index = ( faceIndex < 0 ) ? as_int( node.bbMax.w ) : currentIndex + 1;
 
-		if( !isNodeHit ) {
-			continue;
-		}
+			float tNear = 0.0f;
+			float tFar = INFINITY;
 
-		index = currentIndex + 1;
+			bool isNodeHit = (
+				intersectBox( ray, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
+				tFar > EPSILON5 && ray->t > tNear
+			);
 
-		// Node is leaf node. Test faces.
-		if( node.bbMin.w >= 0.0f ) {
-			intersectFaces( scene, ray, &node, tNear, tFar );
-		}
-	} while( index > 0 && index < BVH_NUM_NODES );
-}
+			#if BVH_PROFILE == 1
+				profileNode( scene, currentIndex, isNodeHit );
+			#endif
 
+			if( !isNodeHit ) {
+				continue;
+			}
 
-/**
- * Traverse the BVH and test the faces against the given ray.
- * This version is for the shadow ray test, so it only checks IF there
- * is an intersection and terminates on the first hit.
- * @param {const Scene*} scene
- * @param {ray4*}        ray
- */
-void traverseShadows( const Scene* scene, ray4* ray ) {
-	float tLight = ray->t;
-	const float3 invDir = native_recip( ray->dir );
-	int index = 1;
+			index = currentIndex + 1;
 
-	traverseLights( scene, ray );
+			// Node is leaf node. Test faces.
+			if( faceIndex >= 0 ) {
+				intersectFaces( scene, ray, &node, tNear, tFar );
+			}
+			// Node is instance node. Test the tree of the object.
+			else if( faceIndex <= -2 ) {
+				traverseInstance( scene, ray, -2 - faceIndex, false );
+			}
+		} while( index > 0 && index < BVH_NUM_NODES );
+	}
 
-	do {
-		const bvhNode node = scene->bvh[index];
-		int currentIndex = index;
 
-		// @see traverse() for an explanation.
-		index = ( node.bbMin.w <= -1.0f ) ? (int) node.bbMax.w : currentIndex + 1;
+	/**
+	 * Traverse the BVH and test the faces against the given ray.
+	 * This version is for the shadow ray test, so it only checks IF there
+	 * is an intersection and terminates on the first hit.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 */
+	void traverseShadows( const Scene* scene, ray4* ray ) {
+		float tLight = ray->t;
+		const float3 invDir = native_recip( ray->dir );
+		int index = 1;
 
-		float tNear = 0.0f;
-		float tFar = INFINITY;
+		traverseLights( scene, ray );
 
-		bool isNodeHit = (
-			intersectBox( ray, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
-			tFar > EPSILON5
-		);
+		do {
+			const bvhNode node = scene->bvh[index];
+			const int faceIndex = as_int( node.bbMin.w );
+			int currentIndex = index;
 
-		if( !isNodeHit ) {
-			continue;
-		}
+			// @see traverse() for an explanation.
+			index = ( faceIndex < 0 ) ? as_int( node.bbMax.w ) : currentIndex + 1;
 
-		index = currentIndex + 1;
+			float tNear = 0.0f;
+			float tFar = INFINITY;
+
+			bool isNodeHit = (
+				intersectBox( ray, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
+				tFar > EPSILON5
+			);
+
+			#if BVH_PROFILE == 1
+				profileNode( scene, currentIndex, isNodeHit );
+			#endif
+
+			if( !isNodeHit ) {
+				continue;
+			}
+
+			index = currentIndex + 1;
+
+			// Node is leaf node. Test faces.
+			if( faceIndex >= 0 ) {
+				intersectFaces( scene, ray, &node, tNear, tFar );
+
+				// It's enough to know that something blocks the way. It doesn't matter what or where.
+				// TODO: It *does* matter what and where, if the material has transparency.
+				if( ray->t < tLight ) {
+					break;
+				}
+			}
+			// Node is instance node. Test the tree of the object.
+			else if( faceIndex <= -2 ) {
+				traverseInstance( scene, ray, -2 - faceIndex, true );
 
-		// Skip the next left child node.
-		if( node.bbMin.w == -2.0f ) {
-			index++;
+				if( ray->t < tLight ) {
+					break;
+				}
+			}
+		} while( index > 0 && index < BVH_NUM_NODES );
+	}
+
+#elif BVH_WIDTH == 2
+
+	/**
+	 * Traverse the BVH with a short stack, visiting the nearer child node
+	 * first, and test the faces against the given ray. Nodes behind a hit
+	 * are culled by the box test.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 */
+	void traverse( const Scene* scene, ray4* ray ) {
+		const float3 invDir = native_recip( ray->dir );
+		const int dirSigns = getDirSigns( ray->dir );
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		int index = 0;
+
+		traverseLights( scene, ray );
+
+		while( index >= 0 ) {
+			#if DEBUG_IMAGE == 1
+				scene->debugColor.y += 1.0f;
+			#endif
+
+			const bvhNode node = scene->bvh[index];
+			const int faceIndex = as_int( node.bbMin.w );
+
+			float tNear = 0.0f;
+			float tFar = INFINITY;
+
+			bool isNodeHit = (
+				intersectBox( ray, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
+				tFar > EPSILON5 && ray->t > tNear
+			);
+
+			// Inner node. Continue with the nearer child.
+			if( isNodeHit && faceIndex == -1 ) {
+				index = visitNearChild( &node, index, dirSigns, stack, &stackSize );
+				continue;
+			}
+
+			// Leaf node. Test faces.
+			if( isNodeHit && faceIndex >= 0 ) {
+				intersectFaces( scene, ray, &node, tNear, tFar );
+			}
+			// Instance node. Test the tree of the object.
+			else if( isNodeHit ) {
+				traverseInstance( scene, ray, -2 - faceIndex, false );
+			}
+
+			index = ( stackSize > 0 ) ? stack[--stackSize] : -1;
 		}
+	}
 
-		// Node is leaf node. Test faces.
-		if( node.bbMin.w >= 0.0f ) {
-			intersectFaces( scene, ray, &node, tNear, tFar );
+
+	/**
+	 * Traverse the BVH with a short stack and test the faces against the given ray.
+	 * This version is for the shadow ray test, so it only checks IF there
+	 * is an intersection and terminates on the first hit.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 */
+	void traverseShadows( const Scene* scene, ray4* ray ) {
+		float tLight = ray->t;
+		const float3 invDir = native_recip( ray->dir );
+		const int dirSigns = getDirSigns( ray->dir );
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		int index = 0;
+
+		traverseLights( scene, ray );
+
+		while( index >= 0 ) {
+			const bvhNode node = scene->bvh[index];
+			const int faceIndex = as_int( node.bbMin.w );
+
+			float tNear = 0.0f;
+			float tFar = INFINITY;
+
+			bool isNodeHit = (
+				intersectBox( ray, &invDir, node.bbMin, node.bbMax, &tNear, &tFar ) &&
+				tFar > EPSILON5
+			);
+
+			// Inner node. Continue with the nearer child.
+			if( isNodeHit && faceIndex == -1 ) {
+				index = visitNearChild( &node, index, dirSigns, stack, &stackSize );
+				continue;
+			}
+
+			// Leaf node. Test faces.
+			if( isNodeHit && faceIndex >= 0 ) {
+				intersectFaces( scene, ray, &node, tNear, tFar );
+			}
+			// Instance node. Test the tree of the object.
+			else if( isNodeHit ) {
+				traverseInstance( scene, ray, -2 - faceIndex, true );
+			}
 
 			// It's enough to know that something blocks the way. It doesn't matter what or where.
-			// TODO: It *does* matter what and where, if the material has transparency.
 			if( ray->t < tLight ) {
 				break;
 			}
+
+			index = ( stackSize > 0 ) ? stack[--stackSize] : -1;
 		}
-	} while( index > 0 && index < BVH_NUM_NODES );
-}
+	}
+
+#else
+
+	/**
+	 * Traverse the wide BVH with a stack and test the faces against the given ray.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 */
+	void traverse( const Scene* scene, ray4* ray ) {
+		const float3 invDir = native_recip( ray->dir );
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 1;
+		stack[0] = 0;
+
+		traverseLights( scene, ray );
+
+		do {
+			#if DEBUG_IMAGE == 1
+				scene->debugColor.y += 1.0f;
+			#endif
+
+			const int index = stack[--stackSize];
+
+			// Instance node. Test the tree of the object.
+			if( index < 0 ) {
+				traverseInstance( scene, ray, -1 - index, false );
+			}
+			else {
+				visitWideNode( scene, ray, &invDir, index, stack, &stackSize );
+			}
+		} while( stackSize > 0 );
+	}
+
+
+	/**
+	 * Traverse the wide BVH and test the faces against the given ray.
+	 * This version is for the shadow ray test, so it only checks IF there
+	 * is an intersection and terminates on the first hit.
+	 * @param {const Scene*} scene
+	 * @param {ray4*}        ray
+	 */
+	void traverseShadows( const Scene* scene, ray4* ray ) {
+		float tLight = ray->t;
+		const float3 invDir = native_recip( ray->dir );
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 1;
+		stack[0] = 0;
+
+		traverseLights( scene, ray );
+
+		do {
+			const int index = stack[--stackSize];
+
+			// Instance node. Test the tree of the object.
+			if( index < 0 ) {
+				traverseInstance( scene, ray, -1 - index, true );
+			}
+			else {
+				visitWideNode( scene, ray, &invDir, index, stack, &stackSize );
+			}
+
+			// It's enough to know that something blocks the way. It doesn't matter what or where.
+			if( ray->t < tLight ) {
+				break;
+			}
+		} while( stackSize > 0 );
+	}
+
+#endif
@@ -1,8 +1,16 @@
 #define ACCEL_STRUCT #ACCEL_STRUCT#
 #define ANTI_ALIASING #ANTI_ALIASING#
 #define BRDF #BRDF#
+#define BVH_NEAR_FIRST #BVH_NEAR_FIRST#
 #define BVH_NUM_NODES #BVH_NUM_NODES#
+#define BVH_PROFILE #BVH_PROFILE#
+#define BVH_QUANTIZE #BVH_QUANTIZE#
+#define BVH_STACK_SIZE #BVH_STACK_SIZE#
 #define BVH_TEX_DIM #BVH_TEX_DIM#
+#define BVH_WIDTH #BVH_WIDTH#
+#define DEBUG_IMAGE #DEBUG_IMAGE#
+#define DEBUG_NUM_FACES #DEBUG_NUM_FACES#
+#define DEBUG_NUM_NODES #DEBUG_NUM_NODES#
 #define EPSILON5 0.00001f
 #define EPSILON7 0.0000001f
 #define EPSILON10 0.0000000001f
@@ -12,12 +20,14 @@
 #define MAX_DEPTH #MAX_DEPTH#
 #define NI_AIR 1.00028f
 #define NUM_LIGHTS #NUM_LIGHTS#
+#define PATH_REGENERATION #PATH_REGENERATION#
 #define PHONGTESS #PHONGTESS#
 #define PHONGTESS_ALPHA #PHONGTESS_ALPHA#
 #define PI_X2 6.28318530718f
 #define SAMPLES #SAMPLES#
 #define SHADOW_RAYS #SHADOW_RAYS#
 #define SKY_LIGHT #SKY_LIGHT#
+#define WAVEFRONT #WAVEFRONT#
 
 
 // Only used inside kernel.
@@ -52,6 +62,13 @@ typedef struct {
 	uint4 normals;
 } face_t;
 
+// Flat triangle for the intersection test, in the same order as the faces.
+typedef struct {
+	float4 a;     // w: x of the normal
+	float4 edge1; // b - a, w: y of the normal
+	float4 edge2; // c - a, w: z of the normal
+} tri_t;
+
 typedef struct {
 	float4 pos;
 	float4 rgb;
@@ -62,19 +79,100 @@ typedef struct {
 // BVH
 #if ACCEL_STRUCT == 0
 
+	#if BVH_WIDTH == 2
+
+		// The w components hold the bits of an int, read them with as_int().
+		typedef struct {
+			float4 bbMin; // w: face index, -1 for inner nodes, -2 - instance index for instance nodes
+			float4 bbMax; // w: number of faces for leaf nodes, otherwise the next node to visit
+		} bvhNode;
+
+	#else
+
+		#if BVH_WIDTH == 4
+			typedef float4 floatW;
+			typedef int4 intW;
+			typedef char4 charW;
+			typedef uchar4 ucharW;
+			typedef ushort4 ushortW;
+			#define convert_floatW convert_float4
+			#define convert_intW convert_int4
+			#define vstoreW vstore4
+		#else
+			typedef float8 floatW;
+			typedef int8 intW;
+			typedef char8 charW;
+			typedef uchar8 ucharW;
+			typedef ushort8 ushortW;
+			#define convert_floatW convert_float8
+			#define convert_intW convert_int8
+			#define vstoreW vstore8
+		#endif
+
+		#if BVH_QUANTIZE == 0
+
+			// The boxes of all children are stored per axis,
+			// so they can be tested at once.
+			typedef struct {
+				floatW bbMinX;
+				floatW bbMinY;
+				floatW bbMinZ;
+				floatW bbMaxX;
+				floatW bbMaxY;
+				floatW bbMaxZ;
+				intW children; // Node index, first face index or instance index. -1 for empty slots.
+				intW numFaces; // 0 for inner nodes, -1 for instance nodes
+			} bvhNode;
+
+		#else
+
+			#if BVH_QUANTIZE == 8
+				typedef ucharW quantW;
+			#else
+				typedef ushortW quantW;
+			#endif
+
+			// The boxes of all children are stored per axis
+			// as steps of <scale> from <origin>.
+			typedef struct {
+				intW children; // Node index, first face index or instance index. -1 for empty slots.
+				float4 origin;
+				float4 scale;
+				quantW bbMinX;
+				quantW bbMinY;
+				quantW bbMinZ;
+				quantW bbMaxX;
+				quantW bbMaxY;
+				quantW bbMaxZ;
+				charW numFaces; // 0 for inner nodes, -1 for instance nodes
+			} bvhNode;
+
+		#endif
+
+	#endif
+
 	typedef struct {
-		float4 bbMin; // w: face index
-		float4 bbMax; // w: face index or next node to visit
-	} bvhNode;
+		float4 invRow0; // Rows of the inverse transformation (world to object)
+		float4 invRow1;
+		float4 invRow2;
+		int4 nodes; // x: root node of the object, y: node after the last one of the object (binary BVH only)
+	} bvhInstance;
 
 	typedef struct {
 		global const bvhNode* bvh;
+		global const bvhInstance* instances;
 		global const light_t* lights;
 		global const uint4* facesV;
 		global const uint4* facesN;
+		global const tri_t* tris;
 		global const float4* vertices;
 		global const float4* normals;
-		float4 debugColor;
+		#if BVH_PROFILE == 1
+			global uint* bvhProfile; // Per node: box tests, hits
+		#endif
+		#if DEBUG_IMAGE == 1
+			float4 debugColor; // x: tested faces, y: visited nodes
+		#endif
 	} Scene;
 
 #endif
@@ -109,3 +207,32 @@ typedef struct {
 	} material;
 
 #endif
+
+
+// Wavefront
+#if WAVEFRONT == 1
+
+	// State of the path of a pixel between the kernels.
+	typedef struct {
+		ray4 ray;
+		float4 color;      // Color of the current path
+		float4 finalColor; // Sum of all paths of the pixel
+		#if DEBUG_IMAGE == 1
+			float4 debugColor;
+		#endif
+		float2 prevFocus;  // x: tObject, y: tFocus
+		float seed;
+		float focus;
+		uint secondaryPaths;
+		uint sample;
+		uint depth;
+		int depthAdded;
+	} pathState;
+
+	typedef struct {
+		float4 origin; // w: distance to the light
+		float4 dir;    // w: index of the path (bits of a uint)
+		float4 color;  // Added to the path if the light is not blocked
+	} shadowRay;
+
+#endif
@@ -80,24 +80,18 @@ const bool intersectSphere(
 /**
  * Find intersection of a triangle and a ray. (No tessellation.)
  * After Möller and Trumbore.
- * @param  {const float3}         a
- * @param  {const float3}         b
- * @param  {const float3}         c
- * @param  {const uint4}          fn
- * @param  {global const float4*} normals
- * @param  {const ray4*}          ray
- * @param  {float*}               t
+ * @param  {const tri_t*} tri   The triangle with its precomputed edges and normal.
+ * @param  {const ray4*}  ray
+ * @param  {float*}       t
+ * @param  {const float}  tNear
  * @return {float3}
  */
-float3 flatTriAndRayIntersect(
-	const float3 a, const float3 b, const float3 c,
-	const ray4* ray, float* t, const float tNear
-) {
+float3 flatTriAndRayIntersect( const tri_t* tri, const ray4* ray, float* t, const float tNear ) {
 	const float f = fmax( 0.0f, tNear - 0.001f );
 	const float3 closeOrigin = fma( ray->dir, f, ray->origin );
-	const float3 edge1 = b - a;
-	const float3 edge2 = c - a;
-	const float3 tVec = closeOrigin - a;
+	const float3 edge1 = tri->edge1.xyz;
+	const float3 edge2 = tri->edge2.xyz;
+	const float3 tVec = closeOrigin - tri->a.xyz;
 	const float3 pVec = cross( ray->dir, edge2 );
 	const float3 qVec = cross( tVec, edge1 );
 	const float invDet = native_recip( dot( edge1, pVec ) );
@@ -119,18 +113,13 @@ float3 flatTriAndRayIntersect(
 
 	*t += f;
 
-	return fast_normalize( cross( edge1, edge2 ) );
-
-	// const float3 an = normals[fn.x].xyz;
-	// const float3 bn = normals[fn.y].xyz;
-	// const float3 cn = normals[fn.z].xyz;
-
-	// return getTriangleNormal( an, bn, cn, 1.0f - u - v, u, v );
+	return (float3)( tri->a.w, tri->edge1.w, tri->edge2.w );
 }
 
 
 /**
  * Face intersection test after Möller and Trumbore.
+ * Flat faces only read their triangle record.
  * @param  {const Scene*} scene
  * @param  {const ray4*}  ray
  * @param  {const int}    fIndex
@@ -143,10 +132,7 @@ float3 checkFaceIntersection(
 	const Scene* scene, const ray4* ray, const int fIndex, float* t,
 	const float tNear, const float tFar
 ) {
-	const uint4 fv = scene->facesV[fIndex];
-	const float3 a = scene->vertices[fv.x].xyz;
-	const float3 b = scene->vertices[fv.y].xyz;
-	const float3 c = scene->vertices[fv.z].xyz;
+	const tri_t tri = scene->tris[fIndex];
 
 	#if PHONGTESS == 1
 
@@ -162,7 +148,7 @@ float3 checkFaceIntersection(
 	#endif
 
 	{
-		return flatTriAndRayIntersect( a, b, c, ray, t, tNear );
+		return flatTriAndRayIntersect( &tri, ray, t, tNear );
 	}
 
 
@@ -170,6 +156,11 @@ float3 checkFaceIntersection(
 	// Based on: "Direct Ray Tracing of Phong Tessellation" by Shinji Ogaki, Yusuke Tokuyoshi
 	#if PHONGTESS == 1
 
+		const uint4 fv = scene->facesV[fIndex];
+		const float3 a = scene->vertices[fv.x].xyz;
+		const float3 b = scene->vertices[fv.y].xyz;
+		const float3 c = scene->vertices[fv.z].xyz;
+
 		return phongTessTriAndRayIntersect( a, b, c, an, bn, cn, ray, t, tNear, tFar );
 
 	#endif
@@ -0,0 +1,366 @@
+/**
+ * Get the index of the path of a pixel.
+ * @param  {const int2} pos Position of the pixel.
+ * @return {uint}           Index of the path.
+ */
+inline uint getPathIndex( const int2 pos ) {
+	return pos.y * IMG_WIDTH + pos.x;
+}
+
+
+/**
+ * Get the pixel of a path.
+ * @param  {const uint} index Index of the path.
+ * @return {int2}             Position of the pixel.
+ */
+inline int2 getPathPixel( const uint index ) {
+	return (int2)( index % IMG_WIDTH, index / IMG_WIDTH );
+}
+
+
+
+/**
+ * KERNEL.
+ * Start the paths of all pixels with their first camera ray.
+ */
+kernel void generatePaths(
+	float seed,
+	const float pxDim,
+	const camera cam,
+	read_only image2d_t imageIn,
+
+	global pathState* paths,
+	global uint* queue,
+	global uint* counters
+) {
+	const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
+	const uint index = getPathIndex( pos );
+
+	// Rays in the current queue, rays in the next queue, shadow rays
+	if( index == 0 ) {
+		counters[0] = IMG_WIDTH * IMG_HEIGHT;
+		counters[1] = 0;
+		counters[2] = 0;
+	}
+
+	pathState path;
+	path.color = (float4)( 1.0f );
+	path.finalColor = (float4)( 0.0f );
+	path.prevFocus = (float2)( -1.0f, -1.0f );
+	path.focus = 0.0f;
+	path.secondaryPaths = 1; // Start at 1 instead of 0, because we are going to divide through it.
+	path.sample = 0;
+	path.depth = 0;
+	path.depthAdded = 0;
+
+	#if DEBUG_IMAGE == 1
+		path.debugColor = (float4)( 0.0f );
+	#endif
+
+	if( cam.focusPoint.x >= 0 && cam.focusPoint.y >= 0 ) {
+		path.prevFocus = getPreviousFocus( cam, pos, imageIn );
+	}
+
+	path.ray = initRay( pxDim, cam, pos, &seed, path.prevFocus.y, path.prevFocus.x );
+	path.seed = seed;
+
+	paths[index] = path;
+	queue[index] = index;
+}
+
+
+/**
+ * KERNEL.
+ * Find the closest hit of each ray in the queue.
+ */
+kernel void extendPaths(
+	global const uint* queue,
+	global const uint* counters,
+	global pathState* paths,
+
+	global const bvhNode* bvh,
+	global const bvhInstance* instances,
+	#if BVH_PROFILE == 1
+		global uint* bvhProfile,
+	#endif
+	global const uint4* facesV,
+	global const uint4* facesN,
+	global const tri_t* tris,
+	global const float4* vertices,
+	global const float4* normals,
+	global const material* materials,
+	global const light_t* lights
+) {
+	const uint i = get_global_id( 0 );
+
+	if( i >= counters[0] ) {
+		return;
+	}
+
+	const uint index = queue[i];
+	Scene scene = { bvh, instances, lights, facesV, facesN, tris, vertices, normals };
+
+	#if BVH_PROFILE == 1
+		scene.bvhProfile = bvhProfile;
+	#endif
+
+	#if DEBUG_IMAGE == 1
+		scene.debugColor = paths[index].debugColor;
+	#endif
+
+	ray4 ray = paths[index].ray;
+	traverse( &scene, &ray );
+
+	paths[index].ray = ray;
+
+	#if DEBUG_IMAGE == 1
+		paths[index].debugColor = scene.debugColor;
+	#endif
+}
+
+
+/**
+ * KERNEL.
+ * Shade the hits of the extended rays. Rays of paths that go on are added to
+ * the next queue, finished paths start their next sample. Shadow rays are only
+ * generated here and traced by traceShadowRays().
+ */
+kernel void shadePaths(
+	const float pxDim,
+	const camera cam,
+
+	global const uint* queueIn,
+	global uint* queueOut,
+	global uint* counters,
+	global pathState* paths,
+	global shadowRay* shadowRays,
+
+	global const bvhNode* bvh,
+	global const bvhInstance* instances,
+	#if BVH_PROFILE == 1
+		global uint* bvhProfile,
+	#endif
+	global const uint4* facesV,
+	global const uint4* facesN,
+	global const tri_t* tris,
+	global const float4* vertices,
+	global const float4* normals,
+	global const material* materials,
+	global const light_t* lights
+) {
+	const uint i = get_global_id( 0 );
+
+	if( i >= counters[0] ) {
+		return;
+	}
+
+	const uint index = queueIn[i];
+	pathState path = paths[index];
+	ray4 ray = path.ray;
+
+	float4 light = (float4)( -1.0f );
+	bool pathEnds = true;
+
+	path.focus = ( path.sample + path.depth == 0 ) ? ray.t : path.focus;
+
+	if( ray.t == INFINITY ) {
+		light = ( ray.hitFace < 0 ) ? (float4)( lights[-( ray.hitFace + 1 )].rgb ) : SKY_LIGHT;
+	}
+	else {
+		material mtl = materials[facesV[ray.hitFace].w];
+
+		// Last round, no need to calculate a new ray.
+		// Unless we hit a material that extends the path.
+		bool addDepth = extendDepth( &mtl, &path.seed );
+
+		if( !( mtl.data.s0 == 1.0f && !addDepth && path.depth == MAX_DEPTH + path.depthAdded - 1 ) ) {
+			path.seed += ray.t;
+
+			ray4 lightRay;
+			lightRay.t = INFINITY;
+			bool hasShadowRay = false;
+
+			#if SHADOW_RAYS == 1 && NUM_LIGHTS > 0
+				if( mtl.data.s0 > 0.0f ) {
+					initShadowRay( &lights[0], &ray, &lightRay );
+					hasShadowRay = true;
+				}
+			#endif
+
+			// New direction of the ray (bouncing of the hit surface)
+			ray4 newRay = getNewRay( &ray, &mtl, &path.seed, &addDepth );
+
+			// Flip the normal if it points in the wrong direction.
+			// Do it only now, becuause we still need the original face normal
+			// for the refraction calculation.
+			if( dot( ray.normal, -ray.dir ) <= 0.0f ) {
+				ray.normal = -ray.normal;
+			}
+
+			// The color the light adds, if traceShadowRays() finds nothing in between.
+			float4 shadowColor;
+
+			if(
+				hasShadowRay &&
+				getShadowRayColor( &ray, &mtl, &lightRay, lights[0].rgb, &path.color, &shadowColor )
+			) {
+				shadowRay sr;
+				sr.origin = (float4)( lightRay.origin, lightRay.t );
+				sr.dir = (float4)( lightRay.dir, as_float( index ) );
+				sr.color = shadowColor;
+
+				shadowRays[atomic_inc( &counters[2] )] = sr;
+			}
+
+			updateColor(
+				&ray, &newRay, &mtl, &lightRay, (float4)( -1.0f ), &path.secondaryPaths,
+				&path.color, &path.finalColor
+			);
+
+			// Extend max path depth
+			path.depthAdded += ( addDepth && path.depthAdded < MAX_ADDED_DEPTH );
+
+			// Russian roulette termination
+			float maxValColor = fmax( path.color.x, fmax( path.color.y, path.color.z ) );
+
+			if( !russianRoulette( path.depth, path.depthAdded, maxValColor, &path.seed ) ) {
+				ray = newRay;
+				path.depth++;
+				pathEnds = ( path.depth >= MAX_DEPTH + path.depthAdded );
+			}
+		}
+	}
+
+	if( pathEnds ) {
+		if( light.x > -1.0f ) {
+			path.color *= light;
+			path.finalColor += path.color;
+		}
+
+		path.sample++;
+
+		if( path.sample < SAMPLES ) {
+			path.color = (float4)( 1.0f );
+			path.depth = 0;
+			path.depthAdded = 0;
+			ray = initRay( pxDim, cam, getPathPixel( index ), &path.seed, path.prevFocus.y, path.prevFocus.x );
+			pathEnds = false;
+		}
+	}
+
+	if( !pathEnds ) {
+		queueOut[atomic_inc( &counters[1] )] = index;
+	}
+
+	path.ray = ray;
+	paths[index] = path;
+}
+
+
+/**
+ * KERNEL.
+ * Test the shadow rays generated by shadePaths() and
+ * add the light to the paths that can see it.
+ */
+kernel void traceShadowRays(
+	global const uint* counters,
+	global const shadowRay* shadowRays,
+	global pathState* paths,
+
+	global const bvhNode* bvh,
+	global const bvhInstance* instances,
+	#if BVH_PROFILE == 1
+		global uint* bvhProfile,
+	#endif
+	global const uint4* facesV,
+	global const uint4* facesN,
+	global const tri_t* tris,
+	global const float4* vertices,
+	global const float4* normals,
+	global const material* materials,
+	global const light_t* lights
+) {
+	const uint i = get_global_id( 0 );
+
+	if( i >= counters[2] ) {
+		return;
+	}
+
+	const shadowRay sr = shadowRays[i];
+	const uint index = as_uint( sr.dir.w );
+	Scene scene = { bvh, instances, lights, facesV, facesN, tris, vertices, normals };
+
+	#if BVH_PROFILE == 1
+		scene.bvhProfile = bvhProfile;
+	#endif
+
+	#if DEBUG_IMAGE == 1
+		scene.debugColor = paths[index].debugColor;
+	#endif
+
+	ray4 lightRay;
+	lightRay.origin = sr.origin.xyz;
+	lightRay.dir = sr.dir.xyz;
+	lightRay.t = sr.origin.w;
+
+	traverseShadows( &scene, &lightRay );
+
+	// Each path has at most one shadow ray per round.
+	if( lightRay.t >= sr.origin.w ) {
+		paths[index].finalColor += sr.color;
+		paths[index].secondaryPaths += 1;
+	}
+
+	#if DEBUG_IMAGE == 1
+		paths[index].debugColor = scene.debugColor;
+	#endif
+}
+
+
+/**
+ * KERNEL.
+ * Make the next queue the current one for the following round.
+ * The host swaps the queue buffers, this only moves the counters,
+ * so the rounds can be enqueued without reading them back.
+ */
+kernel void swapQueues( global uint* counters ) {
+	if( get_global_id( 0 ) > 0 ) {
+		return;
+	}
+
+	counters[0] = counters[1];
+	counters[1] = 0;
+	counters[2] = 0;
+}
+
+
+/**
+ * KERNEL.
+ * Write the colors of the finished paths to the image.
+ */
+kernel void accumulatePaths(
+	const float pixelWeight,
+	global const pathState* paths,
+
+	read_only image2d_t imageIn,
+	write_only image2d_t imageOut
+
+	#if DEBUG_IMAGE == 1
+		, write_only image2d_t imageDebug
+	#endif
+) {
+	const int2 pos = { get_global_id( 0 ), get_global_id( 1 ) };
+	const pathState path = paths[getPathIndex( pos )];
+
+	float4 finalColor = path.finalColor / (float) path.secondaryPaths;
+
+	#if SAMPLES > 1
+		finalColor /= (float) SAMPLES;
+	#endif
+
+	setColors( imageIn, imageOut, pixelWeight, finalColor, path.focus );
+
+	#if DEBUG_IMAGE == 1
+		writeDebugImage( imageDebug, path.debugColor );
+	#endif
+}
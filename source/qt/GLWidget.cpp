@@ -15,17 +15,21 @@ GLWidget::GLWidget( QWidget* parent ) : QGLWidget( parent ) {
 
 	mDoRendering = false;
 	mFrameCount = 0;
+	mPreviousReadback = 0;
 	mPreviousTime = 0;
 
 	mMoveLight = false;
+	mMoveObject = false;
+	mSelectedObject = 0;
 	mViewBVH = false;
 	mViewDebug = false;
 	mViewLights = false;
 	mViewOverlay = false;
 	mViewTracer = true;
 
+	mAccelStruct = NULL;
 	mInfoWindow = NULL;
-	mPathTracer = new PathTracer( this );
+	mPathTracer = new PathTracer();
 	mCamera = new Camera( this );
 	mTimer = new QTimer( this );
 
@@ -167,6 +171,12 @@ void GLWidget::deleteOldModel() {
 			texIter++;
 		}
 	}
+
+	// Kept by the path tracer for updating transformed objects.
+	if( mAccelStruct != NULL ) {
+		delete mAccelStruct;
+		mAccelStruct = NULL;
+	}
 }
 
 
@@ -339,6 +349,7 @@ bool GLWidget::isRendering() {
 void GLWidget::loadModel( string filepath, string filename ) {
 	this->destroyKernelWindow();
 	this->deleteOldModel();
+	mSelectedObject = 0;
 
 	ModelLoader* ml = new ModelLoader();
 	ml->loadModel( filepath, filename );
@@ -350,16 +361,20 @@ void GLWidget::loadModel( string filepath, string filename ) {
 	mVertices = op->getVertices();
 
 	const short usedAccelStruct = Cfg::get().value<short>( Cfg::ACCEL_STRUCT );
-	AccelStructure* accelStruct;
+	const bool isCached = mPathTracer->loadBVHCache( filepath, filename );
 
-	if( usedAccelStruct == ACCELSTRUCT_BVH ) {
-		accelStruct = new BVH( op->getObjects(), mVertices, mNormals );
+	if( usedAccelStruct == ACCELSTRUCT_BVH && !isCached ) {
+		mAccelStruct = new BVH( op->getObjects(), mVertices, mNormals, op->getInstances() );
 	}
 
-	// Visualization of the acceleration structure
+	// Visualization of the acceleration structure.
+	// Not available for a cached BVH.
 	vector<GLfloat> visVertices;
 	vector<GLuint> visIndices;
-	accelStruct->visualize( &visVertices, &visIndices );
+
+	if( mAccelStruct != NULL ) {
+		mAccelStruct->visualize( &visVertices, &visIndices );
+	}
 	mAccelStructNumIndices = visIndices.size();
 
 	// Visualization of the light positions
@@ -376,10 +391,10 @@ void GLWidget::loadModel( string filepath, string filename ) {
 	this->initShaders();
 
 	// OpenCL buffers
-	mPathTracer->initOpenCLBuffers( mVertices, mFaces, mNormals, ml, accelStruct );
+	mPathTracer->initOpenCLBuffers( mVertices, mFaces, mNormals, ml, mAccelStruct );
+	this->createKernelWindow( mPathTracer->getCL() );
 
 	delete ml;
-	delete accelStruct;
 
 	// Ready
 	this->startRendering();
@@ -441,9 +456,11 @@ void GLWidget::modifyCameraStep( const float adjust ) {
 void GLWidget::mousePressEvent( QMouseEvent* e ) {
 	if( e->buttons() == Qt::RightButton ) {
 		mPathTracer->setFocus( e->x(), e->y() );
+		this->resetRenderTime();
 	}
 	else if( e->buttons() == Qt::MidButton ) {
 		mPathTracer->setFocus( -1, -1 );
+		this->resetRenderTime();
 	}
 
 	e->ignore();
@@ -459,6 +476,11 @@ void GLWidget::moveCamera( const int key ) {
 		return;
 	}
 
+	if( mMoveObject ) {
+		this->moveObject( key );
+		return;
+	}
+
 	if( mMoveLight ) {
 		mPathTracer->moveSun( key );
 		return;
@@ -498,6 +520,65 @@ void GLWidget::moveCamera( const int key ) {
 }
 
 
+/**
+ * Move the selected object. The object is translated along the
+ * world axes by the camera step or, with R, rotated around the Y axis
+ * through its center.
+ * @param {const int} key Key code.
+ */
+void GLWidget::moveObject( const int key ) {
+	glm::vec3 translation( 0.0f );
+	glm::vec3 center;
+	glm::mat4 transform;
+	float step = mCamera->getSpeed();
+
+	switch( key ) {
+
+		case Qt::Key_W:
+			translation[2] = -step;
+			break;
+
+		case Qt::Key_S:
+			translation[2] = step;
+			break;
+
+		case Qt::Key_A:
+			translation[0] = -step;
+			break;
+
+		case Qt::Key_D:
+			translation[0] = step;
+			break;
+
+		case Qt::Key_Q:
+			translation[1] = step;
+			break;
+
+		case Qt::Key_E:
+			translation[1] = -step;
+			break;
+
+		case Qt::Key_R:
+			// Rotate in place around the center of the object, not the origin.
+			center = mPathTracer->getObjectCenter( mSelectedObject );
+			transform = glm::translate( glm::mat4( 1.0f ), center );
+			transform = glm::rotate( transform, MathHelp::degToRad( 15.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+			transform = glm::translate( transform, -center );
+
+			mPathTracer->transformObject( mSelectedObject, transform );
+			this->resetRenderTime();
+			return;
+
+		default:
+			return;
+
+	}
+
+	mPathTracer->transformObject( mSelectedObject, glm::translate( glm::mat4( 1.0f ), translation ) );
+	this->resetRenderTime();
+}
+
+
 /**
  * Draw the scene.
  */
@@ -509,7 +590,24 @@ void GLWidget::paintGL() {
 	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
 	if( mViewTracer ) {
-		mTextureOut = mPathTracer->generateImage( &mTextureDebug );
+		mPathTracer->generateImage();
+
+		// The image is accumulated on the device. Only get it
+		// from there as often as the display needs it.
+		GLuint currentTime = glutGet( GLUT_ELAPSED_TIME );
+
+		if( currentTime - mPreviousReadback >= Cfg::get().value<GLuint>( Cfg::RENDER_READBACKINTERVAL ) ) {
+			// The debug view waits for the current frame,
+			// otherwise the image is one readback behind.
+			if( mViewDebug ) {
+				mPathTracer->readImage( &mTextureOut, &mTextureDebug );
+			}
+			else {
+				mPathTracer->readImageAsync( &mTextureOut );
+			}
+
+			mPreviousReadback = currentTime;
+		}
 	}
 
 	this->paintScene();
@@ -654,6 +752,24 @@ void GLWidget::resizeGL( int width, int height ) {
 }
 
 
+/**
+ * Select the next object to be moved with the keyboard.
+ */
+void GLWidget::selectNextObject() {
+	cl_uint numObjects = mPathTracer->getNumObjects();
+
+	if( numObjects == 0 ) {
+		return;
+	}
+
+	mSelectedObject = ( mSelectedObject + 1 ) % numObjects;
+
+	char msg[64];
+	snprintf( msg, 64, "[GLWidget] Selected object: %u", mSelectedObject );
+	Logger::logInfo( msg );
+}
+
+
 /**
  * Set the vertex array for the model overlay.
  * @param {std::vector<GLfloat>} vertices Vertices of the model.
@@ -864,6 +980,18 @@ void GLWidget::toggleLightMovement() {
 }
 
 
+/**
+ * Toggle movement of the selected object.
+ */
+void GLWidget::toggleObjectMovement() {
+	mMoveObject = !mMoveObject;
+
+	char msg[64];
+	snprintf( msg, 64, "[GLWidget] Keyboard controls object %u: %d", mSelectedObject, mMoveObject );
+	Logger::logInfo( msg );
+}
+
+
 /**
  * Toggle rendering of the BVH.
  */
@@ -876,6 +1004,12 @@ void GLWidget::toggleViewBVH() {
  * Toggle rendering of the BVH.
  */
 void GLWidget::toggleViewDebug() {
+	if( !mViewDebug && !Cfg::get().value<bool>( Cfg::RENDER_DEBUGIMAGE ) ) {
+		Logger::logWarning( "[GLWidget] The debug image is disabled. Enable \"render.debug_image\" in the config." );
+
+		return;
+	}
+
 	mViewDebug = !mViewDebug;
 }
 
@@ -65,12 +65,14 @@ class GLWidget : public QGLWidget {
 		QSize minimumSizeHint() const;
 		void modifyCameraStep( const float adjust );
 		void moveCamera( const int key );
+		void selectNextObject();
 		void resetRenderTime();
 		void showKernelWindow();
 		QSize sizeHint() const;
 		void startRendering();
 		void stopRendering();
 		void toggleLightMovement();
+		void toggleObjectMovement();
 
 		static const GLuint ATTRIB_POINTER_VERTEX = 0;
 		Camera* mCamera;
@@ -87,6 +89,7 @@ class GLWidget : public QGLWidget {
 		void initTargetTexture();
 		void loadShader( GLuint program, GLuint shader, string path );
 		void mousePressEvent( QMouseEvent* e );
+		void moveObject( const int key );
 		void paintGL();
 		void paintScene();
 		void resizeGL( int width, int height );
@@ -109,6 +112,7 @@ class GLWidget : public QGLWidget {
 	private:
 		bool mDoRendering;
 		bool mMoveLight;
+		bool mMoveObject;
 		bool mViewBVH;
 		bool mViewDebug;
 		bool mViewLights;
@@ -123,10 +127,13 @@ class GLWidget : public QGLWidget {
 		GLuint mGLProgramTracer;
 		GLuint mGLProgramSimple;
 		GLuint mIndexBuffer;
+		GLuint mSelectedObject;
 		GLuint mLightsNumIndices;
+		GLuint mPreviousReadback;
 		GLuint mPreviousTime;
 		GLuint mRenderStartTime;
 
+		AccelStructure* mAccelStruct;
 		InfoWindow* mInfoWindow;
 		QTimer* mTimer;
 		PathTracer* mPathTracer;
@@ -70,6 +70,31 @@ void InfoWindow::closeEvent( QCloseEvent* event ) {
 }
 
 
+/**
+ * Remove the names and times of the kernels from the layout.
+ */
+void InfoWindow::removeKernelNames() {
+	QLayoutItem* row;
+
+	while( ( row = mMainLayout->takeAt( 0 ) ) != NULL ) {
+		QLayout* rowLayout = row->layout();
+
+		if( rowLayout != NULL ) {
+			QLayoutItem* item;
+
+			while( ( item = rowLayout->takeAt( 0 ) ) != NULL ) {
+				delete item->widget();
+				delete item;
+			}
+		}
+
+		delete row;
+	}
+
+	mKernelLabels.clear();
+}
+
+
 /**
  * Callend when window gets opened.
  * @param {QShowEvent*} event
@@ -115,7 +140,20 @@ void InfoWindow::updateKernelTimes() {
 	char kt[16];
 
 	for( map<cl_kernel, double>::iterator it = kernelTimes.begin(); it != kernelTimes.end(); it++ ) {
+		map<cl_kernel, QLabel*>::iterator label = mKernelLabels.find( it->first );
+
+		// The kernels have been created anew, see CL::freeKernels().
+		if( label == mKernelLabels.end() ) {
+			this->removeKernelNames();
+			this->addKernelNames( mCL->getKernelNames() );
+			label = mKernelLabels.find( it->first );
+
+			if( label == mKernelLabels.end() ) {
+				continue;
+			}
+		}
+
 		snprintf( kt, 16, "%.2f ms", it->second );
-		mKernelLabels[it->first]->setText( tr( kt ) );
+		label->second->setText( tr( kt ) );
 	}
 }
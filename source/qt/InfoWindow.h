@@ -25,6 +25,7 @@ class InfoWindow : public QWidget {
 	protected:
 		void addKernelNames( map<cl_kernel, string> kernelNames );
 		void closeEvent( QCloseEvent* event );
+		void removeKernelNames();
 		void showEvent( QShowEvent* event );
 		void updateKernelTimes();
 
@@ -192,6 +192,14 @@ void Window::keyPressEvent( QKeyEvent* e ) {
 			mGLWidget->toggleLightMovement();
 			break;
 
+		case Qt::Key_O:
+			mGLWidget->toggleObjectMovement();
+			break;
+
+		case Qt::Key_N:
+			mGLWidget->selectNextObject();
+			break;
+
 		case Qt::Key_F:
 			mGLWidget->modifyCameraStep( 0.1f );
 			break;